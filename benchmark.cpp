@@ -0,0 +1,1365 @@
+/*
+Benchmarks of the stabilization building blocks.
+Run ./Benchmark from the build folder, no video sample needed:
+    ./Benchmark [kernels|warp|grass|morphology|stages|accuracy|drift|overlay|buffers|realtime|keyframes|shots|shared|masks]...   (everything by default)
+The stages and the accuracy are measured on synthetic sequences with a known camera movement.
+The exit status is 1 when an optimized result differs from its reference (MISMATCH), or when the stabilization
+in reused buffers allocates more than its OpenCV calls (TOO MANY ALLOCATIONS), so a section can be run as a test.
+*/
+
+#include "stabilization.hpp"
+#include "kernels.hpp"
+#include "warp.hpp"
+#include "morphology.hpp"
+#include "grass.hpp"
+#include "synthetic.hpp"
+#include "realtime.hpp"
+#include "overlay.hpp"
+#include "sharedframes.hpp"
+#include "masksidecar.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+
+
+#define BENCHMARK_ITERATIONS 50
+#define BENCHMARK_SEQUENCE_FRAMES 40
+#define BENCHMARK_SHARED_NAME "/stabilization_benchmark"
+#define BENCHMARK_SHARED_SLOTS 3      // few slots: the reader holds the writer back
+#define BENCHMARK_SIDECAR_PATH "benchmark_masks.msk"
+#define BENCHMARK_MASK_PROBES 2000    // pixels tested per mask
+#define BENCHMARK_WARMUP_FRAMES 3     // frames allocating the buffers of the Stabilizer
+#define BENCHMARK_ROLL_NOISE 1e-4     // camera roll of the shaky sequences (rad), the order of the estimation noise
+
+
+//*************************************************************************
+//                                 HELPERS                                *
+//*************************************************************************
+
+/*
+@return the current time in ms
+*/
+static double now()
+{
+    return (double)cvGetTickCount() / ((double)cvGetTickFrequency() * 1000.);
+}
+
+/*
+@return a random binary (0 / 255) mask with roughly ratio of its pixels set
+*/
+static Mat randomMask(Size size, double ratio, RNG& rng)
+{
+    Mat noise(size, CV_8U);
+    rng.fill(noise, RNG::UNIFORM, Scalar(0), Scalar(256));
+    Mat mask = cv::Mat::zeros(size, CV_8U);
+    mask.setTo(Scalar(255), noise < 256 * ratio);
+    return mask;
+}
+
+// Equivalence checks that failed: the exit status of the benchmark
+static int mismatches = 0;
+
+/*
+@param identical: the result of an equivalence check
+@return the word printed for it, the check is counted when it failed
+*/
+static const char* checkResult(bool identical)
+{
+    if ( !identical )
+    {
+        mismatches++;
+    }
+    return identical ? "identical" : "MISMATCH";
+}
+
+static void printResult(const string& name, Size size, double referenceTime, double optimizedTime, bool identical)
+{
+    printf("%-32s %4dx%-4d  reference %8.3f ms  optimized %8.3f ms  speedup x%5.2f  %s\n",
+           name.c_str(), size.width, size.height, referenceTime, optimizedTime,
+           referenceTime / optimizedTime, checkResult(identical));
+}
+
+
+//*************************************************************************
+//                              MASK KERNELS                              *
+//*************************************************************************
+
+// The scalar loops the kernels replace
+
+static void referenceCameraStabilizationMask(const Mat& maskGrass, const Mat& maskPublic, const Mat& maskScore, Mat& finalMask)
+{
+    finalMask = cv::Mat::zeros(maskGrass.rows, maskGrass.cols, CV_8U);
+    for ( int y = 0 ; y < maskGrass.rows ; y++ )
+    {
+        for ( int x = 0 ; x < maskGrass.cols ; x++ )
+        {
+            if ( maskGrass.at<uchar>(y, x) < 10 )
+            {
+                finalMask.at<uchar>(y, x) = 255;
+            }
+            if ( maskPublic.at<uchar>(y, x) > 250 )
+            {
+                finalMask.at<uchar>(y, x) = 0;
+            }
+            if ( maskScore.at<uchar>(y, x) > 250 )
+            {
+                finalMask.at<uchar>(y, x) = 255;
+            }
+        }
+    }
+}
+
+static void referenceSingularityMask(const Mat& maskPublic, const Mat& maskScore, const Mat& maskBorders, Mat& finalMask)
+{
+    finalMask = cv::Mat::zeros(maskPublic.rows, maskPublic.cols, CV_8U);
+    for ( int y = 0 ; y < maskPublic.rows ; y++ )
+    {
+        for ( int x = 0 ; x < maskPublic.cols ; x++ )
+        {
+            if ( maskPublic.at<uchar>(y, x) > 250 || maskScore.at<uchar>(y, x) > 250 || maskBorders.at<uchar>(y, x) > 250 )
+            {
+                finalMask.at<uchar>(y, x) = 255;
+            }
+        }
+    }
+}
+
+static void referenceSubstituteMaskedPixels(const Mat& blurredMask, const Mat& blurredFrame, Mat& frame)
+{
+    for ( int y = 0 ; y < frame.rows ; y++ )
+    {
+        for ( int x = 0 ; x < frame.cols ; x++ )
+        {
+            if ( blurredMask.at<uchar>(y, x) > 0 )
+            {
+                frame.at<Vec3b>(y, x) = blurredFrame.at<Vec3b>(y, x);
+            }
+        }
+    }
+}
+
+/*
+Compare the vectorized mask kernels with the scalar loops they replace
+@param size: the frame size
+*/
+static void benchmarkMaskKernels(Size size)
+{
+    RNG rng(42);
+    Mat maskGrass = randomMask(size, 0.7, rng);
+    Mat maskPublic = randomMask(size, 0.2, rng);
+    Mat maskScore = randomMask(size, 0.02, rng);
+    Mat maskBorders = getBorderMask(size.height, size.width, SINGULARITY_MASK_BORDER);
+    Mat blurredMask = randomMask(size, 0.3, rng);
+    Mat frame(size, CV_8UC3), blurredFrame(size, CV_8UC3);
+    randu(frame, Scalar::all(0), Scalar::all(256));
+    randu(blurredFrame, Scalar::all(0), Scalar::all(256));
+
+    Mat referenceMask, optimizedMask;
+    double start = now();
+    for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+    {
+        referenceCameraStabilizationMask(maskGrass, maskPublic, maskScore, referenceMask);
+    }
+    double referenceTime = (now() - start) / BENCHMARK_ITERATIONS;
+    start = now();
+    for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+    {
+        composeCameraStabilizationMask(maskGrass, maskPublic, maskScore, optimizedMask);
+    }
+    double optimizedTime = (now() - start) / BENCHMARK_ITERATIONS;
+    printResult("camera stabilization mask", size, referenceTime, optimizedTime, norm(referenceMask, optimizedMask, NORM_INF) == 0);
+
+    start = now();
+    for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+    {
+        referenceSingularityMask(maskPublic, maskScore, maskBorders, referenceMask);
+    }
+    referenceTime = (now() - start) / BENCHMARK_ITERATIONS;
+    start = now();
+    for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+    {
+        composeSingularityMask(maskPublic, maskScore, maskBorders, optimizedMask);
+    }
+    optimizedTime = (now() - start) / BENCHMARK_ITERATIONS;
+    printResult("singularity mask", size, referenceTime, optimizedTime, norm(referenceMask, optimizedMask, NORM_INF) == 0);
+
+    Mat referenceFrame, optimizedFrame;
+    referenceTime = 0;
+    optimizedTime = 0;
+    for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+    {
+        referenceFrame = frame.clone();
+        start = now();
+        referenceSubstituteMaskedPixels(blurredMask, blurredFrame, referenceFrame);
+        referenceTime += now() - start;
+        optimizedFrame = frame.clone();
+        start = now();
+        substituteMaskedPixels(blurredMask, blurredFrame, optimizedFrame);
+        optimizedTime += now() - start;
+    }
+    printResult("masked blur substitution", size, referenceTime / BENCHMARK_ITERATIONS, optimizedTime / BENCHMARK_ITERATIONS,
+                norm(referenceFrame, optimizedFrame, NORM_INF) == 0);
+}
+
+
+/*
+Compare the masked blur with the two full frame blurs and the substitution it replaces,
+on the real camera stabilization mask of a synthetic frame
+@param size: the frame size
+*/
+static void benchmarkMaskedBlur(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, 1);
+    Mat frame = addBlackBorder(sequence.frames[0], BORDER_WIDTH, BORDER_HEIGHT);
+    Mat mask = getMaskOfIrrelevantAreasForCameraStabilization(frame);
+
+    Mat referenceFrame, optimizedFrame;
+    double referenceTime = 0, optimizedTime = 0;
+    for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+    {
+        referenceFrame = frame.clone();
+        double start = now();
+        Mat blurredMask, blurredFrame;
+        blur(mask, blurredMask, Size(30, 30));
+        blur(frame, blurredFrame, Size(30, 30));
+        substituteMaskedPixels(blurredMask, blurredFrame, referenceFrame);
+        referenceTime += now() - start;
+        optimizedFrame = frame.clone();
+        start = now();
+        blurMaskedPixels(mask, frame, optimizedFrame, 30);
+        optimizedTime += now() - start;
+    }
+    printResult("masked blur", size, referenceTime / BENCHMARK_ITERATIONS, optimizedTime / BENCHMARK_ITERATIONS,
+                norm(referenceFrame, optimizedFrame, NORM_INF) == 0);
+}
+
+
+//*************************************************************************
+//                                  WARP                                  *
+//*************************************************************************
+
+/*
+Kernel of each motion model against warpAffine() of the snapped movement, on a frame and on a mask,
+with the pixels that differ from warpAffine() of the movement itself
+@param size: the frame size
+*/
+static void benchmarkWarp(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, 1);
+    Mat mask = detectGrass(sequence.frames[0]);
+    const double angle = 0.5 * CV_PI / 180;
+    // The near movements have the rotation and scale noise of an estimation: within WARP_SNAP_TOLERANCE
+    // of the cheaper model across the widest frame
+    const Mat movements[] = {
+        (Mat_<double>(2, 3) << 1, 0, 3.4, 0, 1, -2.6),
+        (Mat_<double>(2, 3) << 1 + 2e-4, -1.5e-4, 3.4, 1.5e-4, 1 + 2e-4, -2.6),
+        (Mat_<double>(2, 3) << 1.02, 0, -7.3, 0, 1.02, 4.1),
+        (Mat_<double>(2, 3) << 1.02, -3e-4, -7.3, 3e-4, 1.02, 4.1),
+        (Mat_<double>(2, 3) << 1.01 * cos(angle), -1.01 * sin(angle), 5.2, 1.01 * sin(angle), 1.01 * cos(angle), -3.7)
+    };
+    const char* names[] = { "translation", "near translation", "similarity", "near similarity", "affine" };
+    const MotionModel expected[] = { MOTION_TRANSLATION, MOTION_TRANSLATION, MOTION_SIMILARITY, MOTION_SIMILARITY, MOTION_AFFINE };
+    const int movementCount = sizeof(movements) / sizeof(movements[0]);
+    for ( int m = 0 ; m < movementCount ; m++ )
+    {
+        Mat snapped;
+        MotionModel model = classifyMotion(movements[m], size, snapped);
+        for ( int isMask = 0 ; isMask < 2 ; isMask++ )
+        {
+            const Mat& frame = isMask ? mask : sequence.frames[0];
+            Mat reference, warped, unsnapped;
+            double referenceTime = 0, optimizedTime = 0;
+            for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+            {
+                double start = now();
+                warpAffine(frame, reference, snapped, frame.size(), INTER_NEAREST | WARP_INVERSE_MAP);
+                referenceTime += now() - start;
+                start = now();
+                warpNearest(frame, movements[m], warped);
+                optimizedTime += now() - start;
+            }
+            warpAffine(frame, unsnapped, movements[m], frame.size(), INTER_NEAREST | WARP_INVERSE_MAP);
+            string name = string("warp ") + names[m] + ( model == expected[m] ? "" : " (other model)" ) + ( isMask ? " mask" : "" );
+            printResult(name, size, referenceTime / BENCHMARK_ITERATIONS, optimizedTime / BENCHMARK_ITERATIONS,
+                        norm(reference, warped, NORM_INF) == 0);
+            if ( model != MOTION_AFFINE && norm(snapped, movements[m], NORM_INF) > 0 )
+            {
+                printf("%-32s %4dx%-4d  pixels moved by the snap: %d\n", name.c_str(), size.width, size.height,
+                       countNonZero(unsnapped.reshape(1) != warped.reshape(1)));
+            }
+        }
+    }
+}
+
+/*
+The kernels on the movements the Stabilizer estimates on a synthetic sequence: how often each
+model is used, the time against warpAffine(), and the pixels moved by the snap
+@param size: the frame size
+@param motion: the camera path of the sequence
+@param sequenceName: printed with the results
+*/
+static void benchmarkEstimatedWarps(Size size, const SyntheticMotion& motion, const char* sequenceName)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES, 42, motion);
+    Stabilizer stabilizer;
+    const char* names[] = { "translation", "similarity", "affine" };
+    int hits[3] = { 0, 0, 0 };
+    double referenceTime = 0, optimizedTime = 0, snappedPixels = 0;
+    bool identical = true;
+    int warps = 0;
+    Mat reference, warped, snapped;
+    for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+    {
+        Mat homography = stabilizer.estimate(prepareFrame(sequence.frames[i]));
+        if ( homography.empty() )
+        {
+            continue;
+        }
+        const Mat& frame = sequence.frames[i];
+        MotionModel model = classifyMotion(homography, frame.size(), snapped);
+        hits[model]++;
+        double start = now();
+        warpAffine(frame, reference, homography, frame.size(), INTER_NEAREST | WARP_INVERSE_MAP);
+        referenceTime += now() - start;
+        start = now();
+        warpNearest(frame, homography, warped);
+        optimizedTime += now() - start;
+        snappedPixels += (double)countNonZero(reference.reshape(1) != warped.reshape(1)) / reference.total();
+        // The kernel is exact for the snapped movement
+        warpAffine(frame, reference, snapped, frame.size(), INTER_NEAREST | WARP_INVERSE_MAP);
+        identical = identical && norm(reference, warped, NORM_INF) == 0;
+        warps++;
+    }
+    if ( warps == 0 )
+    {
+        return;
+    }
+    printResult(string("warp (estimated, ") + sequenceName + ")", size, referenceTime / warps, optimizedTime / warps, identical);
+    printf("%4dx%-4d  kernels used: %s %d, %s %d, %s %d  values moved by the snap: %.4f%%\n", size.width, size.height,
+           names[MOTION_TRANSLATION], hits[MOTION_TRANSLATION], names[MOTION_SIMILARITY], hits[MOTION_SIMILARITY],
+           names[MOTION_AFFINE], hits[MOTION_AFFINE], 100. * snappedPixels / warps);
+}
+
+
+//*************************************************************************
+//                                 GRASS                                  *
+//*************************************************************************
+
+/*
+The grass detection the lookup table replaces: the frame converted to HSV, thresholded with inRange()
+@return mask of the field
+*/
+static Mat referenceGrass(const Mat frame)
+{
+    Scalar lower, upper;
+    getGrassThresholds(lower, upper);
+    Mat HSV, threshold;
+    cvtColor(frame, HSV, CV_BGR2HSV);
+    inRange(HSV, lower, upper, threshold);
+    return threshold;
+}
+
+/*
+Compare the grass lookup table with the HSV conversion and inRange() it replaces,
+on a synthetic frame and on random colors, for a few quantizations of the table
+@param size: the frame size
+*/
+static void benchmarkGrass(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, 1);
+    Mat noise(size, CV_8UC3);
+    RNG rng(42);
+    randu(noise, Scalar::all(0), Scalar::all(256));
+    const Mat frames[] = { sequence.frames[0], noise };
+    const char* frameNames[] = { "synthetic", "random" };
+    Scalar lower, upper;
+    getGrassThresholds(lower, upper);
+
+    for ( int quantization = 0 ; quantization <= 2 ; quantization++ )
+    {
+        GrassClassifier classifier;
+        double start = now();
+        classifier.setThresholds(lower, upper, quantization);
+        double buildTime = now() - start;
+        for ( int f = 0 ; f < 2 ; f++ )
+        {
+            Mat reference, optimized;
+            start = now();
+            for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+            {
+                reference = referenceGrass(frames[f]);
+            }
+            double referenceTime = (now() - start) / BENCHMARK_ITERATIONS;
+            start = now();
+            for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+            {
+                classifier.classify(frames[f], optimized);
+            }
+            double optimizedTime = (now() - start) / BENCHMARK_ITERATIONS;
+            double agreement = 1. - (double)countNonZero(reference != optimized) / reference.total();
+            ostringstream name;
+            name << "grass table q" << quantization << " " << frameNames[f];
+            printResult(name.str(), size, referenceTime, optimizedTime, agreement == 1);
+            printf("    table built in %.1f ms, agreement %.4f%%\n", buildTime, 100. * agreement);
+        }
+    }
+}
+
+
+//*************************************************************************
+//                               MORPHOLOGY                               *
+//*************************************************************************
+
+/*
+Compare the running min / max morphology with erode() and dilate(), for every element size
+of the masks, on the grass mask of a synthetic frame
+@param size: the frame size
+*/
+static void benchmarkMorphology(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, 1);
+    Mat grass = detectGrass(addBlackBorder(sequence.frames[0], BORDER_WIDTH, BORDER_HEIGHT));
+    const int radiuses[] = { FIELD_MASK_DILATION_SIZE, FIELD_MASK_EROSION_SIZE, PUBLIC_MASK_EROSION_SIZE, PUBLIC_MASK_DILATION_SIZE };
+
+    for ( int r = 0 ; r < 4 ; r++ )
+    {
+        int radius = radiuses[r];
+        Mat element = getStructuringElement(MORPH_RECT, Size(2 * radius + 1, 2 * radius + 1), Point(radius, radius));
+        for ( int dilation = 0 ; dilation < 2 ; dilation++ )
+        {
+            Mat reference, optimized;
+            double start = now();
+            for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+            {
+                if ( dilation )
+                {
+                    dilate(grass, reference, element);
+                }
+                else
+                {
+                    erode(grass, reference, element);
+                }
+            }
+            double referenceTime = (now() - start) / BENCHMARK_ITERATIONS;
+            start = now();
+            for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+            {
+                if ( dilation )
+                {
+                    dilateRectangle(grass, optimized, radius);
+                }
+                else
+                {
+                    erodeRectangle(grass, optimized, radius);
+                }
+            }
+            double optimizedTime = (now() - start) / BENCHMARK_ITERATIONS;
+            ostringstream name;
+            name << ( dilation ? "dilation " : "erosion " ) << 2 * radius + 1 << "x" << 2 * radius + 1;
+            printResult(name.str(), grass.size(), referenceTime, optimizedTime, norm(reference, optimized, NORM_INF) == 0);
+        }
+    }
+}
+
+
+//*************************************************************************
+//                                 STAGES                                 *
+//*************************************************************************
+
+/*
+Time of every stage of the stabilization, averaged over a synthetic sequence
+@param size: the frame size
+*/
+static void benchmarkStages(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES);
+    const char* stages[] = { "addBlackBorder", "grass detection", "field morphology", "public morphology",
+                             "mask composition", "preProccessingStabilization", "estimateRigidTransform", "warp" };
+    const int stageCount = sizeof(stages) / sizeof(stages[0]);
+    vector<double> times(stageCount, 0);
+
+    Mat previousProcessed;
+    for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+    {
+        const Mat frame = sequence.frames[i];
+        int stage = 0;
+        double start = now();
+        Mat bordered = addBlackBorder(frame, BORDER_WIDTH, BORDER_HEIGHT);
+        times[stage++] += now() - start;
+
+        start = now();
+        Mat grass = detectGrass(bordered);
+        times[stage++] += now() - start;
+
+        start = now();
+        Mat field = grass.clone();
+        dilateMask(field, FIELD_MASK_DILATION_SIZE);
+        erodeMask(field, FIELD_MASK_EROSION_SIZE);
+        times[stage++] += now() - start;
+
+        start = now();
+        Mat publicArea = grass.clone();
+        erodeMask(publicArea, PUBLIC_MASK_EROSION_SIZE);
+        dilateMask(publicArea, PUBLIC_MASK_DILATION_SIZE);
+        publicArea = 255 - publicArea;
+        times[stage++] += now() - start;
+
+        start = now();
+        Mat mask;
+        composeCameraStabilizationMask(field, publicArea, detectScoreOverlayPanel(bordered, BORDER_HEIGHT/2, BORDER_WIDTH/2), mask);
+        times[stage++] += now() - start;
+
+        start = now();
+        Mat processed = preProccessingStabilization(bordered);
+        times[stage++] += now() - start;
+
+        if ( !previousProcessed.empty() )
+        {
+            start = now();
+            Mat homography = estimateRigidTransform(previousProcessed, processed, false);
+            times[stage++] += now() - start;
+
+            start = now();
+            if ( !homography.empty() )
+            {
+                applyHomography(frame, homography);
+            }
+            times[stage++] += now() - start;
+        }
+        previousProcessed = processed;
+    }
+
+    int pairs = MAX((int)sequence.frames.size() - 1, 1);
+    for ( int stage = 0 ; stage < stageCount ; stage++ )
+    {
+        // The last two stages work on pairs of frames
+        double perFrame = times[stage] / ( stage >= stageCount - 2 ? pairs : sequence.frames.size() );
+        printf("%4dx%-4d  %-30s %8.3f ms\n", size.width, size.height, stages[stage], perFrame);
+    }
+}
+
+
+//*************************************************************************
+//                                ACCURACY                                *
+//*************************************************************************
+
+/*
+Detection time and error against the ground truth of every movement detection mode
+@param size: the frame size
+*/
+static void benchmarkAccuracy(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES);
+    const EstimationMode modes[] = { ESTIMATION_FULL, ESTIMATION_PYRAMID, ESTIMATION_TRACKING };
+    const char* modeNames[] = { "full", "pyramid", "tracking" };
+
+    // The pre processing is shared by all the modes
+    vector<PreparedFrame> prepared;
+    for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+    {
+        prepared.push_back(prepareFrame(sequence.frames[i]));
+    }
+
+    for ( int m = 0 ; m < 3 ; m++ )
+    {
+        StabilizerSettings settings;
+        settings.estimationMode = modes[m];
+        Stabilizer stabilizer(settings);
+        double time = 0, meanError = 0, maxError = 0;
+        int failures = 0, pairs = 0;
+        for ( size_t i = 0 ; i < prepared.size() ; i++ )
+        {
+            // Each mode gets its own copy: the pyramid mode adds its pyramids to the frames
+            PreparedFrame frame = prepared[i];
+            frame.pyramid.clear();
+            double start = now();
+            Mat homography = stabilizer.estimate(frame);
+            time += now() - start;
+            if ( i == 0 )
+            {
+                continue;
+            }
+            pairs++;
+            if ( homography.empty() )
+            {
+                failures++;
+                continue;
+            }
+            double error = homographyError(homography, sequence.homographies[i], size);
+            meanError += error;
+            maxError = MAX(maxError, error);
+        }
+        int found = MAX(pairs - failures, 1);
+        printf("%4dx%-4d  %-10s detection %8.3f ms/frame  error mean %6.2f px  max %6.2f px  failures %d/%d\n",
+               size.width, size.height, modeNames[m], time / MAX(pairs, 1), meanError / found, maxError, failures, pairs);
+    }
+}
+
+
+//*************************************************************************
+//                            REDUCED MASKS                               *
+//*************************************************************************
+
+/*
+Drift of the masks computed at a lower resolution from the full resolution ones:
+share of the mask pixels that differ, difference of the detected movements, and error against the ground truth
+@param size: the frame size
+*/
+static void benchmarkMaskDrift(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES);
+    vector<PreparedFrame> fullResolution;
+    vector<Mat> fullHomographies;
+    Stabilizer fullStabilizer;
+    double fullTime = 0, fullError = 0;
+    for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+    {
+        double start = now();
+        fullResolution.push_back(prepareFrame(sequence.frames[i]));
+        fullTime += now() - start;
+        fullHomographies.push_back(fullStabilizer.estimate(fullResolution.back()));
+        if ( i > 0 && !fullHomographies.back().empty() )
+        {
+            fullError += homographyError(fullHomographies.back(), sequence.homographies[i], size);
+        }
+    }
+    int pairs = MAX((int)sequence.frames.size() - 1, 1);
+    printf("%4dx%-4d  downscale 1  pre processing %8.3f ms/frame                                                   error %6.2f px\n",
+           size.width, size.height, fullTime / sequence.frames.size(), fullError / pairs);
+
+    const int downscales[] = { 2, 3, 4 };
+    for ( int d = 0 ; d < 3 ; d++ )
+    {
+        Stabilizer stabilizer;
+        double time = 0, disagreement = 0, drift = 0, maxDrift = 0, error = 0;
+        for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+        {
+            double start = now();
+            PreparedFrame prepared = prepareFrame(sequence.frames[i], downscales[d]);
+            time += now() - start;
+            disagreement += (double)countNonZero(prepared.mask != fullResolution[i].mask) / prepared.mask.total();
+            Mat homography = stabilizer.estimate(prepared);
+            if ( i == 0 || homography.empty() || fullHomographies[i].empty() )
+            {
+                continue;
+            }
+            double difference = homographyError(homography, fullHomographies[i], size);
+            drift += difference;
+            maxDrift = MAX(maxDrift, difference);
+            error += homographyError(homography, sequence.homographies[i], size);
+        }
+        printf("%4dx%-4d  downscale %d  pre processing %8.3f ms/frame  mask disagreement %5.2f%%  drift mean %6.2f px  max %6.2f px  error %6.2f px\n",
+               size.width, size.height, downscales[d], time / sequence.frames.size(),
+               100. * disagreement / sequence.frames.size(), drift / pairs, maxDrift, error / pairs);
+    }
+}
+
+
+//*************************************************************************
+//                                BUFFERS                                 *
+//*************************************************************************
+
+// Heap allocations made while countingAllocations is set, by any thread
+static std::atomic<bool> countingAllocations(false);
+static std::atomic<long long> allocations(0);
+
+#if defined(__GLIBC__)
+/*
+The allocation functions of the C library are replaced by counting ones: they catch the allocations
+of operator new, of the Mat (fastMalloc) and of OpenCV itself
+*/
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* pointer);
+}
+
+static inline void* countAllocation(void* pointer)
+{
+    if ( pointer != NULL && countingAllocations.load(std::memory_order_relaxed) )
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    return pointer;
+}
+
+extern "C" void* malloc(size_t size) throw()
+{
+    return countAllocation(__libc_malloc(size));
+}
+
+extern "C" void* calloc(size_t count, size_t size) throw()
+{
+    return countAllocation(__libc_calloc(count, size));
+}
+
+extern "C" void* realloc(void* pointer, size_t size) throw()
+{
+    return countAllocation(__libc_realloc(pointer, size));
+}
+
+extern "C" void free(void* pointer) throw()
+{
+    __libc_free(pointer);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) throw()
+{
+    return countAllocation(__libc_memalign(alignment, size));
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) throw()
+{
+    return countAllocation(__libc_memalign(alignment, size));
+}
+
+extern "C" int posix_memalign(void** pointer, size_t alignment, size_t size) throw()
+{
+    void* allocated = countAllocation(__libc_memalign(alignment, size));
+    if ( allocated == NULL && size > 0 )
+    {
+        return ENOMEM;
+    }
+    *pointer = allocated;
+    return 0;
+}
+#endif
+
+/*
+Stabilization in the buffers of the Stabilizer against the allocating one: time, identical frames,
+buffers reallocated once the first frames allocated them, and heap allocations per frame.
+Once the buffers are allocated, the only allowed allocations are the ones of the OpenCV calls
+(see Stabilizer::stabilize()): they are counted on the same inputs, and the stabilization must not make more
+@param size: the frame size
+*/
+static void benchmarkBuffers(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES);
+    Stabilizer allocating, buffered;
+    Mat stabilizedFrame, previousProcessed, warpedFrame(size, CV_8UC3), grassMask(size, CV_8U, Scalar(0)), warpedMask(size, CV_8U);
+    double allocatingTime = 0, bufferedTime = 0;
+    bool identical = true;
+    long long stabilizerAllocations = 0, allowedAllocations = 0;
+    for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+    {
+        double start = now();
+        Mat reference = allocating.stabilize(sequence.frames[i]);
+        allocatingTime += now() - start;
+
+        const bool counted = i >= BENCHMARK_WARMUP_FRAMES;
+        if ( counted )
+        {
+            buffered.getPreviousFrame().processedFrame.copyTo(previousProcessed);
+        }
+        start = now();
+        allocations = 0;
+        countingAllocations = counted;
+        buffered.stabilize(sequence.frames[i], stabilizedFrame);
+        countingAllocations = false;
+        stabilizerAllocations += allocations;
+        bufferedTime += now() - start;
+        identical = identical && countNonZero(reference.reshape(1) != stabilizedFrame.reshape(1)) == 0;
+
+        if ( counted )
+        {
+            // The OpenCV calls of the stabilization, on the same inputs: the movement detection,
+            // and the warps of the frame and of its grass mask when the movement has a rotation
+            const Mat homography = buffered.getLastHomography();
+            allocations = 0;
+            countingAllocations = true;
+            estimateRigidTransform(previousProcessed, buffered.getPreviousFrame().processedFrame, false);
+            if ( !homography.empty() && classifyMotion(homography, size) == MOTION_AFFINE )
+            {
+                warpAffine(sequence.frames[i], warpedFrame, homography, size, INTER_NEAREST | WARP_INVERSE_MAP);
+                warpAffine(grassMask, warpedMask, homography, size, INTER_NEAREST | WARP_INVERSE_MAP);
+            }
+            countingAllocations = false;
+            allowedAllocations += allocations;
+        }
+    }
+    printResult("stabilize (buffers)", size, allocatingTime / sequence.frames.size(), bufferedTime / sequence.frames.size(), identical);
+    printf("%4dx%-4d  buffers reallocated after the first frames: %d\n", size.width, size.height, buffered.getReallocationCount());
+#if defined(__GLIBC__)
+    const int countedFrames = sequence.frames.size() - BENCHMARK_WARMUP_FRAMES;
+    const bool withinAllowance = stabilizerAllocations <= allowedAllocations;
+    if ( !withinAllowance )
+    {
+        mismatches++;
+    }
+    printf("%4dx%-4d  heap allocations per frame after the first frames: %6.1f  (OpenCV calls: %6.1f)  %s\n",
+           size.width, size.height, (double)stabilizerAllocations / countedFrames, (double)allowedAllocations / countedFrames,
+           withinAllowance ? "ok" : "TOO MANY ALLOCATIONS");
+#else
+    printf("%4dx%-4d  heap allocations not counted: they are counted with the GNU C library only\n", size.width, size.height);
+#endif
+}
+
+
+//*************************************************************************
+//                             SHARED FRAMES                              *
+//*************************************************************************
+
+/*
+Stabilization into the slots of the shared memory ring against a stabilization followed by a copy,
+with a reader on another thread checking the order and the content of the frames it receives
+@param size: the frame size
+*/
+static void benchmarkSharedFrames(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES);
+    const int frames = sequence.frames.size();
+
+    // The reference: the stabilized frames copied out of the stabilizer buffer
+    vector<Mat> references(frames);
+    Stabilizer copying;
+    Mat stabilizedFrame;
+    double copyingTime = 0;
+    for ( int i = 0 ; i < frames ; i++ )
+    {
+        double start = now();
+        copying.stabilize(sequence.frames[i], stabilizedFrame);
+        stabilizedFrame.copyTo(references[i]);
+        copyingTime += now() - start;
+    }
+
+    SharedFrameWriter writer;
+    if ( !writer.open(BENCHMARK_SHARED_NAME, size, BENCHMARK_SHARED_SLOTS) )
+    {
+        return;
+    }
+    vector<double> commitTimes(frames, 0);
+    std::atomic<bool> attached(false);
+    int received = 0;
+    bool inOrder = true, identical = true;
+    double latency = 0;
+    std::thread readerThread([&]()
+    {
+        SharedFrameReader reader;
+        attached = reader.open(BENCHMARK_SHARED_NAME);
+        SharedFrame frame;
+        while ( attached && received < frames && reader.next(frame, 1000) )
+        {
+            latency += now() - commitTimes[frame.frameIndex];
+            inOrder = inOrder && frame.frameIndex == received && frame.sequence == (uint64_t)received;
+            identical = identical && countNonZero(frame.frame.reshape(1) != references[frame.frameIndex].reshape(1)) == 0;
+            received++;
+        }
+    });
+    while ( !attached )
+    {
+        std::this_thread::yield();
+    }
+
+    Stabilizer sharing;
+    Mat slotMask;
+    double sharingTime = 0;
+    for ( int i = 0 ; i < frames ; i++ )
+    {
+        double start = now();
+        writer.beginFrame(stabilizedFrame, slotMask);
+        sharing.stabilize(sequence.frames[i], stabilizedFrame);
+        sharingTime += now() - start;
+        getMaskOfIrrelevantAreasForSingularities(sharing.getStabilizedFrameAnalysis(), slotMask);
+        commitTimes[i] = now();
+        writer.commitFrame(sharing.getLastHomography(), i);
+    }
+    readerThread.join();
+    // Without the waits for the reader: the cost of the writer alone
+    const double waitingTime = writer.getWaitingTime();
+    writer.close();
+
+    printResult("stabilize (shared)", size, copyingTime / frames, ( sharingTime - waitingTime ) / frames,
+                identical && inOrder && received == frames);
+    printf("%4dx%-4d  frames received %d/%d in order %s  latency %6.3f ms  writer held back %8.3f ms/frame  reallocations %d\n",
+           size.width, size.height, received, frames, inOrder ? "yes" : "no", latency / MAX(received, 1),
+           waitingTime / frames, sharing.getReallocationCount());
+}
+
+
+//*************************************************************************
+//                              MASK SPANS                                *
+//*************************************************************************
+
+/*
+Run length encoding of the masks of a stabilized sequence: size, encoding and decoding cost,
+pixel tests on the spans against the tests on the decoded masks, and a round trip through a sidecar file
+@param size: the frame size
+*/
+static void benchmarkMaskSpans(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES);
+    const int frames = sequence.frames.size();
+    Stabilizer stabilizer;
+    Mat stabilizedFrame;
+    vector<Mat> singularityMasks(frames), cameraMasks(frames);
+    for ( int i = 0 ; i < frames ; i++ )
+    {
+        stabilizer.stabilize(sequence.frames[i], stabilizedFrame);
+        getMaskOfIrrelevantAreasForSingularities(stabilizer.getStabilizedFrameAnalysis(), singularityMasks[i]);
+        stabilizer.getPreviousFrame().mask.copyTo(cameraMasks[i]);
+    }
+
+    MaskSidecarWriter writer;
+    if ( !writer.open(BENCHMARK_SIDECAR_PATH, size) )
+    {
+        cerr << "[ERROR]: Could not create \"" << BENCHMARK_SIDECAR_PATH << "\"" << endl;
+        return;
+    }
+    MaskSidecarFrame frame;
+    Mat decoded;
+    double encodingTime = 0, decodingTime = 0, decodedTestTime = 0, spansTestTime = 0;
+    uint64_t rawBytes = 0;
+    bool identical = true;
+    for ( int i = 0 ; i < frames ; i++ )
+    {
+        double start = now();
+        frame.frameIndex = i;
+        frame.singularities.encode(singularityMasks[i]);
+        frame.camera.encode(cameraMasks[i]);
+        encodingTime += now() - start;
+        writer.write(frame);
+        rawBytes += singularityMasks[i].total() + cameraMasks[i].total();
+
+        // A detector testing some pixels of the frame: decode the mask first, or test the spans
+        start = now();
+        frame.singularities.decode(decoded);
+        decodingTime += now() - start;
+        identical = identical && countNonZero(decoded != singularityMasks[i]) == 0;
+        // The same pixels for both tests
+        int decodedHits = 0, spansHits = 0;
+        RNG rng(size.area() + i);
+        start = now();
+        for ( int k = 0 ; k < BENCHMARK_MASK_PROBES ; k++ )
+        {
+            int x = rng.uniform(0, size.width), y = rng.uniform(0, size.height);
+            decodedHits += decoded.at<uchar>(y, x) != 0;
+        }
+        decodedTestTime += now() - start;
+        rng = RNG(size.area() + i);
+        start = now();
+        for ( int k = 0 ; k < BENCHMARK_MASK_PROBES ; k++ )
+        {
+            int x = rng.uniform(0, size.width), y = rng.uniform(0, size.height);
+            spansHits += frame.singularities.contains(x, y);
+        }
+        spansTestTime += now() - start;
+        identical = identical && decodedHits == spansHits && frame.singularities.countNonZero() == countNonZero(singularityMasks[i]);
+    }
+    writer.close();
+
+    // Random access: the frames read backwards
+    MaskSidecarReader reader;
+    bool roundTrip = reader.open(BENCHMARK_SIDECAR_PATH) && reader.getFrameCount() == frames;
+    for ( int i = frames - 1 ; i >= 0 && roundTrip ; i-- )
+    {
+        roundTrip = reader.read(i, frame) && frame.frameIndex == i;
+        frame.singularities.decode(decoded);
+        roundTrip = roundTrip && countNonZero(decoded != singularityMasks[i]) == 0;
+        frame.camera.decode(decoded);
+        roundTrip = roundTrip && countNonZero(decoded != cameraMasks[i]) == 0;
+    }
+    uint64_t fileSize = writer.getFileSize();
+    reader.close();
+    remove(BENCHMARK_SIDECAR_PATH);
+
+    printResult("pixel tests (spans)", size, ( decodingTime + decodedTestTime ) / frames, spansTestTime / frames, identical);
+    printf("%4dx%-4d  encoding %8.3f ms/frame  decoding %8.3f ms/frame  %7.1f kB/frame instead of %7.1f kB (x%.0f)  sidecar round trip %s\n",
+           size.width, size.height, encodingTime / frames, decodingTime / frames, fileSize / 1e3 / frames, rawBytes / 1e3 / frames,
+           rawBytes / (double)MAX(fileSize, (uint64_t)1), checkResult(roundTrip));
+}
+
+
+//*************************************************************************
+//                               KEYFRAMES                                *
+//*************************************************************************
+
+/*
+Keyframe detection against the detection on every frame: cost, difference of the movements and error against the ground truth
+@param size: the frame size
+*/
+static void benchmarkKeyframes(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES);
+    Mat stabilizedFrame;
+    vector<Mat> fullHomographies;
+    Stabilizer fullStabilizer;
+    double fullTime = 0, fullError = 0;
+    for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+    {
+        double start = now();
+        fullStabilizer.stabilize(sequence.frames[i], stabilizedFrame);
+        fullTime += now() - start;
+        fullHomographies.push_back(fullStabilizer.getLastHomography().clone());
+        if ( i > 0 && !fullHomographies.back().empty() )
+        {
+            fullError += homographyError(fullHomographies.back(), sequence.homographies[i], size);
+        }
+    }
+    int pairs = MAX((int)sequence.frames.size() - 1, 1);
+    printf("%4dx%-4d  every frame      %8.3f ms/frame                                                error %6.2f px\n",
+           size.width, size.height, fullTime / sequence.frames.size(), fullError / pairs);
+
+    const int intervals[] = { 2, 4, 8, 8 };
+    for ( int k = 0 ; k < 4 ; k++ )
+    {
+        StabilizerSettings settings;
+        settings.keyframeInterval = intervals[k];
+        settings.adaptiveKeyframes = k == 3;
+        Stabilizer stabilizer(settings);
+        double time = 0, difference = 0, maxDifference = 0, error = 0;
+        for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+        {
+            double start = now();
+            stabilizer.stabilize(sequence.frames[i], stabilizedFrame);
+            time += now() - start;
+            Mat homography = stabilizer.getLastHomography();
+            if ( i == 0 || homography.empty() || fullHomographies[i].empty() )
+            {
+                continue;
+            }
+            double frameDifference = homographyError(homography, fullHomographies[i], size);
+            difference += frameDifference;
+            maxDifference = MAX(maxDifference, frameDifference);
+            error += homographyError(homography, sequence.homographies[i], size);
+        }
+        printf("%4dx%-4d  keyframes %d%-5s %8.3f ms/frame  keyframes %2d (%d forced)  against every frame %6.2f px  max %6.2f px  error %6.2f px\n",
+               size.width, size.height, intervals[k], settings.adaptiveKeyframes ? " auto" : "", time / sequence.frames.size(),
+               stabilizer.getKeyframeCount(), stabilizer.getForcedKeyframeCount(), difference / pairs, maxDifference, error / pairs);
+    }
+}
+
+
+//*************************************************************************
+//                                 SHOTS                                  *
+//*************************************************************************
+
+/*
+Shot detection on a synthetic broadcast: a wide shot, a cut to a tighter shot of the pitch,
+then a close-up of the stands. Cost of the detection, classification, and stabilization time with and without it
+@param size: the frame size
+*/
+static void benchmarkShots(Size size)
+{
+    SyntheticSequence wide = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES / 2);
+    SyntheticSequence other = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES / 2, 7);
+    vector<Mat> frames;
+    vector<ShotTransition> expected;
+    for ( size_t i = 0 ; i < wide.frames.size() ; i++ )
+    {
+        frames.push_back(wide.frames[i]);
+        expected.push_back(i == 0 ? SHOT_CUT : SHOT_CONTINUOUS);
+    }
+    for ( size_t i = 0 ; i < other.frames.size() ; i++ )
+    {
+        // Twice closer, on the pitch only
+        Mat tight;
+        resize(other.frames[i](Rect(size.width / 4, size.height / 2, size.width / 2, size.height / 2)), tight, size);
+        frames.push_back(tight);
+        expected.push_back(i == 0 ? SHOT_CUT : SHOT_CONTINUOUS);
+    }
+    for ( int i = 0 ; i < 5 ; i++ )
+    {
+        // The stands, filmed from close
+        Mat closeUp;
+        resize(wide.frames.back()(Rect(i * 4, 0, size.width / 4, size.height / 8)), closeUp, size);
+        frames.push_back(closeUp);
+        expected.push_back(SHOT_NON_PITCH);
+    }
+
+    ShotDetector detector;
+    double time = 0;
+    int confusion[3][3] = { { 0 } };
+    for ( size_t i = 0 ; i < frames.size() ; i++ )
+    {
+        double start = now();
+        ShotTransition found = detector.process(frames[i]);
+        time += now() - start;
+        confusion[expected[i]][found]++;
+    }
+    printf("%4dx%-4d  detection %6.3f ms/frame  continuous %2d/%2d (%d cuts)  cuts %d/%d  off the pitch %d/%d\n",
+           size.width, size.height, time / frames.size(), confusion[SHOT_CONTINUOUS][SHOT_CONTINUOUS],
+           confusion[SHOT_CONTINUOUS][0] + confusion[SHOT_CONTINUOUS][1] + confusion[SHOT_CONTINUOUS][2], confusion[SHOT_CONTINUOUS][SHOT_CUT],
+           confusion[SHOT_CUT][SHOT_CUT], confusion[SHOT_CUT][0] + confusion[SHOT_CUT][1] + confusion[SHOT_CUT][2],
+           confusion[SHOT_NON_PITCH][SHOT_NON_PITCH], confusion[SHOT_NON_PITCH][0] + confusion[SHOT_NON_PITCH][1] + confusion[SHOT_NON_PITCH][2]);
+
+    for ( int detectCuts = 0 ; detectCuts < 2 ; detectCuts++ )
+    {
+        StabilizerSettings settings;
+        settings.detectCuts = detectCuts == 1;
+        Stabilizer stabilizer(settings);
+        Mat stabilizedFrame;
+        double stabilizationTime = 0;
+        int failures = 0;
+        for ( size_t i = 0 ; i < frames.size() ; i++ )
+        {
+            double start = now();
+            stabilizer.stabilize(frames[i], stabilizedFrame);
+            stabilizationTime += now() - start;
+            failures += i > 0 && stabilizer.getLastHomography().empty() && expected[i] == SHOT_CONTINUOUS ? 1 : 0;
+        }
+        printf("%4dx%-4d  stabilization %-11s %8.3f ms/frame  movements not found in a shot %d\n", size.width, size.height,
+               settings.detectCuts ? "with cuts" : "without", stabilizationTime / frames.size(), failures);
+    }
+}
+
+
+//*************************************************************************
+//                            QUALITY LEVELS                              *
+//*************************************************************************
+
+/*
+Cost and error of every quality level of the real-time mode, to choose a deadline
+@param size: the frame size
+*/
+static void benchmarkQualityLevels(Size size)
+{
+    SyntheticSequence sequence = generateSyntheticSequence(size, BENCHMARK_SEQUENCE_FRAMES);
+    Mat stabilizedFrame;
+    for ( int level = QUALITY_FULL ; level < QUALITY_LEVELS ; level++ )
+    {
+        Stabilizer stabilizer;
+        stabilizer.setQualityLevel((QualityLevel)level);
+        double time = 0, error = 0;
+        int failures = 0;
+        for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+        {
+            double start = now();
+            stabilizer.stabilize(sequence.frames[i], stabilizedFrame);
+            time += now() - start;
+            Mat homography = stabilizer.getLastHomography();
+            if ( i == 0 )
+            {
+                continue;
+            }
+            if ( homography.empty() )
+            {
+                failures++;
+                continue;
+            }
+            error += homographyError(homography, sequence.homographies[i], size);
+        }
+        int pairs = sequence.frames.size() - 1;
+        printf("%4dx%-4d  %-16s %8.3f ms/frame  error mean %6.2f px  failures %d/%d\n", size.width, size.height,
+               getQualityLevelName((QualityLevel)level), time / sequence.frames.size(), error / MAX(pairs - failures, 1), failures, pairs);
+    }
+}
+
+
+//*************************************************************************
+//                             SCORE OVERLAY                              *
+//*************************************************************************
+
+/*
+Learning cost of the overlay detector, and overlap of the detected regions with the synthetic overlay
+@param size: the frame size
+*/
+static void benchmarkOverlay(Size size)
+{
+    // The first frame only starts the learning window
+    SyntheticSequence sequence = generateSyntheticSequence(size, OVERLAY_LEARNING_PAIRS + 1);
+    ScoreOverlayDetector detector;
+    double time = 0;
+    Mat mask;
+    for ( size_t i = 0 ; i < sequence.frames.size() ; i++ )
+    {
+        double start = now();
+        mask = detector.process(sequence.frames[i]);
+        time += now() - start;
+    }
+    if ( !detector.hasDetected() )
+    {
+        printf("%4dx%-4d  no detection after %d frames (the camera did not move enough)\n",
+               size.width, size.height, (int)sequence.frames.size());
+        return;
+    }
+
+    // The cached regions, until the next check
+    double start = now();
+    for ( int i = 0 ; i < BENCHMARK_ITERATIONS ; i++ )
+    {
+        detector.process(sequence.frames.back());
+    }
+    double cachedTime = (now() - start) / BENCHMARK_ITERATIONS;
+
+    Mat truth = detectScoreOverlayPanel(sequence.frames[0]);
+    double intersection = countNonZero(mask & truth);
+    double area = countNonZero(mask | truth);
+    printf("%4dx%-4d  learning %8.3f ms/frame  cached %8.4f ms/frame  regions %d  overlap with the overlay %5.1f%%\n",
+           size.width, size.height, time / sequence.frames.size(), cachedTime,
+           (int)detector.getRegions().size(), 100. * intersection / MAX(area, 1.));
+}
+
+
+int main(int argc, char ** argv)
+{
+    const Size sizes[] = { Size(640, 360), Size(1280, 720), Size(1920, 1080) };
+    const int sizesCount = sizeof(sizes) / sizeof(sizes[0]);
+
+    vector<string> sections;
+    for ( int i = 1 ; i < argc ; i++ )
+    {
+        sections.push_back(argv[i]);
+    }
+    if ( sections.empty() )
+    {
+        sections.push_back("kernels");
+        sections.push_back("warp");
+        sections.push_back("grass");
+        sections.push_back("morphology");
+        sections.push_back("stages");
+        sections.push_back("accuracy");
+        sections.push_back("drift");
+        sections.push_back("overlay");
+        sections.push_back("buffers");
+        sections.push_back("realtime");
+        sections.push_back("keyframes");
+        sections.push_back("shots");
+        sections.push_back("shared");
+        sections.push_back("masks");
+    }
+
+    for ( size_t s = 0 ; s < sections.size() ; s++ )
+    {
+        if ( sections[s] == "kernels" )
+        {
+            cout << "Mask kernels (" << BENCHMARK_ITERATIONS << " iterations)" << endl;
+            // 720p and 1080p
+            for ( int i = 1 ; i < sizesCount ; i++ )
+            {
+                benchmarkMaskKernels(sizes[i]);
+                benchmarkMaskedBlur(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "warp" )
+        {
+            cout << "Warp kernels (" << BENCHMARK_ITERATIONS << " iterations)" << endl;
+            for ( int i = 1 ; i < sizesCount ; i++ )
+            {
+                benchmarkWarp(sizes[i]);
+                // The default path pans and zooms. A handheld or shaky broadcast camera pans with a small roll
+                // from frame to frame, like the rotation noise of the estimation
+                SyntheticMotion shakyPan;
+                shakyPan.zoomAmplitude = 0;
+                shakyPan.rollNoise = BENCHMARK_ROLL_NOISE;
+                benchmarkEstimatedWarps(sizes[i], SyntheticMotion(), "pan and zoom");
+                benchmarkEstimatedWarps(sizes[i], shakyPan, "shaky pan");
+            }
+        }
+        else if ( sections[s] == "grass" )
+        {
+            cout << "Grass detection (" << BENCHMARK_ITERATIONS << " iterations)" << endl;
+            for ( int i = 1 ; i < sizesCount ; i++ )
+            {
+                benchmarkGrass(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "morphology" )
+        {
+            cout << "Masks morphology (" << BENCHMARK_ITERATIONS << " iterations)" << endl;
+            for ( int i = 1 ; i < sizesCount ; i++ )
+            {
+                benchmarkMorphology(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "stages" )
+        {
+            cout << "Stages (synthetic sequence of " << BENCHMARK_SEQUENCE_FRAMES << " frames)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkStages(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "accuracy" )
+        {
+            cout << "Movement detection against the ground truth (synthetic sequence of " << BENCHMARK_SEQUENCE_FRAMES << " frames)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkAccuracy(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "drift" )
+        {
+            cout << "Masks at a lower resolution against the full resolution (synthetic sequence of " << BENCHMARK_SEQUENCE_FRAMES << " frames)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkMaskDrift(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "overlay" )
+        {
+            cout << "Score overlay detection (synthetic sequence of " << OVERLAY_LEARNING_PAIRS + 1 << " frames)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkOverlay(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "buffers" )
+        {
+            cout << "Stabilization in reused buffers (synthetic sequence of " << BENCHMARK_SEQUENCE_FRAMES << " frames)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkBuffers(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "keyframes" )
+        {
+            cout << "Keyframe detection against the detection on every frame (synthetic sequence of " << BENCHMARK_SEQUENCE_FRAMES << " frames)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkKeyframes(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "shots" )
+        {
+            cout << "Shot detection (synthetic broadcast of " << BENCHMARK_SEQUENCE_FRAMES + 5 << " frames)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkShots(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "shared" )
+        {
+            cout << "Shared memory output with a reader on another thread (synthetic sequence of " << BENCHMARK_SEQUENCE_FRAMES
+                 << " frames, " << BENCHMARK_SHARED_SLOTS << " slots)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkSharedFrames(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "masks" )
+        {
+            cout << "Run length encoded masks (synthetic sequence of " << BENCHMARK_SEQUENCE_FRAMES << " frames, "
+                 << BENCHMARK_MASK_PROBES << " pixel tests per frame)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkMaskSpans(sizes[i]);
+            }
+        }
+        else if ( sections[s] == "realtime" )
+        {
+            cout << "Quality levels of the real-time mode (synthetic sequence of " << BENCHMARK_SEQUENCE_FRAMES << " frames)" << endl;
+            for ( int i = 0 ; i < sizesCount ; i++ )
+            {
+                benchmarkQualityLevels(sizes[i]);
+            }
+        }
+        else
+        {
+            cerr << "[ERROR]: Unknown benchmark \"" << sections[s] << "\"" << endl;
+            return -1;
+        }
+        cout << endl;
+    }
+    if ( mismatches > 0 )
+    {
+        cerr << "[ERROR]: " << mismatches << " results differ from their reference" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+Chunk parallel stabilization of long videos.
+*/
+
+#include "chunks.hpp"
+#include "profiler.hpp"
+
+#include <atomic>
+#include <thread>
+
+
+struct Chunk
+{
+    int firstFrame;
+    int endFrame; // excluded, INT_MAX for the end of the video
+    vector<Mat> homographies;
+    bool failed;
+};
+
+/*
+Move the video to the frame, by seeking or by skipping the previous frames
+@return false if the frame can not be reached
+*/
+static bool seekFrame(VideoCapture& videoBuffer, int frame)
+{
+    if ( frame == 0 )
+    {
+        return true;
+    }
+    videoBuffer.set(CV_CAP_PROP_POS_FRAMES, frame);
+    if ( (int)videoBuffer.get(CV_CAP_PROP_POS_FRAMES) == frame )
+    {
+        return true;
+    }
+    // Not seekable, or not frame accurate: skip the frames from the start
+    cerr << "[WARNING]: Can not seek to frame " << frame << ", skipping the frames instead" << endl;
+    videoBuffer.set(CV_CAP_PROP_POS_FRAMES, 0);
+    for ( int i = 0 ; i < frame ; i++ )
+    {
+        if ( !videoBuffer.grab() )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Detect the movements of the frames of a chunk
+@param videoPath: the video
+@param settings: the parameters of the stabilization
+@param chunk: the chunk to fill
+*/
+static void estimateChunk(const string& videoPath, const StabilizerSettings& settings, Chunk& chunk, volatile int& stopSignal)
+{
+    VideoCapture videoBuffer(videoPath);
+    // The chunk starts on the last frame of the previous chunk, the overlapping pair
+    int overlapFrame = MAX(chunk.firstFrame - 1, 0);
+    if ( !videoBuffer.isOpened() || !seekFrame(videoBuffer, overlapFrame) )
+    {
+        chunk.failed = true;
+        return;
+    }
+
+    Stabilizer stabilizer(settings);
+    Mat frame;
+    for ( int index = overlapFrame ; index < chunk.endFrame && !stopSignal ; index++ )
+    {
+        frame = Mat();
+        videoBuffer >> frame;
+        if ( frame.empty() )
+        {
+            break;
+        }
+        Mat homography = stabilizer.estimate(prepareFrame(frame, settings.maskDownscale));
+        if ( index >= chunk.firstFrame )
+        {
+            chunk.homographies.push_back(homography);
+            profileFrameDone();
+        }
+    }
+}
+
+bool estimateHomographiesInChunks(const string& videoPath, int frameCount, bool limited, int threads, const StabilizerSettings& settings,
+                                  vector<Mat>& homographies, volatile int& stopSignal)
+{
+    if ( frameCount <= 0 )
+    {
+        cerr << "[ERROR]: The frame count of the video is unknown, it can not be split in chunks" << endl;
+        return false;
+    }
+    threads = MAX(threads, 1);
+    int chunkCount = MIN(threads * CHUNKS_PER_THREAD, frameCount);
+    vector<Chunk> chunks(chunkCount);
+    for ( int i = 0 ; i < chunkCount ; i++ )
+    {
+        chunks[i].firstFrame = (int)((long long)frameCount * i / chunkCount);
+        chunks[i].endFrame = (int)((long long)frameCount * (i + 1) / chunkCount);
+        chunks[i].failed = false;
+    }
+    // The frame count of the container may be wrong: the last chunk reads until the end, unless the user set a limit
+    if ( !limited )
+    {
+        chunks[chunkCount - 1].endFrame = INT_MAX;
+    }
+
+    std::atomic<int> nextChunk(0);
+    vector<std::thread> workers;
+    for ( int i = 0 ; i < threads ; i++ )
+    {
+        workers.push_back(std::thread([&]()
+        {
+            int chunk;
+            while ( ( chunk = nextChunk++ ) < chunkCount )
+            {
+                estimateChunk(videoPath, settings, chunks[chunk], stopSignal);
+            }
+        }));
+    }
+    for ( size_t i = 0 ; i < workers.size() ; i++ )
+    {
+        workers[i].join();
+    }
+
+    // Stitch the chunks back together
+    homographies.clear();
+    for ( int i = 0 ; i < chunkCount ; i++ )
+    {
+        if ( chunks[i].failed )
+        {
+            cerr << "[ERROR]: Could not read the chunk starting at frame " << chunks[i].firstFrame << endl;
+            return false;
+        }
+        homographies.insert(homographies.end(), chunks[i].homographies.begin(), chunks[i].homographies.end());
+        // A chunk ending early (end of the video reached, or stopped) must be the last one:
+        // the movements after the gap would be applied to the wrong frames
+        bool complete = (int)chunks[i].homographies.size() == chunks[i].endFrame - chunks[i].firstFrame;
+        if ( !complete && i < chunkCount - 1 )
+        {
+            if ( !stopSignal )
+            {
+                cerr << "[WARNING]: The video ends at frame " << homographies.size() << ", before its announced frame count" << endl;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+int applyHomographies(VideoCapture& videoBuffer, VideoWriter& exportVideoWriter, const vector<Mat>& homographies,
+                      volatile int& stopSignal)
+{
+    int exportedFrames = 0;
+    Mat frame;
+    for ( size_t index = 0 ; index < homographies.size() && !stopSignal ; index++ )
+    {
+        videoBuffer >> frame;
+        if ( frame.empty() )
+        {
+            break;
+        }
+        // No movement for the first frame
+        Mat stabilizedFrame = homographies[index].empty() ? frame : applyHomography(frame, homographies[index]);
+        if ( exportVideoWriter.isOpened() )
+        {
+            exportVideoWriter << stabilizedFrame;
+        }
+        exportedFrames++;
+    }
+    return exportedFrames;
+}
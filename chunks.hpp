@@ -0,0 +1,43 @@
+/*
+Chunk parallel stabilization of long videos.
+The video is split in chunks, and the movements of every chunk are detected on their own thread.
+*/
+
+#ifndef CHUNKS_HPP
+#define CHUNKS_HPP
+
+#include "stabilization.hpp"
+
+// More chunks than threads, so that a slow chunk does not hold the others
+#define CHUNKS_PER_THREAD 4
+
+
+/*
+Detect the movement of every frame of the video.
+Each chunk starts one frame early, to detect the movement between its first frame and the last frame
+of the previous chunk: the movements are the ones of a sequential run. Nothing else is carried from one
+frame to the next: the overlay detection, the cut detection and the tracking estimation are not supported.
+@param videoPath: the video, opened once per thread
+@param frameCount: the number of frames of the video, as given by the container, or the limit set by the user
+@param limited: the frame count is the limit set by the user: no frame after it is read
+@param threads: the number of threads
+@param settings: the parameters of the stabilization
+@param homographies: filled with the movement of every frame (empty for the first frame)
+@param stopSignal: stop when it becomes non zero
+@return false if the video can not be read
+*/
+bool estimateHomographiesInChunks(const string& videoPath, int frameCount, bool limited, int threads, const StabilizerSettings& settings,
+                                  vector<Mat>& homographies, volatile int& stopSignal);
+
+/*
+Move every frame of the video with its homography, and export it
+@param videoBuffer: the video, opened at its first frame
+@param exportVideoWriter: the stabilized video, may not be opened
+@param homographies: the movement of every frame
+@param stopSignal: stop when it becomes non zero
+@return the number of exported frames
+*/
+int applyHomographies(VideoCapture& videoBuffer, VideoWriter& exportVideoWriter, const vector<Mat>& homographies,
+                      volatile int& stopSignal);
+
+#endif
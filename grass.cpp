@@ -0,0 +1,175 @@
+/*
+Grass detection with a lookup table.
+*/
+
+#include "grass.hpp"
+
+#include <cstring>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+/*
+Index of the color in the table: the channels without their quantized bits, blue first
+*/
+static inline int tableIndex(int blue, int green, int red, int quantization)
+{
+    const int bits = 8 - quantization;
+    return ( (blue >> quantization) << (2 * bits) ) | ( (green >> quantization) << bits ) | ( red >> quantization );
+}
+
+GrassClassifier::GrassClassifier()
+    : quantization(0)
+{
+}
+
+void GrassClassifier::setThresholds(const Scalar& lower, const Scalar& upper, int quantization)
+{
+    CV_Assert( quantization >= 0 && quantization < 8 );
+    if ( isBuilt() && lower == this->lower && upper == this->upper && quantization == this->quantization )
+    {
+        return;
+    }
+    this->lower = lower;
+    this->upper = upper;
+    this->quantization = quantization;
+
+    // A quantized cell is classified by its center color
+    const int cells = 256 >> quantization;
+    const int center = quantization > 0 ? 1 << (quantization - 1) : 0;
+    table.assign(( (size_t)cells * cells * cells + 63 ) / 64, 0);
+
+    // Every color of a blue cell in one image: green on the rows, red on the columns.
+    // cvtColor() and inRange() classify them exactly like the frames
+    Mat colors(cells, cells, CV_8UC3), HSV, grass;
+    for ( int blue = 0 ; blue < cells ; blue++ )
+    {
+        for ( int green = 0 ; green < cells ; green++ )
+        {
+            Vec3b* row = colors.ptr<Vec3b>(green);
+            for ( int red = 0 ; red < cells ; red++ )
+            {
+                row[red] = Vec3b((blue << quantization) + center, (green << quantization) + center, (red << quantization) + center);
+            }
+        }
+        cvtColor(colors, HSV, CV_BGR2HSV);
+        inRange(HSV, lower, upper, grass);
+        for ( int green = 0 ; green < cells ; green++ )
+        {
+            const uchar* row = grass.ptr<uchar>(green);
+            for ( int red = 0 ; red < cells ; red++ )
+            {
+                if ( row[red] )
+                {
+                    int index = tableIndex(blue << quantization, green << quantization, red << quantization, quantization);
+                    table[index >> 6] |= (uint64_t)1 << (index & 63);
+                }
+            }
+        }
+    }
+}
+
+bool GrassClassifier::isBuilt() const
+{
+    return !table.empty();
+}
+
+Scalar GrassClassifier::getLower() const
+{
+    return lower;
+}
+
+Scalar GrassClassifier::getUpper() const
+{
+    return upper;
+}
+
+int GrassClassifier::getQuantization() const
+{
+    return quantization;
+}
+
+bool GrassClassifier::isGrass(uchar blue, uchar green, uchar red) const
+{
+    int index = tableIndex(blue, green, red, quantization);
+    return ( table[index >> 6] >> (index & 63) ) & 1;
+}
+
+#if defined(__AVX2__)
+/*
+Classify the pixels of a row 8 at a time: the table indices are computed in 32 bit lanes,
+and the 32 bit words of the table holding their bits are gathered
+@param pixel: the BGR pixels of the row
+@param dst: the mask row
+@param width: the width of the row
+@param bits: the table
+@param q: the quantization of the table
+@return the first pixel left to the scalar loop
+*/
+static int classifyRowAVX2(const uchar* pixel, uchar* dst, int width, const uint64_t* bits, int q)
+{
+    // Pixels 0-3 in the low lane, 4-7 in the high lane (bytes 12 to 27 of the 32 loaded)
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i blueBytes = _mm256_setr_epi8(0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1,
+                                               0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1);
+    const __m256i greenBytes = _mm256_setr_epi8(1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1,
+                                                1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1);
+    const __m256i redBytes = _mm256_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1,
+                                              2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+    const __m128i quantizationShift = _mm_cvtsi32_si128(q);
+    const __m128i greenShift = _mm_cvtsi32_si128(8 - q);
+    const __m128i blueShift = _mm_cvtsi32_si128(2 * (8 - q));
+    const __m256i lowBits = _mm256_set1_epi32(31);
+    const __m256i one = _mm256_set1_epi32(1);
+    const int* words = (const int*)bits;
+    int x = 0;
+    // 32 bytes are loaded for 8 pixels (24 bytes): the last pixels of the row are left to the scalar loop
+    for ( ; x <= width - 11 ; x += 8, pixel += 24 )
+    {
+        __m256i colors = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)pixel), lanes);
+        __m256i blue = _mm256_srl_epi32(_mm256_shuffle_epi8(colors, blueBytes), quantizationShift);
+        __m256i green = _mm256_srl_epi32(_mm256_shuffle_epi8(colors, greenBytes), quantizationShift);
+        __m256i red = _mm256_srl_epi32(_mm256_shuffle_epi8(colors, redBytes), quantizationShift);
+        __m256i index = _mm256_or_si256(_mm256_or_si256(_mm256_sll_epi32(blue, blueShift), _mm256_sll_epi32(green, greenShift)), red);
+        // The table is read as 32 bit words: word index >> 5, bit index & 31 (little endian)
+        __m256i word = _mm256_i32gather_epi32(words, _mm256_srli_epi32(index, 5), 4);
+        __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(index, lowBits)), one);
+        // 0 or -1 per lane, narrowed to bytes: lanes 0-3 in the low 4 bytes of each 128 bit half
+        __m256i grass = _mm256_cmpeq_epi32(bit, one);
+        __m256i narrowed = _mm256_packs_epi16(_mm256_packs_epi32(grass, grass), _mm256_packs_epi32(grass, grass));
+        int low = _mm256_cvtsi256_si32(narrowed);
+        int high = _mm_cvtsi128_si32(_mm256_extracti128_si256(narrowed, 1));
+        memcpy(dst + x, &low, 4);
+        memcpy(dst + x + 4, &high, 4);
+    }
+    return x;
+}
+#endif
+
+void GrassClassifier::classify(const Mat& frame, Mat& mask) const
+{
+    CV_Assert( isBuilt() && frame.type() == CV_8UC3 );
+    mask.create(frame.rows, frame.cols, CV_8U);
+    const uint64_t* bits = &table[0];
+    const int q = quantization;
+    for ( int y = 0 ; y < frame.rows ; y++ )
+    {
+        const uchar* pixel = frame.ptr<uchar>(y);
+        uchar* dst = mask.ptr<uchar>(y);
+        int x = 0;
+#if defined(__AVX2__)
+        x = classifyRowAVX2(pixel, dst, frame.cols, bits, q);
+        pixel += 3 * x;
+#endif
+        for ( ; x < frame.cols ; x++, pixel += 3 )
+        {
+            int index = tableIndex(pixel[0], pixel[1], pixel[2], q);
+            // 0 or 255 without a branch
+            dst[x] = (uchar)( -(int)( ( bits[index >> 6] >> (index & 63) ) & 1 ) );
+        }
+    }
+}
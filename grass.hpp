@@ -0,0 +1,50 @@
+/*
+Grass detection with a lookup table: the BGR color of a pixel gives directly whether it is grass,
+with the same result as converting the frame to HSV and thresholding it with inRange().
+The table has one bit per BGR color (2 MB), built once by converting every color to HSV.
+A quantization drops the low bits of each channel: smaller table, approximate result.
+With AVX2, classify() gathers the bits of 8 pixels at a time from the table.
+*/
+
+#ifndef GRASS_HPP
+#define GRASS_HPP
+
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+
+
+class GrassClassifier
+{
+public:
+    GrassClassifier();
+
+    /*
+    Build the table, if the parameters changed
+    @param lower, upper: the inclusive HSV bounds of the grass, as given to inRange()
+    @param quantization: low bits dropped on each channel, 0 for an exact table
+    */
+    void setThresholds(const Scalar& lower, const Scalar& upper, int quantization = 0);
+    bool isBuilt() const;
+    Scalar getLower() const;
+    Scalar getUpper() const;
+    int getQuantization() const;
+
+    bool isGrass(uchar blue, uchar green, uchar red) const;
+    /*
+    @param frame: the CV_8UC3 BGR frame
+    @param mask: 255 where the pixel is grass, 0 elsewhere
+    */
+    void classify(const Mat& frame, Mat& mask) const;
+
+private:
+    std::vector<uint64_t> table;
+    Scalar lower;
+    Scalar upper;
+    int quantization;
+};
+
+#endif
@@ -0,0 +1,340 @@
+/*
+Vectorized row kernels used by the masks composition and the pre processing.
+*/
+
+#include "kernels.hpp"
+
+#include <climits>
+#include <vector>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Thresholds of the masks
+#define MASK_GRASS_THRESHOLD 10   // grass mask is off below
+#define MASK_ON_THRESHOLD 250     // other masks are on above
+
+// Rows of the masked blur sharing one integral image. OpenCV has no unsigned integral: the 32 bit
+// signed sums are kept to a band, whose total stays far below 2^31 (a whole 4K frame would not)
+#define MASKED_BLUR_BAND_ROWS 64
+
+
+//*************************************************************************
+//                                  ROWS                                  *
+//*************************************************************************
+
+void composeCameraStabilizationRow(const uchar* grass, const uchar* publicArea, const uchar* score, uchar* dst, int width)
+{
+    int x = 0;
+#if defined(__AVX2__)
+    {
+        const __m256i grassMax = _mm256_set1_epi8(MASK_GRASS_THRESHOLD - 1);
+        const __m256i onMin = _mm256_set1_epi8((char)(MASK_ON_THRESHOLD + 1));
+        for ( ; x <= width - 32 ; x += 32 )
+        {
+            __m256i g = _mm256_loadu_si256((const __m256i*)(grass + x));
+            __m256i p = _mm256_loadu_si256((const __m256i*)(publicArea + x));
+            __m256i s = _mm256_loadu_si256((const __m256i*)(score + x));
+            // x < 10 <=> min(x, 9) == x, x > 250 <=> max(x, 251) == x
+            __m256i notGrass = _mm256_cmpeq_epi8(_mm256_min_epu8(g, grassMax), g);
+            __m256i isPublic = _mm256_cmpeq_epi8(_mm256_max_epu8(p, onMin), p);
+            __m256i isScore = _mm256_cmpeq_epi8(_mm256_max_epu8(s, onMin), s);
+            __m256i result = _mm256_or_si256(isScore, _mm256_andnot_si256(isPublic, notGrass));
+            _mm256_storeu_si256((__m256i*)(dst + x), result);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i grassMax = _mm_set1_epi8(MASK_GRASS_THRESHOLD - 1);
+        const __m128i onMin = _mm_set1_epi8((char)(MASK_ON_THRESHOLD + 1));
+        for ( ; x <= width - 16 ; x += 16 )
+        {
+            __m128i g = _mm_loadu_si128((const __m128i*)(grass + x));
+            __m128i p = _mm_loadu_si128((const __m128i*)(publicArea + x));
+            __m128i s = _mm_loadu_si128((const __m128i*)(score + x));
+            __m128i notGrass = _mm_cmpeq_epi8(_mm_min_epu8(g, grassMax), g);
+            __m128i isPublic = _mm_cmpeq_epi8(_mm_max_epu8(p, onMin), p);
+            __m128i isScore = _mm_cmpeq_epi8(_mm_max_epu8(s, onMin), s);
+            __m128i result = _mm_or_si128(isScore, _mm_andnot_si128(isPublic, notGrass));
+            _mm_storeu_si128((__m128i*)(dst + x), result);
+        }
+    }
+#endif
+    for ( ; x < width ; x++ )
+    {
+        // add everything that is not grass, remove the public, add the infosLayer
+        uchar value = ( grass[x] < MASK_GRASS_THRESHOLD ) ? 255 : 0;
+        if ( publicArea[x] > MASK_ON_THRESHOLD )
+        {
+            value = 0;
+        }
+        if ( score[x] > MASK_ON_THRESHOLD )
+        {
+            value = 255;
+        }
+        dst[x] = value;
+    }
+}
+
+void composeSingularityRow(const uchar* publicArea, const uchar* score, const uchar* borders, uchar* dst, int width)
+{
+    int x = 0;
+#if defined(__AVX2__)
+    {
+        const __m256i onMin = _mm256_set1_epi8((char)(MASK_ON_THRESHOLD + 1));
+        for ( ; x <= width - 32 ; x += 32 )
+        {
+            __m256i p = _mm256_loadu_si256((const __m256i*)(publicArea + x));
+            __m256i s = _mm256_loadu_si256((const __m256i*)(score + x));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(borders + x));
+            __m256i result = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(p, onMin), p),
+                             _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(s, onMin), s),
+                                             _mm256_cmpeq_epi8(_mm256_max_epu8(b, onMin), b)));
+            _mm256_storeu_si256((__m256i*)(dst + x), result);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i onMin = _mm_set1_epi8((char)(MASK_ON_THRESHOLD + 1));
+        for ( ; x <= width - 16 ; x += 16 )
+        {
+            __m128i p = _mm_loadu_si128((const __m128i*)(publicArea + x));
+            __m128i s = _mm_loadu_si128((const __m128i*)(score + x));
+            __m128i b = _mm_loadu_si128((const __m128i*)(borders + x));
+            __m128i result = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(p, onMin), p),
+                             _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(s, onMin), s),
+                                          _mm_cmpeq_epi8(_mm_max_epu8(b, onMin), b)));
+            _mm_storeu_si128((__m128i*)(dst + x), result);
+        }
+    }
+#endif
+    for ( ; x < width ; x++ )
+    {
+        bool masked = publicArea[x] > MASK_ON_THRESHOLD
+                      || score[x] > MASK_ON_THRESHOLD
+                      || borders[x] > MASK_ON_THRESHOLD;
+        dst[x] = masked ? 255 : 0;
+    }
+}
+
+void substituteMaskedPixelsRow(const uchar* blurredMask, const uchar* blurredFrame, uchar* frame, int width)
+{
+    int x = 0;
+#if defined(__SSSE3__)
+    {
+        // Spread 16 mask bytes over the 48 bytes of 16 BGR pixels
+        const __m128i spread0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+        const __m128i spread1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+        const __m128i spread2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+        const __m128i zero = _mm_setzero_si128();
+        for ( ; x <= width - 16 ; x += 16 )
+        {
+            __m128i m = _mm_loadu_si128((const __m128i*)(blurredMask + x));
+            // m > 0 <=> !(m == 0)
+            __m128i isMasked = _mm_xor_si128(_mm_cmpeq_epi8(m, zero), _mm_set1_epi8(-1));
+            if ( _mm_movemask_epi8(isMasked) == 0 )
+            {
+                continue;
+            }
+            const __m128i spreads[3] = { spread0, spread1, spread2 };
+            for ( int i = 0 ; i < 3 ; i++ )
+            {
+                __m128i select = _mm_shuffle_epi8(isMasked, spreads[i]);
+                __m128i* dst = (__m128i*)(frame + 3 * x + 16 * i);
+                __m128i original = _mm_loadu_si128(dst);
+                __m128i blurred = _mm_loadu_si128((const __m128i*)(blurredFrame + 3 * x + 16 * i));
+                _mm_storeu_si128(dst, _mm_or_si128(_mm_and_si128(select, blurred), _mm_andnot_si128(select, original)));
+            }
+        }
+    }
+#endif
+    for ( ; x < width ; x++ )
+    {
+        if ( blurredMask[x] > 0 )
+        {
+            frame[3 * x] = blurredFrame[3 * x];
+            frame[3 * x + 1] = blurredFrame[3 * x + 1];
+            frame[3 * x + 2] = blurredFrame[3 * x + 2];
+        }
+    }
+}
+
+
+//*************************************************************************
+//                                 FRAMES                                 *
+//*************************************************************************
+
+void composeCameraStabilizationMask(const Mat& maskGrass, const Mat& maskPublic, const Mat& maskScore, Mat& finalMask)
+{
+    CV_Assert( maskGrass.type() == CV_8U && maskPublic.size() == maskGrass.size() && maskScore.size() == maskGrass.size() );
+    finalMask.create(maskGrass.rows, maskGrass.cols, CV_8U);
+    for ( int y = 0 ; y < maskGrass.rows ; y++ )
+    {
+        composeCameraStabilizationRow(maskGrass.ptr<uchar>(y), maskPublic.ptr<uchar>(y), maskScore.ptr<uchar>(y),
+                                      finalMask.ptr<uchar>(y), maskGrass.cols);
+    }
+}
+
+void composeSingularityMask(const Mat& maskPublic, const Mat& maskScore, const Mat& maskBorders, Mat& finalMask)
+{
+    CV_Assert( maskPublic.type() == CV_8U && maskScore.size() == maskPublic.size() && maskBorders.size() == maskPublic.size() );
+    finalMask.create(maskPublic.rows, maskPublic.cols, CV_8U);
+    for ( int y = 0 ; y < maskPublic.rows ; y++ )
+    {
+        composeSingularityRow(maskPublic.ptr<uchar>(y), maskScore.ptr<uchar>(y), maskBorders.ptr<uchar>(y),
+                              finalMask.ptr<uchar>(y), maskPublic.cols);
+    }
+}
+
+void substituteMaskedPixels(const Mat& blurredMask, const Mat& blurredFrame, Mat& frame)
+{
+    CV_Assert( frame.type() == CV_8UC3 && blurredFrame.type() == CV_8UC3 && blurredMask.type() == CV_8U );
+    CV_Assert( blurredMask.size() == frame.size() && blurredFrame.size() == frame.size() );
+    for ( int y = 0 ; y < frame.rows ; y++ )
+    {
+        substituteMaskedPixelsRow(blurredMask.ptr<uchar>(y), blurredFrame.ptr<uchar>(y), frame.ptr<uchar>(y), frame.cols);
+    }
+}
+
+
+//*************************************************************************
+//                              MASKED BLUR                               *
+//*************************************************************************
+
+// Pixels [begin, end) of the row y
+struct MaskedSpan
+{
+    int y;
+    int begin;
+    int end;
+};
+
+/*
+Buffers of the masked blur, kept from one call to the next by each thread.
+The frame bands change size from one call to the next: their buffers only grow,
+the bands use their top left part
+*/
+struct MaskedBlurBuffers
+{
+    Mat paddedMask;
+    Mat maskSums;
+    Mat paddedFrame;
+    Mat frameSums;
+    std::vector<MaskedSpan> spans;
+};
+
+static thread_local MaskedBlurBuffers maskedBlurBuffers;
+
+/*
+@return the top left rows x cols part of the buffer, grown if needed
+*/
+static Mat reserve(Mat& buffer, int rows, int cols, int type)
+{
+    if ( buffer.rows < rows || buffer.cols < cols || buffer.type() != type )
+    {
+        buffer.create(MAX(buffer.rows, rows), MAX(buffer.cols, cols), type);
+    }
+    return buffer(Rect(0, 0, cols, rows));
+}
+
+void blurMaskedPixels(const Mat& mask, const Mat& frame, Mat& result, int blurSize)
+{
+    CV_Assert( mask.type() == CV_8U && frame.type() == CV_8UC3 && mask.size() == frame.size() );
+    CV_Assert( result.type() == CV_8UC3 && result.size() == frame.size() && result.data != frame.data );
+    // blur() anchors its window at the center: pixel x is the mean of x - before ... x + after,
+    // the pixels out of the image being extrapolated with BORDER_REFLECT_101
+    const int before = blurSize / 2, after = blurSize - 1 - before;
+    // blur() rounds sum * scale: the same rounding gives the same pixels
+    const double scale = 1. / (blurSize * blurSize);
+    int minimumSum = 1;
+    while ( saturate_cast<uchar>(minimumSum * scale) == 0 )
+    {
+        minimumSum++;
+    }
+
+    Mat& paddedMask = maskedBlurBuffers.paddedMask;
+    copyMakeBorder(mask, paddedMask, before, after, before, after, BORDER_REFLECT_101);
+    const int paddedWidth = paddedMask.cols;
+    // The sums of a band, mask or frame, fit in 32 bits
+    CV_Assert( (double)( MASKED_BLUR_BAND_ROWS + blurSize ) * ( paddedWidth + 1 ) * 255 < (double)INT_MAX );
+
+    std::vector<MaskedSpan>& spans = maskedBlurBuffers.spans;
+    for ( int bandStart = 0 ; bandStart < frame.rows ; bandStart += MASKED_BLUR_BAND_ROWS )
+    {
+        int bandEnd = MIN(bandStart + MASKED_BLUR_BAND_ROWS, frame.rows);
+
+        // Window sums of the mask over the rows of the band and their windows
+        const int bandRows = bandEnd - bandStart + blurSize - 1;
+        Mat maskSums = reserve(maskedBlurBuffers.maskSums, bandRows + 1, paddedWidth + 1, CV_32S);
+        integral(paddedMask(Rect(0, bandStart, paddedWidth, bandRows)), maskSums, CV_32S);
+
+        // The pixels where the blurred mask is > 0, and their bounding box
+        spans.clear();
+        int left = frame.cols, right = 0;
+        for ( int y = bandStart ; y < bandEnd ; y++ )
+        {
+            const int* top = maskSums.ptr<int>(y - bandStart);
+            const int* bottom = maskSums.ptr<int>(y - bandStart + blurSize);
+            // Most rows of a wide shot have no masked pixel in their window
+            if ( bottom[paddedWidth] - top[paddedWidth] < minimumSum )
+            {
+                continue;
+            }
+            int begin = -1;
+            for ( int x = 0 ; x <= frame.cols ; x++ )
+            {
+                bool masked = x < frame.cols
+                              && bottom[x + blurSize] - top[x + blurSize] - bottom[x] + top[x] >= minimumSum;
+                if ( masked && begin < 0 )
+                {
+                    begin = x;
+                }
+                else if ( !masked && begin >= 0 )
+                {
+                    MaskedSpan span = { y, begin, x };
+                    spans.push_back(span);
+                    left = MIN(left, begin);
+                    right = MAX(right, x);
+                    begin = -1;
+                }
+            }
+        }
+        if ( spans.empty() )
+        {
+            continue;
+        }
+
+        // Window sums of the frame around the bounding box.
+        // The border of a ROI is taken from its parent image: only the image borders are extrapolated
+        Rect box(left, spans.front().y, right - left, spans.back().y - spans.front().y + 1);
+        Mat paddedFrame = reserve(maskedBlurBuffers.paddedFrame, box.height + blurSize - 1, box.width + blurSize - 1, CV_8UC3);
+        Mat frameSums = reserve(maskedBlurBuffers.frameSums, box.height + blurSize, box.width + blurSize, CV_32SC3);
+        copyMakeBorder(frame(box), paddedFrame, before, after, before, after, BORDER_REFLECT_101);
+        integral(paddedFrame, frameSums, CV_32S);
+        for ( size_t i = 0 ; i < spans.size() ; i++ )
+        {
+            const MaskedSpan& span = spans[i];
+            const int* top = frameSums.ptr<int>(span.y - box.y);
+            const int* bottom = frameSums.ptr<int>(span.y - box.y + blurSize);
+            uchar* dst = result.ptr<uchar>(span.y);
+            for ( int x = span.begin ; x < span.end ; x++ )
+            {
+                int first = 3 * (x - box.x), last = 3 * (x - box.x + blurSize);
+                for ( int c = 0 ; c < 3 ; c++ )
+                {
+                    int sum = bottom[last + c] - top[last + c] - bottom[first + c] + top[first + c];
+                    dst[3 * x + c] = saturate_cast<uchar>(sum * scale);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+/*
+Vectorized row kernels used by the masks composition and the pre processing.
+Every kernel has an AVX2 / SSE path and a scalar fallback giving the same result.
+*/
+
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+
+
+/*
+Camera stabilization mask: 255 where the pixel is not grass (< 10) and not public (> 250),
+or where it is part of the score panel (> 250). 0 elsewhere.
+*/
+void composeCameraStabilizationMask(const Mat& maskGrass, const Mat& maskPublic, const Mat& maskScore, Mat& finalMask);
+
+/*
+Singularity mask: 255 where any of the masks is > 250. 0 elsewhere.
+*/
+void composeSingularityMask(const Mat& maskPublic, const Mat& maskScore, const Mat& maskBorders, Mat& finalMask);
+
+/*
+Copy the blurred frame pixels into the frame where blurredMask > 0 (CV_8UC3 frames only)
+*/
+void substituteMaskedPixels(const Mat& blurredMask, const Mat& blurredFrame, Mat& frame);
+
+
+/*
+Same result as blurring the mask and the frame with a blurSize x blurSize box filter (blur()),
+then copying the blurred frame pixels into result where the blurred mask is > 0.
+The frame is only blurred around these pixels, with integral images of the rows that have some:
+the cost follows the masked area instead of the frame area.
+@param mask: CV_8U mask of the pixels to blur
+@param frame: the CV_8UC3 frame to blur
+@param result: a copy of the frame (not sharing its data), receiving the blurred pixels
+*/
+void blurMaskedPixels(const Mat& mask, const Mat& frame, Mat& result, int blurSize);
+
+// Row versions, on contiguous row pointers
+void composeCameraStabilizationRow(const uchar* grass, const uchar* publicArea, const uchar* score, uchar* dst, int width);
+void composeSingularityRow(const uchar* publicArea, const uchar* score, const uchar* borders, uchar* dst, int width);
+void substituteMaskedPixelsRow(const uchar* blurredMask, const uchar* blurredFrame, uchar* frame, int width);
+
+#endif
@@ -1,30 +1,464 @@
-#include "stabilization.cpp"
+#include "stabilization.hpp"
+#include "options.hpp"
+#include "pipeline.hpp"
+#include "chunks.hpp"
+#include "trajectory.hpp"
+#include "profiler.hpp"
+#include "panorama.hpp"
+#include "overlay.hpp"
+#include "streams.hpp"
+#include "realtime.hpp"
+#include "sharedframes.hpp"
+#include "masksidecar.hpp"
+
+// Scale of the panorama displayed by the interactive mode
+#define PANORAMA_PREVIEW_SCALE 0.25
+#define DEFAULT_PANORAMA_SPILL_PREFIX "panorama"
+// Longest wait for a slot of the shared memory ring before checking for ctrl-C, in ms
+#define SHARED_OUTPUT_WAIT 100
 
 // This keeps the webcam/video from locking up when you interrupt a frame capture
 volatile int quit_signal = 0;
 #ifdef __unix__
 #include <signal.h>
 
-extern "C" void quit_signal_handler(int signum) 
+extern "C" void quit_signal_handler(int signum)
 {
 	if ( quit_signal != 0 )
 	{
 		exit(0); // just exit already
-	} 
+	}
 	quit_signal = 1;
 	printf("Will quit at next frame\n");
 }
 #endif
 
-int main(int c, char ** argv)
+/*
+@return the current time in ms
+*/
+static double now()
+{
+	return (double)cvGetTickCount() / ((double)cvGetTickFrequency() * 1000.);
+}
+
+/*
+@param prepared: a prepared frame
+@return the pixels of the frame not blended in the panorama: the players and the score panel
+*/
+static Mat getPanoramaMask(const PreparedFrame& prepared)
+{
+	// The mask of the camera stabilization, without the black border
+	return prepared.mask(Rect(BORDER_WIDTH / 2, BORDER_WIDTH / 2, prepared.frame.cols, prepared.frame.rows));
+}
+
+/*
+Interactive mode: display the singularity mask and the panorama, and wait for the spacebar between two frames
+@param videoBuffer: the opened video
+@param exportVideoWriter: the stabilized video, may not be opened
+@param lastFrameNumber: the number of the last frame to process
+@param settings: the parameters of the stabilization
+@param panorama: where the frames are blended
+*/
+static void runInteractive(VideoCapture& videoBuffer, VideoWriter& exportVideoWriter, int lastFrameNumber,
+                           const StabilizerSettings& settings, Panorama& panorama)
+{
+	// Initialisation : First frame
+	Mat previousFrame;
+	videoBuffer >> previousFrame;
+	if ( previousFrame.empty() )
+	{
+		return;
+	}
+	if ( exportVideoWriter.isOpened() )
+	{
+		exportVideoWriter << previousFrame;
+	}
+	// The stabilizer keeps the pre processing of the previous frame from one step to the next
+	Stabilizer stabilizer(settings);
+	ScoreOverlayDetector overlay;
+	// The first frame is the reference: no movement detected
+	PreparedFrame reference = prepareFrame(previousFrame, settings.maskDownscale,
+	                                       settings.detectOverlay ? overlay.process(previousFrame) : Mat());
+	stabilizer.stabilize(reference);
+	panorama.addFrame(previousFrame, Mat(), getPanoramaMask(reference));
+	// The panorama is built from the first shot only
+	bool panoramaShot = true;
+
+	// Then, loop on frames
+	for (int frameNumber = 2 ; frameNumber <= lastFrameNumber; frameNumber++)
+	{
+		//imshow("previousFrame", reduceImgCouleur(previousFrame, 4));
+		cout << "frame " << frameNumber << "/" << lastFrameNumber << " ";
+		Mat currentFrame;
+		videoBuffer >> currentFrame;
+
+		// Handling end of video
+		if ( currentFrame.empty() )
+		{
+			break;
+		}
+		// Handling keyboard events
+		if ( quit_signal )
+		{
+			cout << "QUIT SIGNAL REACHED" << endl;
+			break;
+		}
+
+		double elapsedTime = (double)cvGetTickCount();
+		PreparedFrame prepared = prepareFrame(currentFrame, settings.maskDownscale,
+		                                      settings.detectOverlay ? overlay.process(currentFrame) : Mat());
+		Mat stabilizedFrame = stabilizer.stabilize(prepared);
+		elapsedTime = (double)cvGetTickCount() - elapsedTime;
+		printf( "detection time = %g ms\n", elapsedTime / ((double)cvGetTickFrequency() * 1000.) );
+
+		if ( exportVideoWriter.isOpened() )
+		{
+			exportVideoWriter << stabilizedFrame;
+		}
+
+		Mat singularitiesMask = getMaskOfIrrelevantAreasForSingularities(stabilizer.getStabilizedFrameAnalysis());
+		imshow("singularity final mask", scaleGrayFrame(singularitiesMask, 3));
+
+		// Blend the frames together in the panorama of the pitch
+		if ( waitKey(300) >= 0 )
+		{
+			break;
+		}
+		panoramaShot = panoramaShot && stabilizer.getLastShot() == SHOT_CONTINUOUS;
+		if ( panoramaShot )
+		{
+			panorama.addFrame(currentFrame, stabilizer.getLastHomography(), getPanoramaMask(prepared));
+		}
+		imshow("panorama", panorama.render(PANORAMA_PREVIEW_SCALE));
+		if ( waitKey(300) >= 0 )
+		{
+			break;
+		}
+
+		// spacebar control to move to the next frame
+		while ( waitKey(100) == -1 )
+		{}
+
+		previousFrame = currentFrame;
+	}
+}
+
+/*
+Headless mode: no window and no wait, every stabilized frame is exported.
+The throughput is reported at the end.
+@param videoBuffer: the opened video
+@param exportVideoWriter: the stabilized video, may not be opened
+@param lastFrameNumber: the number of the last frame to process
+@param settings: the parameters of the stabilization
+@param trajectory: where to save the detected movements, may not be opened
+@param panorama: where the frames are blended, NULL to disable
+@param sharedOutput: where the frames are published for other processes, NULL to disable
+@param maskSidecar: where to save the masks of every frame, may not be opened
+*/
+static void runHeadless(VideoCapture& videoBuffer, VideoWriter& exportVideoWriter, int lastFrameNumber,
+                        const StabilizerSettings& settings, TrajectoryWriter& trajectory, Panorama* panorama,
+                        SharedFrameWriter* sharedOutput, MaskSidecarWriter& maskSidecar)
 {
+	Stabilizer stabilizer(settings);
+	ScoreOverlayDetector overlay;
+	QualityController quality("Video", settings.deadline);
+	Mat currentFrame;
+	// Kept from one frame to the next: the stabilizer writes in the same buffer
+	// (or in the next slot of the shared memory ring)
+	Mat stabilizedFrame, singularityMask;
+	// The encoded masks reuse their spans from one frame to the next
+	MaskSidecarFrame maskFrame;
+	uint64_t rawMaskBytes = 0;
+	int processedFrames = 0;
+	int cuts = 0, offPitchFrames = 0;
+	bool panoramaShot = true;
+	double decodingTime = 0, stabilizationTime = 0, encodingTime = 0;
+	double startTime = now();
+
+	for (int frameNumber = 1 ; frameNumber <= lastFrameNumber && !quit_signal ; frameNumber++)
+	{
+		double stepTime = now();
+		// A new Mat each frame: the stabilizer keeps a reference on the previous one
+		currentFrame = Mat();
+		videoBuffer >> currentFrame;
+		if ( currentFrame.empty() )
+		{
+			break;
+		}
+		decodingTime += now() - stepTime;
+
+		if ( sharedOutput != NULL )
+		{
+			if ( currentFrame.size() != sharedOutput->getFrameSize() )
+			{
+				cerr << "[ERROR]: The frames of the video do not have the size of the shared memory ring" << endl;
+				break;
+			}
+			// A slow reader holds the writer back: wait for its slot, but stay responsive to ctrl-C
+			bool slotReady = false;
+			while ( !slotReady && !quit_signal )
+			{
+				slotReady = sharedOutput->beginFrame(stabilizedFrame, singularityMask, SHARED_OUTPUT_WAIT);
+			}
+			if ( !slotReady )
+			{
+				break;
+			}
+		}
+
+		stepTime = now();
+		stabilizer.stabilize(currentFrame, stabilizedFrame, settings.detectOverlay ? overlay.process(currentFrame) : Mat());
+		double frameStabilizationTime = now() - stepTime;
+		stabilizationTime += frameStabilizationTime;
+		if ( settings.deadline > 0 )
+		{
+			stabilizer.setQualityLevel(quality.frameDone(frameStabilizationTime));
+		}
+
+		// The first frame starts the first shot
+		ShotTransition shot = stabilizer.getLastShot();
+		if ( shot == SHOT_CUT && processedFrames > 0 )
+		{
+			cuts++;
+		}
+		else if ( shot == SHOT_NON_PITCH )
+		{
+			offPitchFrames++;
+		}
+		// The panorama is built from the first shot only
+		panoramaShot = panoramaShot && ( shot == SHOT_CONTINUOUS || ( shot == SHOT_CUT && processedFrames == 0 ) );
+
+		if ( panorama != NULL && panoramaShot )
+		{
+			panorama->addFrame(currentFrame, stabilizer.getLastHomography(), getPanoramaMask(stabilizer.getPreviousFrame()));
+		}
+
+		if ( sharedOutput != NULL || maskSidecar.isOpened() )
+		{
+			// With a shared output, the mask is computed in the slot, next to the frame
+			getMaskOfIrrelevantAreasForSingularities(stabilizer.getStabilizedFrameAnalysis(), singularityMask);
+		}
+		if ( sharedOutput != NULL )
+		{
+			sharedOutput->commitFrame(stabilizer.getLastHomography(), frameNumber - 1);
+		}
+		if ( maskSidecar.isOpened() )
+		{
+			maskFrame.frameIndex = frameNumber - 1;
+			maskFrame.singularities.encode(singularityMask);
+			// No camera mask for a frame off the pitch: it went through as is
+			const Mat& cameraMask = stabilizer.getPreviousFrame().mask;
+			if ( shot == SHOT_NON_PITCH || cameraMask.empty() )
+			{
+				maskFrame.camera.clear();
+			}
+			else
+			{
+				maskFrame.camera.encode(cameraMask);
+			}
+			rawMaskBytes += singularityMask.total() + maskFrame.camera.getSize().area();
+			if ( !maskSidecar.write(maskFrame) )
+			{
+				cerr << "[ERROR]: Could not write the masks of the frame " << frameNumber - 1 << endl;
+				break;
+			}
+		}
+
+		if ( trajectory.isOpened() )
+		{
+			TrajectoryRecord record;
+			record.frameIndex = frameNumber - 1;
+			record.setHomography(stabilizer.getLastHomography());
+			record.trackCount = MIN(stabilizer.getTrackCount(), 65535);
+			record.estimationTime = frameStabilizationTime;
+			trajectory.write(record);
+		}
+
+		stepTime = now();
+		if ( exportVideoWriter.isOpened() )
+		{
+			exportVideoWriter << stabilizedFrame;
+		}
+		encodingTime += now() - stepTime;
+		processedFrames++;
+	}
+	if ( quit_signal )
+	{
+		cout << "QUIT SIGNAL REACHED" << endl;
+	}
+
+	double totalTime = now() - startTime;
+	double frames = MAX(processedFrames, 1);
+	cout << "Processed " << processedFrames << " frames in " << totalTime / 1000. << " s ("
+	     << processedFrames / (totalTime / 1000.) << " fps)" << endl;
+	printf("Per frame: total %.2f ms, decoding %.2f ms, stabilization %.2f ms, encoding %.2f ms\n",
+	       totalTime / frames, decodingTime / frames, stabilizationTime / frames, encodingTime / frames);
+	if ( settings.deadline > 0 )
+	{
+		cout << quality.getMissedDeadlines() << " frames over the " << settings.deadline << " ms deadline, "
+		     << quality.getSwitchCount() << " quality switches, last quality: " << getQualityLevelName(quality.getLevel()) << endl;
+	}
+	if ( sharedOutput != NULL )
+	{
+		cout << sharedOutput->getPublishedCount() << " frames published in the shared memory, "
+		     << sharedOutput->getWaitingTime() / 1000. << " s spent waiting for the readers" << endl;
+	}
+	if ( maskSidecar.isOpened() )
+	{
+		printf("Masks saved in %.2f MB instead of %.2f MB (%.1fx smaller)\n", maskSidecar.getFileSize() / 1e6, rawMaskBytes / 1e6,
+		       rawMaskBytes / (double)MAX(maskSidecar.getFileSize(), (uint64_t)1));
+	}
+	if ( settings.detectCuts )
+	{
+		cout << cuts << " cuts, " << offPitchFrames << " frames off the pitch" << endl;
+	}
+	if ( settings.keyframeInterval > 0 )
+	{
+		cout << "Movement detected on " << stabilizer.getKeyframeCount() << " keyframes ("
+		     << stabilizer.getForcedKeyframeCount() << " forced by the residual check), last interval "
+		     << stabilizer.getKeyframeInterval() << " frames" << endl;
+	}
+	if ( stabilizer.getReallocationCount() > 0 )
+	{
+		cerr << "[WARNING]: The stabilizer buffers were reallocated " << stabilizer.getReallocationCount() << " times" << endl;
+	}
+}
+
+/*
+@param outputPath: the stabilized video of the single stream mode
+@param index: the index of the stream
+@return the stabilized video of the stream: the output path suffixed by _index, empty if the export is disabled
+*/
+static string getStreamOutputPath(const string& outputPath, int index)
+{
+	if ( outputPath.empty() )
+	{
+		return outputPath;
+	}
+	ostringstream suffix;
+	suffix << "_" << index;
+	size_t extension = outputPath.find_last_of('.');
+	size_t directory = outputPath.find_last_of('/');
+	if ( extension == string::npos || ( directory != string::npos && extension < directory ) )
+	{
+		return outputPath + suffix.str();
+	}
+	return outputPath.substr(0, extension) + suffix.str() + outputPath.substr(extension);
+}
+
+/*
+Multi-stream mode: every stream is stabilized at once, and its latencies are reported at the end
+@param options: the parsed options
+*/
+static void runMultipleStreams(const Options& options)
+{
+	vector<string> outputs;
+	for ( size_t i = 0 ; i < options.streamPaths.size() ; i++ )
+	{
+		outputs.push_back(getStreamOutputPath(options.outputPath, i));
+	}
+	long stolenTasks = 0;
+	double startTime = now();
+	vector<StreamStats> stats = runStreams(options.streamPaths, outputs, options.codec, options.streamThreads, options.maxFrames,
+	                                       options.stabilizerSettings, quit_signal, stolenTasks);
+	double totalTime = now() - startTime;
+	if ( quit_signal )
+	{
+		cout << "QUIT SIGNAL REACHED" << endl;
+	}
+
+	int frames = 0;
+	for ( size_t i = 0 ; i < stats.size() ; i++ )
+	{
+		frames += stats[i].frames;
+		if ( stats[i].failed )
+		{
+			continue;
+		}
+		printf("Stream %d (%s): %d frames, %.1f fps, latency mean %.2f ms, p50 %.2f ms, p95 %.2f ms, max %.2f ms\n",
+		       (int)i, stats[i].input.c_str(), stats[i].frames, stats[i].frames / MAX(stats[i].totalTime / 1000., 1e-9),
+		       stats[i].meanLatency, stats[i].p50Latency, stats[i].p95Latency, stats[i].maxLatency);
+		if ( options.stabilizerSettings.deadline > 0 )
+		{
+			printf("Stream %d: %d frames over the deadline, %d quality switches\n",
+			       (int)i, stats[i].missedDeadlines, stats[i].qualitySwitches);
+		}
+	}
+	cout << "Processed " << frames << " frames of " << stats.size() << " streams in " << totalTime / 1000. << " s ("
+	     << frames / (totalTime / 1000.) << " fps) with " << options.streamThreads << " threads, "
+	     << stolenTasks << " frames stolen by another thread" << endl;
+}
+
+int main(int argc, char ** argv)
+{
+	Options options;
+	if ( !parseOptions(argc, argv, options) )
+	{
+		printUsage(argv[0]);
+		return -1;
+	}
+	if ( options.help )
+	{
+		printUsage(argv[0]);
+		return 0;
+	}
+	if ( !options.profilePath.empty() )
+	{
+		enableProfiling(options.profilePath, options.profileInterval);
+	}
+
 #ifdef __unix__
 	// listen for ctrl-C
-	signal(SIGINT, quit_signal_handler); 
+	signal(SIGINT, quit_signal_handler);
 #endif
 
+	if ( options.stabilizerSettings.deadline > 0 && ( !options.replayPath.empty() || options.chunkThreads > 0 || options.pipeline ) )
+	{
+		cerr << "[ERROR]: --deadline only applies to the headless and multi-stream modes" << endl;
+		return -1;
+	}
+	if ( options.stabilizerSettings.keyframeInterval > 0 && ( !options.replayPath.empty() || options.chunkThreads > 0 || options.pipeline ) )
+	{
+		cerr << "[ERROR]: --keyframes only applies to the headless and multi-stream modes" << endl;
+		return -1;
+	}
+	// The overlay, the tracked corners and the shots are learned from the previous frames: a chunk
+	// starting without them would not give the movements of a sequential run
+	if ( options.chunkThreads > 0 && ( options.stabilizerSettings.detectOverlay || options.stabilizerSettings.detectCuts
+	                                   || options.stabilizerSettings.estimationMode == ESTIMATION_TRACKING ) )
+	{
+		cerr << "[ERROR]: --chunks can not be combined with --detect-overlay, --detect-cuts or --estimation tracking" << endl;
+		return -1;
+	}
+	if ( !options.maskSidecarPath.empty() && ( !options.replayPath.empty() || options.chunkThreads > 0 || options.pipeline
+	                                           || !options.streamPaths.empty() ) )
+	{
+		cerr << "[ERROR]: --mask-sidecar only applies to the headless mode" << endl;
+		return -1;
+	}
+	if ( !options.sharedOutputName.empty() && ( !options.replayPath.empty() || options.chunkThreads > 0 || options.pipeline
+	                                            || !options.streamPaths.empty() ) )
+	{
+		cerr << "[ERROR]: --shared-output only applies to the headless mode" << endl;
+		return -1;
+	}
+
+	if ( !options.streamPaths.empty() )
+	{
+		if ( !options.replayPath.empty() || options.chunkThreads > 0 || options.pipeline
+		     || !options.trajectoryPath.empty() || !options.panoramaPath.empty() )
+		{
+			cerr << "[ERROR]: --streams can not be combined with --replay, --chunks, --pipeline, --trajectory or --panorama" << endl;
+			return -1;
+		}
+		runMultipleStreams(options);
+		finishProfiling();
+		cout << "Stabilization ended, closing program." << endl;
+		return 0;
+	}
+
 	VideoCapture videoBuffer;
-	std::string videoPath = "samples/calme.mp4";
+	std::string videoPath = options.inputPath;
 	videoBuffer = VideoCapture(videoPath);
 
 	// Handling errors
@@ -39,13 +473,11 @@ int main(int c, char ** argv)
 	}
 
 	// Video infos
-	int size;
 	int videoHeight;
 	int videoWidth;
 	int videoFramerate;
 	int videoFrameTotalCount;
 
-	size = MIN(videoBuffer.get(CV_CAP_PROP_FRAME_WIDTH), videoBuffer.get(CV_CAP_PROP_FRAME_HEIGHT)); // TODO : useless ?
 	videoHeight = videoBuffer.get(CV_CAP_PROP_FRAME_HEIGHT);
 	videoWidth = videoBuffer.get(CV_CAP_PROP_FRAME_WIDTH);
 	videoFramerate = videoBuffer.get(CV_CAP_PROP_FPS);
@@ -56,75 +488,163 @@ int main(int c, char ** argv)
 	cout << "Framerate: " << videoFramerate << "fps" << endl;
 	cout << "Total Frame Count: " << videoFrameTotalCount << endl;
 
-	// The exported video file, with the borders
-	Size frameSize(static_cast<int>(videoWidth + BORDER_WIDTH), static_cast<int>(videoHeight + BORDER_HEIGHT));
-	VideoWriter exportVideoWriter("stabilized_video.avi", CV_FOURCC('P', 'I', 'M', '1'), videoFramerate, frameSize, true);
-	// Initialisation : First frame
-	Mat previousFrame;
-	videoBuffer >> previousFrame;
+	// Some containers do not give their frame count or framerate
+	int lastFrameNumber = videoFrameTotalCount > 0 ? videoFrameTotalCount : INT_MAX;
+	if ( options.maxFrames > 0 )
+	{
+		lastFrameNumber = MIN(lastFrameNumber, options.maxFrames);
+	}
+	if ( videoFramerate <= 0 )
+	{
+		videoFramerate = 25;
+	}
 
-	// Then, loop on frames
-	for (int frameNumber = 2 ; frameNumber <= videoFrameTotalCount; frameNumber++)
+	// The replay may crop and scale the stabilized frames
+	Rect crop(0, 0, videoWidth, videoHeight);
+	if ( options.crop[2] > 0 )
 	{
-		//imshow("previousFrame", reduceImgCouleur(previousFrame, 4));
-		cout << "frame " << frameNumber << "/" << videoFrameTotalCount + 1 << " ";
-		Mat currentFrame;
-		videoBuffer >> currentFrame;
+		crop = Rect(options.crop[0], options.crop[1], options.crop[2], options.crop[3]);
+	}
+	double outputScale = options.replayPath.empty() ? 1 : options.outputScale;
 
-		// Handling end of video
-		if ( currentFrame.empty() )
+	// The exported video file. The stabilized frames have the size of the video, or of the scaled crop
+	VideoWriter exportVideoWriter;
+	if ( !options.outputPath.empty() )
+	{
+		const string& codec = options.codec;
+		Size frameSize(cvRound(crop.width * outputScale), cvRound(crop.height * outputScale));
+		if ( options.replayPath.empty() )
 		{
-			break;
-		} 
-		// Handling keyboard events
-		if ( quit_signal )
+			frameSize = Size(videoWidth, videoHeight);
+		}
+		exportVideoWriter.open(options.outputPath, CV_FOURCC(codec[0], codec[1], codec[2], codec[3]), videoFramerate, frameSize, true);
+		if ( !exportVideoWriter.isOpened() )
 		{
-			cout << "QUIT SIGNAL REACHED" << endl;
-			exit(0); // exit cleanly on interrupt
+			cerr << "[ERROR]: Could not create the video named \"" << options.outputPath << "\"" << endl;
+			return -1;
 		}
+	}
 
-		double elapsedTime = (double)cvGetTickCount();
-		Mat stabilizedFrame = stabilize(previousFrame, currentFrame);
-		elapsedTime = (double)cvGetTickCount() - elapsedTime;
-		printf( "detection time = %g ms\n", elapsedTime / ((double)cvGetTickFrequency() * 1000.) );
-
-		Mat singularitiesMask = getMaskOfIrrelevantAreasForSingularities(stabilizedFrame);
-		imshow("singularity final mask", scaleGrayFrame(singularitiesMask, 3));
-
-		// Blend frames together to generate some kind of "panorama" construction
-		Mat displayFrame = previousFrame.clone();
-		//imshow("before", display_frame);
-		if ( waitKey(300) >= 0 ) 
+	// The detected movements
+	TrajectoryWriter trajectory;
+	if ( !options.trajectoryPath.empty() && options.replayPath.empty() )
+	{
+		if ( options.pipeline )
 		{
-			break;
+			cerr << "[ERROR]: The trajectory can only be saved by the headless and chunks modes" << endl;
+			return -1;
 		}
-
-		for( int y = 0 ; y < stabilizedFrame.rows ; y++ )
+		if ( !trajectory.open(options.trajectoryPath, Size(videoWidth, videoHeight), videoFramerate,
+		                      options.stabilizerSettings.estimationMode) )
 		{
-			for( int x = 0 ; x < stabilizedFrame.cols ; x++ )
-			{
-				Vec3b pixel = displayFrame.at<Vec3b>(y,x);
-				Vec3b pixel2 = stabilizedFrame.at<Vec3b>(y,x);
-				pixel[0] = 0.5* pixel[0] + 0.5 * pixel2[0];
-				pixel[1] = 0.5* pixel[1] + 0.5 * pixel2[1];
-				pixel[2] = 0.5* pixel[2] + 0.5 * pixel2[2];
-				displayFrame.at<Vec3b>(y,x) = pixel;
-			}
+			cerr << "[ERROR]: Could not create the trajectory named \"" << options.trajectoryPath << "\"" << endl;
+			return -1;
 		}
+	}
 
-		//imshow("after", display_frame);
-		if ( waitKey(300) >= 0 ) 
+	// The stabilized frames published for other processes
+	SharedFrameWriter sharedOutput;
+	if ( !options.sharedOutputName.empty() )
+	{
+		if ( !sharedOutput.open(options.sharedOutputName, Size(videoWidth, videoHeight), options.sharedSlots) )
 		{
-			break;
+			return -1;
 		}
+		cout << "Stabilized frames published in the shared memory " << options.sharedOutputName << endl;
+	}
 
-		// spacebar control to move to the next frame
-		while ( waitKey(100) == -1 ) 
-		{}
+	// The masks of every frame
+	MaskSidecarWriter maskSidecar;
+	if ( !options.maskSidecarPath.empty() && !maskSidecar.open(options.maskSidecarPath, Size(videoWidth, videoHeight)) )
+	{
+		cerr << "[ERROR]: Could not create the mask sidecar named \"" << options.maskSidecarPath << "\"" << endl;
+		return -1;
+	}
 
-		previousFrame = currentFrame;
+	// The panorama, built by the interactive and headless modes
+	bool buildsPanorama = options.replayPath.empty() && options.chunkThreads == 0 && !options.pipeline;
+	if ( !options.panoramaPath.empty() && !buildsPanorama )
+	{
+		cerr << "[ERROR]: The panorama can only be built by the interactive and headless modes" << endl;
+		return -1;
+	}
+	Panorama panorama(options.panoramaPath.empty() ? DEFAULT_PANORAMA_SPILL_PREFIX : options.panoramaPath);
+
+	if ( !options.replayPath.empty() )
+	{
+		TrajectoryReader replayedTrajectory;
+		if ( !replayedTrajectory.open(options.replayPath) )
+		{
+			cerr << "[ERROR]: Could not open the trajectory named \"" << options.replayPath << "\"" << endl;
+			return -1;
+		}
+		double startTime = now();
+		int frames = replayTrajectory(videoBuffer, exportVideoWriter, replayedTrajectory, crop, outputScale, quit_signal);
+		double totalTime = now() - startTime;
+		cout << "Rendered " << frames << " frames in " << totalTime / 1000. << " s ("
+		     << frames / (totalTime / 1000.) << " fps)" << endl;
+	}
+	else if ( options.chunkThreads > 0 )
+	{
+		double startTime = now();
+		vector<Mat> homographies;
+		// --frames limits the chunks too: the same frames as a sequential run
+		const bool limited = options.maxFrames > 0;
+		if ( !estimateHomographiesInChunks(videoPath, limited ? lastFrameNumber : videoFrameTotalCount, limited, options.chunkThreads,
+		                                  options.stabilizerSettings, homographies, quit_signal) )
+		{
+			return -1;
+		}
+		double estimationTime = now() - startTime;
+		for ( size_t index = 0 ; index < homographies.size() && trajectory.isOpened() ; index++ )
+		{
+			TrajectoryRecord record;
+			record.frameIndex = index;
+			record.setHomography(homographies[index]);
+			trajectory.write(record);
+		}
+		int frames = applyHomographies(videoBuffer, exportVideoWriter, homographies, quit_signal);
+		double totalTime = now() - startTime;
+		cout << "Processed " << frames << " frames in " << totalTime / 1000. << " s ("
+		     << frames / (totalTime / 1000.) << " fps) with " << options.chunkThreads << " threads" << endl;
+		printf("Movement detection %.2f s, moving and encoding %.2f s\n", estimationTime / 1000., (totalTime - estimationTime) / 1000.);
+	}
+	else if ( options.pipeline )
+	{
+		PipelineStats stats = runPipeline(videoBuffer, exportVideoWriter, lastFrameNumber, options.workers,
+		                                  options.stabilizerSettings, quit_signal);
+		double frames = MAX(stats.frames, 1);
+		cout << "Processed " << stats.frames << " frames in " << stats.totalTime / 1000. << " s ("
+		     << stats.frames / (stats.totalTime / 1000.) << " fps) with " << options.workers << " workers" << endl;
+		printf("Per frame: total %.2f ms, decoding %.2f ms, pre processing %.2f ms, movement detection %.2f ms, encoding %.2f ms\n",
+		       stats.totalTime / frames, stats.decodingTime / frames, stats.preparationTime / frames,
+		       stats.estimationTime / frames, stats.encodingTime / frames);
+	}
+	else if ( options.headless )
+	{
+		runHeadless(videoBuffer, exportVideoWriter, lastFrameNumber, options.stabilizerSettings, trajectory,
+		            options.panoramaPath.empty() ? NULL : &panorama, options.sharedOutputName.empty() ? NULL : &sharedOutput,
+		            maskSidecar);
+	}
+	else
+	{
+		runInteractive(videoBuffer, exportVideoWriter, lastFrameNumber, options.stabilizerSettings, panorama);
 	}
 
+	if ( !options.panoramaPath.empty() )
+	{
+		Mat panoramaImage = panorama.render(options.panoramaScale);
+		if ( panoramaImage.empty() || !imwrite(options.panoramaPath, panoramaImage) )
+		{
+			cerr << "[ERROR]: Could not write the panorama named \"" << options.panoramaPath << "\"" << endl;
+		}
+		else
+		{
+			cout << "Panorama of " << panorama.getTileCount() << " tiles written to " << options.panoramaPath << endl;
+		}
+	}
+
+	finishProfiling();
 	cout << "Stabilization ended, closing program." << endl;
-	return 1;
-}
\ No newline at end of file
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+Mask sidecar files: the run length encoded masks of every frame of a video.
+*/
+
+#include "masksidecar.hpp"
+
+#include <cstring>
+#include <iostream>
+
+
+//*************************************************************************
+//                                 WRITER                                 *
+//*************************************************************************
+
+MaskSidecarWriter::MaskSidecarWriter()
+    : file(NULL)
+    , position(0)
+{
+}
+
+MaskSidecarWriter::~MaskSidecarWriter()
+{
+    close();
+}
+
+bool MaskSidecarWriter::open(const string& path, Size frameSize)
+{
+    close();
+    file = fopen(path.c_str(), "wb");
+    if ( file == NULL )
+    {
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MASK_SIDECAR_MAGIC, 4);
+    header.version = MASK_SIDECAR_VERSION;
+    header.frameWidth = frameSize.width;
+    header.frameHeight = frameSize.height;
+    offsets.clear();
+    position = sizeof(header);
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool MaskSidecarWriter::isOpened() const
+{
+    return file != NULL;
+}
+
+bool MaskSidecarWriter::write(const MaskSidecarFrame& frame)
+{
+    const int32_t frameIndex = frame.frameIndex;
+    if ( file == NULL || fwrite(&frameIndex, sizeof(frameIndex), 1, file) != 1
+         || !frame.singularities.write(file) || !frame.camera.write(file) )
+    {
+        return false;
+    }
+    offsets.push_back(position);
+    position += sizeof(frameIndex) + frame.singularities.getEncodedSize() + frame.camera.getEncodedSize();
+    return true;
+}
+
+void MaskSidecarWriter::close()
+{
+    if ( file == NULL )
+    {
+        return;
+    }
+    header.frameCount = offsets.size();
+    header.indexOffset = position;
+    if ( !offsets.empty() )
+    {
+        fwrite(&offsets[0], sizeof(uint64_t), offsets.size(), file);
+    }
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    file = NULL;
+}
+
+uint64_t MaskSidecarWriter::getFileSize() const
+{
+    return position;
+}
+
+
+//*************************************************************************
+//                                 READER                                 *
+//*************************************************************************
+
+MaskSidecarReader::MaskSidecarReader()
+    : file(NULL)
+    , fileSize(0)
+{
+}
+
+MaskSidecarReader::~MaskSidecarReader()
+{
+    close();
+}
+
+bool MaskSidecarReader::open(const string& path)
+{
+    close();
+    file = fopen(path.c_str(), "rb");
+    if ( file == NULL )
+    {
+        return false;
+    }
+    if ( fread(&header, sizeof(header), 1, file) != 1
+         || memcmp(header.magic, MASK_SIDECAR_MAGIC, 4) != 0
+         || header.version != MASK_SIDECAR_VERSION )
+    {
+        cerr << "[ERROR]: \"" << path << "\" is not a mask sidecar file, or not of this version" << endl;
+        close();
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    fileSize = ftell(file);
+    if ( header.indexOffset == 0 )
+    {
+        cerr << "[WARNING]: The mask sidecar \"" << path << "\" was not closed, its frames are searched" << endl;
+        return rebuildIndex();
+    }
+    if ( header.indexOffset > fileSize || header.frameCount > ( fileSize - header.indexOffset ) / sizeof(uint64_t) )
+    {
+        cerr << "[ERROR]: The index of the mask sidecar \"" << path << "\" is truncated" << endl;
+        close();
+        return false;
+    }
+    offsets.resize(header.frameCount);
+    if ( fseek(file, header.indexOffset, SEEK_SET) != 0
+         || ( !offsets.empty() && fread(&offsets[0], sizeof(uint64_t), offsets.size(), file) != offsets.size() ) )
+    {
+        cerr << "[ERROR]: The index of the mask sidecar \"" << path << "\" is truncated" << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MaskSidecarReader::rebuildIndex()
+{
+    offsets.clear();
+    MaskSidecarFrame frame;
+    uint64_t position = sizeof(header);
+    // The last frame may be cut: only the complete ones are kept
+    while ( readFrame(position, frame) )
+    {
+        offsets.push_back(position);
+        position += sizeof(int32_t) + frame.singularities.getEncodedSize() + frame.camera.getEncodedSize();
+    }
+    header.frameCount = offsets.size();
+    return true;
+}
+
+bool MaskSidecarReader::isOpened() const
+{
+    return file != NULL;
+}
+
+void MaskSidecarReader::close()
+{
+    if ( file != NULL )
+    {
+        fclose(file);
+        file = NULL;
+    }
+    offsets.clear();
+}
+
+const MaskSidecarHeader& MaskSidecarReader::getHeader() const
+{
+    return header;
+}
+
+int MaskSidecarReader::getFrameCount() const
+{
+    return (int)offsets.size();
+}
+
+Size MaskSidecarReader::getFrameSize() const
+{
+    return Size(header.frameWidth, header.frameHeight);
+}
+
+bool MaskSidecarReader::read(int frameIndex, MaskSidecarFrame& frame)
+{
+    if ( file == NULL || frameIndex < 0 || frameIndex >= getFrameCount() )
+    {
+        return false;
+    }
+    return readFrame(offsets[frameIndex], frame);
+}
+
+bool MaskSidecarReader::readFrame(uint64_t position, MaskSidecarFrame& frame)
+{
+    int32_t storedIndex;
+    if ( position + sizeof(storedIndex) > fileSize || fseek(file, position, SEEK_SET) != 0
+         || fread(&storedIndex, sizeof(storedIndex), 1, file) != 1 )
+    {
+        return false;
+    }
+    position += sizeof(storedIndex);
+    if ( !frame.singularities.read(file, fileSize - position) )
+    {
+        return false;
+    }
+    position += frame.singularities.getEncodedSize();
+    if ( !frame.camera.read(file, fileSize - position) )
+    {
+        return false;
+    }
+    frame.frameIndex = storedIndex;
+    return true;
+}
@@ -0,0 +1,99 @@
+/*
+Mask sidecar files: the singularity and camera stabilization masks of every frame of a video,
+run length encoded (see maskspans.hpp), next to the stabilized video.
+
+Layout (host byte order):
+    MaskSidecarHeader
+    per frame, in order: frame index (int32), singularity mask, camera stabilization mask (MaskSpans::write())
+    index: offset of every frame in the file (uint64 x frameCount)
+The records do not have a fixed size: the index is written when the file is closed, and its offset
+is in the header. A file that was not closed has no index: the reader finds the frames by reading them.
+*/
+
+#ifndef MASKSIDECAR_HPP
+#define MASKSIDECAR_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "maskspans.hpp"
+
+#define MASK_SIDECAR_MAGIC "SMSK"
+#define MASK_SIDECAR_VERSION 1
+
+
+#pragma pack(push, 1)
+struct MaskSidecarHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t frameWidth;
+    int32_t frameHeight;
+    uint64_t frameCount;    // written when the file is closed
+    uint64_t indexOffset;   // written when the file is closed, 0 before
+};
+#pragma pack(pop)
+
+// The masks of a frame
+struct MaskSidecarFrame
+{
+    int frameIndex;
+    MaskSpans singularities;    // mask of irrelevant areas for singularities, frame size
+    MaskSpans camera;           // mask of irrelevant areas for the camera stabilization, bordered frame size (may be empty)
+};
+
+class MaskSidecarWriter
+{
+public:
+    MaskSidecarWriter();
+    ~MaskSidecarWriter();
+
+    bool open(const string& path, Size frameSize);
+    bool isOpened() const;
+    // The frames are written in order, one per frame of the video
+    bool write(const MaskSidecarFrame& frame);
+    // Write the index and the header
+    void close();
+
+    // Bytes written so far
+    uint64_t getFileSize() const;
+
+private:
+    FILE* file;
+    MaskSidecarHeader header;
+    vector<uint64_t> offsets;
+    uint64_t position;
+};
+
+class MaskSidecarReader
+{
+public:
+    MaskSidecarReader();
+    ~MaskSidecarReader();
+
+    bool open(const string& path);
+    bool isOpened() const;
+    void close();
+
+    const MaskSidecarHeader& getHeader() const;
+    int getFrameCount() const;
+    Size getFrameSize() const;
+
+    // Random access to the masks of a frame
+    bool read(int frameIndex, MaskSidecarFrame& frame);
+
+private:
+    // Find the frames of a file that was not closed
+    bool rebuildIndex();
+    // Read the frame at a position of the file
+    bool readFrame(uint64_t position, MaskSidecarFrame& frame);
+
+    FILE* file;
+    uint64_t fileSize;
+    MaskSidecarHeader header;
+    vector<uint64_t> offsets;
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*
+Run length encoding of the binary masks.
+*/
+
+#include "maskspans.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+/*
+@return 8 pixels of a row
+*/
+static inline uint64_t loadPixels(const uchar* pixels)
+{
+    uint64_t word;
+    memcpy(&word, pixels, sizeof(word));
+    return word;
+}
+
+/*
+Append the spans of a row, skipping 8 pixels at a time inside the uniform areas (0 or 255)
+@param row: the pixels of the row
+@param width: the width of the row
+@param spans: where the spans are appended
+*/
+static void encodeRow(const uchar* row, int width, vector<MaskSpan>& spans)
+{
+    int x = 0;
+    while ( x < width )
+    {
+        while ( x + 8 <= width && loadPixels(row + x) == 0 )
+        {
+            x += 8;
+        }
+        while ( x < width && row[x] == 0 )
+        {
+            x++;
+        }
+        if ( x >= width )
+        {
+            break;
+        }
+        MaskSpan span;
+        span.start = x;
+        while ( x + 8 <= width && loadPixels(row + x) == ~(uint64_t)0 )
+        {
+            x += 8;
+        }
+        while ( x < width && row[x] != 0 )
+        {
+            x++;
+        }
+        span.end = x;
+        spans.push_back(span);
+    }
+}
+
+MaskSpans::MaskSpans()
+{
+    clear();
+}
+
+void MaskSpans::encode(const Mat& mask)
+{
+    CV_Assert( mask.type() == CV_8U && mask.cols <= MASK_SPANS_MAX_WIDTH );
+    size = mask.size();
+    rowStarts.resize(size.height + 1);
+    spans.clear();
+    for ( int y = 0 ; y < size.height ; y++ )
+    {
+        rowStarts[y] = spans.size();
+        encodeRow(mask.ptr<uchar>(y), size.width, spans);
+    }
+    rowStarts[size.height] = spans.size();
+}
+
+void MaskSpans::decode(Mat& mask) const
+{
+    mask.create(size, CV_8U);
+    for ( int y = 0 ; y < size.height ; y++ )
+    {
+        uchar* row = mask.ptr<uchar>(y);
+        int x = 0;
+        for ( uint32_t i = rowStarts[y] ; i < rowStarts[y + 1] ; i++ )
+        {
+            memset(row + x, 0, spans[i].start - x);
+            memset(row + spans[i].start, 255, spans[i].end - spans[i].start);
+            x = spans[i].end;
+        }
+        memset(row + x, 0, size.width - x);
+    }
+}
+
+void MaskSpans::clear()
+{
+    size = Size();
+    rowStarts.assign(1, 0);
+    spans.clear();
+}
+
+bool MaskSpans::empty() const
+{
+    return size.area() == 0;
+}
+
+Size MaskSpans::getSize() const
+{
+    return size;
+}
+
+int MaskSpans::getSpanCount() const
+{
+    return spans.size();
+}
+
+int MaskSpans::getRow(int y, const MaskSpan*& rowSpans) const
+{
+    CV_Assert( y >= 0 && y < size.height );
+    rowSpans = spans.data() + rowStarts[y];
+    return rowStarts[y + 1] - rowStarts[y];
+}
+
+bool MaskSpans::contains(int x, int y) const
+{
+    if ( (unsigned)x >= (unsigned)size.width || (unsigned)y >= (unsigned)size.height )
+    {
+        return false;
+    }
+    const MaskSpan* first = spans.data() + rowStarts[y];
+    const MaskSpan* last = spans.data() + rowStarts[y + 1];
+    // The first span starting after x, the one before may hold x
+    const MaskSpan* after = upper_bound(first, last, x, [](int value, const MaskSpan& span) { return value < span.start; });
+    return after != first && x < (after - 1)->end;
+}
+
+int MaskSpans::countNonZero() const
+{
+    int count = 0;
+    for ( size_t i = 0 ; i < spans.size() ; i++ )
+    {
+        count += spans[i].end - spans[i].start;
+    }
+    return count;
+}
+
+int MaskSpans::countNonZero(Rect area) const
+{
+    area &= Rect(0, 0, size.width, size.height);
+    int count = 0;
+    for ( int y = area.y ; y < area.y + area.height ; y++ )
+    {
+        for ( uint32_t i = rowStarts[y] ; i < rowStarts[y + 1] ; i++ )
+        {
+            const int start = MAX((int)spans[i].start, area.x);
+            const int end = MIN((int)spans[i].end, area.x + area.width);
+            count += MAX(end - start, 0);
+        }
+    }
+    return count;
+}
+
+
+//*************************************************************************
+//                             SERIALIZATION                              *
+//*************************************************************************
+
+bool MaskSpans::write(FILE* file) const
+{
+    const int32_t dimensions[3] = { size.width, size.height, (int32_t)spans.size() };
+    if ( fwrite(dimensions, sizeof(dimensions), 1, file) != 1 )
+    {
+        return false;
+    }
+    if ( size.height > 0 )
+    {
+        // A row has at most MASK_SPANS_MAX_WIDTH / 2 spans
+        rowCounts.resize(size.height);
+        for ( int y = 0 ; y < size.height ; y++ )
+        {
+            rowCounts[y] = rowStarts[y + 1] - rowStarts[y];
+        }
+        if ( fwrite(&rowCounts[0], sizeof(uint16_t), size.height, file) != (size_t)size.height )
+        {
+            return false;
+        }
+    }
+    return spans.empty() || fwrite(&spans[0], sizeof(MaskSpan), spans.size(), file) == spans.size();
+}
+
+bool MaskSpans::read(FILE* file, uint64_t available)
+{
+    int32_t dimensions[3];
+    if ( fread(dimensions, sizeof(dimensions), 1, file) != 1
+         || dimensions[0] < 0 || dimensions[0] > MASK_SPANS_MAX_WIDTH || dimensions[1] < 0 || dimensions[2] < 0
+         || (int64_t)dimensions[2] > (int64_t)dimensions[1] * ( dimensions[0] / 2 + 1 )
+         // A corrupted size must not allocate more than the file holds
+         || sizeof(dimensions) + (uint64_t)dimensions[1] * sizeof(uint16_t) + (uint64_t)dimensions[2] * sizeof(MaskSpan) > available )
+    {
+        clear();
+        return false;
+    }
+    size = Size(dimensions[0], dimensions[1]);
+    rowCounts.resize(size.height);
+    rowStarts.resize(size.height + 1);
+    spans.resize(dimensions[2]);
+    bool valid = ( size.height == 0 || fread(&rowCounts[0], sizeof(uint16_t), size.height, file) == (size_t)size.height )
+                 && ( spans.empty() || fread(&spans[0], sizeof(MaskSpan), spans.size(), file) == spans.size() );
+    rowStarts[0] = 0;
+    for ( int y = 0 ; y < size.height && valid ; y++ )
+    {
+        rowStarts[y + 1] = rowStarts[y] + rowCounts[y];
+    }
+    valid = valid && rowStarts[size.height] == spans.size();
+    // The queries rely on sorted spans inside the row
+    for ( int y = 0 ; y < size.height && valid ; y++ )
+    {
+        int x = 0;
+        for ( uint32_t i = rowStarts[y] ; i < rowStarts[y + 1] && valid ; i++ )
+        {
+            valid = spans[i].start >= x && spans[i].end > spans[i].start && spans[i].end <= size.width;
+            x = spans[i].end;
+        }
+    }
+    if ( !valid )
+    {
+        clear();
+    }
+    return valid;
+}
+
+size_t MaskSpans::getEncodedSize() const
+{
+    return 3 * sizeof(int32_t) + size.height * sizeof(uint16_t) + spans.size() * sizeof(MaskSpan);
+}
@@ -0,0 +1,80 @@
+/*
+Run length encoding of the binary masks (singularities, camera stabilization).
+The masks are mostly made of a few large areas (the public, the score panel, the borders): each row
+is stored as the sorted list of its spans of set pixels, a few bytes per row instead of the width.
+The per pixel tests run on the spans themselves, without expanding the mask again.
+*/
+
+#ifndef MASKSPANS_HPP
+#define MASKSPANS_HPP
+
+#include <cstdio>
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+// The span bounds are 16 bit: wider masks can not be encoded
+#define MASK_SPANS_MAX_WIDTH 65535
+
+
+// Set pixels start to end - 1 of a row
+struct MaskSpan
+{
+    uint16_t start;
+    uint16_t end;
+};
+
+class MaskSpans
+{
+public:
+    MaskSpans();
+
+    /*
+    @param mask: the mask to encode (CV_8U), every non zero pixel is set
+    The buffers are reused: encoding masks of the same size does not allocate once they hold the largest one.
+    */
+    void encode(const Mat& mask);
+    /*
+    @param mask: filled with the mask (CV_8U, 255 for the set pixels), written in place when it has the right size
+    */
+    void decode(Mat& mask) const;
+    void clear();
+
+    bool empty() const;
+    Size getSize() const;
+    int getSpanCount() const;
+
+    /*
+    @param y: a row of the mask
+    @param spans: set to the spans of the row, sorted and separated
+    @return the number of spans of the row
+    */
+    int getRow(int y, const MaskSpan*& spans) const;
+    // @return true if the pixel (x, y) is set (false outside of the mask)
+    bool contains(int x, int y) const;
+    int countNonZero() const;
+    // @return the set pixels in an area
+    int countNonZero(Rect area) const;
+
+    /*
+    Serialization: width, height and span count (int32), spans per row (uint16 x height), spans
+    @param available: the bytes left in the file, checked before the buffers are sized from the data
+    @return false on a write error, or a read error or corrupted data
+    */
+    bool write(FILE* file) const;
+    bool read(FILE* file, uint64_t available);
+    // Bytes written by write()
+    size_t getEncodedSize() const;
+
+private:
+    Size size;
+    vector<uint32_t> rowStarts;     // the spans of the row y are spans[rowStarts[y]] to spans[rowStarts[y + 1] - 1]
+    vector<MaskSpan> spans;
+    mutable vector<uint16_t> rowCounts; // serialization buffer
+};
+
+#endif
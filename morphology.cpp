@@ -0,0 +1,141 @@
+/*
+Morphology of the masks with rectangular structuring elements.
+*/
+
+#include "morphology.hpp"
+
+
+/*
+Buffers of the passes. The masks of a video have the same sizes from one frame to the next:
+each thread keeps its buffers from one call to the next, so they are only allocated on the first frames.
+They only grow, the passes use their top left part.
+*/
+struct MorphologyBuffers
+{
+    Mat neutralRow;
+    Mat prefix;
+    Mat suffix;
+    Mat columns;
+    Mat transposed;
+    Mat rows;
+};
+
+static thread_local MorphologyBuffers morphologyBuffers;
+
+/*
+@return the top left rows x cols part of the buffer, grown if needed
+*/
+static Mat reserve(Mat& buffer, int rows, int cols)
+{
+    if ( buffer.rows < rows || buffer.cols < cols )
+    {
+        buffer.create(MAX(buffer.rows, rows), MAX(buffer.cols, cols), CV_8U);
+    }
+    return buffer(Rect(0, 0, cols, rows));
+}
+
+struct Erosion
+{
+    // Value of the pixels out of the image: never the minimum
+    static const uchar neutral = 255;
+    static void combine(const Mat& a, const Mat& b, Mat& result) { min(a, b, result); }
+};
+
+struct Dilation
+{
+    static const uchar neutral = 0;
+    static void combine(const Mat& a, const Mat& b, Mat& result) { max(a, b, result); }
+};
+
+/*
+van Herk / Gil-Werman running minimum or maximum over the columns:
+dst(y) is the minimum of src(y - radius) ... src(y + radius).
+The rows, extended by radius neutral rows on both sides, are cut in blocks of the window size.
+In each block, prefix(i) combines the rows from the block start to i, and suffix(i) the rows from i to the block end.
+A window starting at i covers the end of one block and the start of the next one: its result is
+suffix(i) combined with prefix(i + window - 1), 3 operations per pixel whatever the window size.
+Each operation works on whole rows, with the vectorized min() / max().
+*/
+template<typename Operation>
+static void runningColumns(const Mat& src, Mat& dst, int radius)
+{
+    const int window = 2 * radius + 1;
+    const int length = src.rows + 2 * radius;
+    const int total = (length + window - 1) / window * window;
+    Mat neutralRow = reserve(morphologyBuffers.neutralRow, 1, src.cols);
+    neutralRow.setTo(Scalar(Operation::neutral));
+    Mat prefix = reserve(morphologyBuffers.prefix, total, src.cols);
+    Mat suffix = reserve(morphologyBuffers.suffix, total, src.cols);
+
+    for ( int start = 0 ; start < total ; start += window )
+    {
+        for ( int i = start ; i < start + window ; i++ )
+        {
+            int y = i - radius;
+            const Mat row = y >= 0 && y < src.rows ? src.row(y) : neutralRow;
+            Mat prefixRow = prefix.row(i);
+            if ( i == start )
+            {
+                row.copyTo(prefixRow);
+            }
+            else
+            {
+                Operation::combine(prefix.row(i - 1), row, prefixRow);
+            }
+        }
+        for ( int i = start + window - 1 ; i >= start ; i-- )
+        {
+            int y = i - radius;
+            const Mat row = y >= 0 && y < src.rows ? src.row(y) : neutralRow;
+            Mat suffixRow = suffix.row(i);
+            if ( i == start + window - 1 )
+            {
+                row.copyTo(suffixRow);
+            }
+            else
+            {
+                Operation::combine(suffix.row(i + 1), row, suffixRow);
+            }
+        }
+    }
+
+    dst.create(src.rows, src.cols, CV_8U);
+    for ( int y = 0 ; y < src.rows ; y++ )
+    {
+        // The window of dst(y) starts at the extended row y
+        Mat dstRow = dst.row(y);
+        Operation::combine(suffix.row(y), prefix.row(y + window - 1), dstRow);
+    }
+}
+
+/*
+The rectangle is separable: columns pass, then the rows pass done as a columns pass on the transposed image
+*/
+template<typename Operation>
+static void rectangleMorphology(const Mat& src, Mat& dst, int radius)
+{
+    CV_Assert( src.type() == CV_8U && radius >= 0 );
+    if ( radius == 0 )
+    {
+        src.copyTo(dst);
+        return;
+    }
+    Mat columns = reserve(morphologyBuffers.columns, src.rows, src.cols);
+    Mat transposed = reserve(morphologyBuffers.transposed, src.cols, src.rows);
+    Mat rows = reserve(morphologyBuffers.rows, src.cols, src.rows);
+    runningColumns<Operation>(src, columns, radius);
+    transpose(columns, transposed);
+    runningColumns<Operation>(transposed, rows, radius);
+    // dst may be src: written last
+    transpose(rows, dst);
+}
+
+void erodeRectangle(const Mat& src, Mat& dst, int radius)
+{
+    rectangleMorphology<Erosion>(src, dst, radius);
+}
+
+void dilateRectangle(const Mat& src, Mat& dst, int radius)
+{
+    rectangleMorphology<Dilation>(src, dst, radius);
+}
@@ -0,0 +1,31 @@
+/*
+Morphology of the masks with rectangular structuring elements.
+Same results as erode() / dilate() with a MORPH_RECT element and the default border
+(the pixels out of the image are ignored), at a constant cost per pixel whatever the element size:
+the rectangle is separated in a vertical and an horizontal pass, each computed with the
+van Herk / Gil-Werman running minimum / maximum.
+*/
+
+#ifndef MORPHOLOGY_HPP
+#define MORPHOLOGY_HPP
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+
+
+/*
+@param src: the CV_8U image to erode
+@param dst: the eroded image, may be src
+@param radius: the element is a (2 * radius + 1) square centered on the pixel
+*/
+void erodeRectangle(const Mat& src, Mat& dst, int radius);
+
+/*
+@param src: the CV_8U image to dilate
+@param dst: the dilated image, may be src
+@param radius: the element is a (2 * radius + 1) square centered on the pixel
+*/
+void dilateRectangle(const Mat& src, Mat& dst, int radius);
+
+#endif
@@ -0,0 +1,343 @@
+/*
+Command line configuration of the Main program
+*/
+
+#include "options.hpp"
+#include "sharedframes.hpp"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+// Decoding, movement detection and encoding keep one core each
+#define DEFAULT_WORKERS max(1, (int)thread::hardware_concurrency() - 3)
+// Every core runs the streams
+#define DEFAULT_STREAM_THREADS max(1, (int)thread::hardware_concurrency())
+
+
+Options::Options()
+    : inputPath(DEFAULT_INPUT_PATH)
+    , outputPath(DEFAULT_OUTPUT_PATH)
+    , codec(DEFAULT_CODEC)
+    , headless(false)
+    , pipeline(false)
+    , workers(DEFAULT_WORKERS)
+    , chunkThreads(0)
+    , streamThreads(DEFAULT_STREAM_THREADS)
+    , outputScale(1)
+    , maxFrames(0)
+    , panoramaScale(1)
+    , sharedSlots(SHARED_FRAMES_DEFAULT_SLOTS)
+    , profileInterval(0)
+    , help(false)
+{
+    crop[0] = crop[1] = crop[2] = crop[3] = 0;
+}
+
+/*
+@param value: the text to convert
+@param result: the converted integer
+@return false if value is not an integer
+*/
+static bool parseInt(const char* value, int& result)
+{
+    char* end = NULL;
+    long parsed = strtol(value, &end, 10);
+    if ( end == value || *end != '\0' )
+    {
+        return false;
+    }
+    result = static_cast<int>(parsed);
+    return true;
+}
+
+bool parseOptions(int argc, char ** argv, Options& options)
+{
+    for ( int i = 1 ; i < argc ; i++ )
+    {
+        string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if ( argument == "-h" || argument == "--help" )
+        {
+            options.help = true;
+        }
+        else if ( argument == "--headless" )
+        {
+            options.headless = true;
+        }
+        else if ( argument == "--pipeline" )
+        {
+            options.headless = true;
+            options.pipeline = true;
+        }
+        else if ( argument == "--no-output" )
+        {
+            options.outputPath = "";
+        }
+        else if ( ( argument == "-i" || argument == "--input" ) && hasValue )
+        {
+            options.inputPath = argv[++i];
+        }
+        else if ( ( argument == "-o" || argument == "--output" ) && hasValue )
+        {
+            options.outputPath = argv[++i];
+        }
+        else if ( argument == "--codec" && hasValue )
+        {
+            options.codec = argv[++i];
+            if ( options.codec.size() != 4 )
+            {
+                cerr << "[ERROR]: The codec must be a fourcc, like PIM1 or MJPG" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--frames" && hasValue )
+        {
+            if ( !parseInt(argv[++i], options.maxFrames) || options.maxFrames < 0 )
+            {
+                cerr << "[ERROR]: --frames expects a positive number" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--workers" && hasValue )
+        {
+            if ( !parseInt(argv[++i], options.workers) || options.workers < 1 )
+            {
+                cerr << "[ERROR]: --workers expects a number greater than 0" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--chunks" && hasValue )
+        {
+            if ( !parseInt(argv[++i], options.chunkThreads) || options.chunkThreads < 1 )
+            {
+                cerr << "[ERROR]: --chunks expects a number greater than 0" << endl;
+                return false;
+            }
+            options.headless = true;
+        }
+        else if ( argument == "--streams" && hasValue )
+        {
+            // Comma separated paths
+            string paths = argv[++i];
+            size_t start = 0;
+            while ( start <= paths.size() )
+            {
+                size_t end = paths.find(',', start);
+                end = end == string::npos ? paths.size() : end;
+                if ( end > start )
+                {
+                    options.streamPaths.push_back(paths.substr(start, end - start));
+                }
+                start = end + 1;
+            }
+            if ( options.streamPaths.empty() )
+            {
+                cerr << "[ERROR]: --streams expects comma separated videos or named pipes" << endl;
+                return false;
+            }
+            options.headless = true;
+        }
+        else if ( argument == "--stream-threads" && hasValue )
+        {
+            if ( !parseInt(argv[++i], options.streamThreads) || options.streamThreads < 1 )
+            {
+                cerr << "[ERROR]: --stream-threads expects a number greater than 0" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--estimation" && hasValue )
+        {
+            string mode = argv[++i];
+            if ( mode == "full" )
+            {
+                options.stabilizerSettings.estimationMode = ESTIMATION_FULL;
+            }
+            else if ( mode == "pyramid" )
+            {
+                options.stabilizerSettings.estimationMode = ESTIMATION_PYRAMID;
+            }
+            else if ( mode == "tracking" )
+            {
+                options.stabilizerSettings.estimationMode = ESTIMATION_TRACKING;
+            }
+            else
+            {
+                cerr << "[ERROR]: --estimation expects full, pyramid or tracking" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--mask-downscale" && hasValue )
+        {
+            int& downscale = options.stabilizerSettings.maskDownscale;
+            if ( !parseInt(argv[++i], downscale) || downscale < 1 )
+            {
+                cerr << "[ERROR]: --mask-downscale expects a number greater than 0" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--detect-overlay" )
+        {
+            options.stabilizerSettings.detectOverlay = true;
+        }
+        else if ( argument == "--detect-cuts" )
+        {
+            options.stabilizerSettings.detectCuts = true;
+        }
+        else if ( argument == "--keyframes" && hasValue )
+        {
+            int& interval = options.stabilizerSettings.keyframeInterval;
+            options.headless = true;
+            if ( !parseInt(argv[++i], interval) || interval < 1 )
+            {
+                cerr << "[ERROR]: --keyframes expects a number greater than 0" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--adaptive-keyframes" )
+        {
+            options.stabilizerSettings.adaptiveKeyframes = true;
+        }
+        else if ( argument == "--deadline" && hasValue )
+        {
+            options.stabilizerSettings.deadline = atof(argv[++i]);
+            options.headless = true;
+            if ( options.stabilizerSettings.deadline <= 0 )
+            {
+                cerr << "[ERROR]: --deadline expects a number of ms greater than 0" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--trajectory" && hasValue )
+        {
+            options.trajectoryPath = argv[++i];
+            options.headless = true;
+        }
+        else if ( argument == "--replay" && hasValue )
+        {
+            options.replayPath = argv[++i];
+            options.headless = true;
+        }
+        else if ( argument == "--crop" && hasValue )
+        {
+            int* crop = options.crop;
+            char end;
+            if ( sscanf(argv[++i], "%d,%d,%d,%d%c", &crop[0], &crop[1], &crop[2], &crop[3], &end) != 4
+                 || crop[0] < 0 || crop[1] < 0 || crop[2] <= 0 || crop[3] <= 0 )
+            {
+                cerr << "[ERROR]: --crop expects x,y,width,height" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--output-scale" && hasValue )
+        {
+            options.outputScale = atof(argv[++i]);
+            if ( options.outputScale <= 0 )
+            {
+                cerr << "[ERROR]: --output-scale expects a number greater than 0" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--panorama" && hasValue )
+        {
+            options.panoramaPath = argv[++i];
+        }
+        else if ( argument == "--panorama-scale" && hasValue )
+        {
+            options.panoramaScale = atof(argv[++i]);
+            if ( options.panoramaScale <= 0 )
+            {
+                cerr << "[ERROR]: --panorama-scale expects a number greater than 0" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--mask-sidecar" && hasValue )
+        {
+            options.maskSidecarPath = argv[++i];
+            options.headless = true;
+        }
+        else if ( argument == "--shared-output" && hasValue )
+        {
+            options.sharedOutputName = argv[++i];
+            options.headless = true;
+            if ( options.sharedOutputName.size() < 2 || options.sharedOutputName[0] != '/'
+                 || options.sharedOutputName.find('/', 1) != string::npos )
+            {
+                cerr << "[ERROR]: --shared-output expects a name starting with a single / (e.g. /stabilized)" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--shared-slots" && hasValue )
+        {
+            if ( !parseInt(argv[++i], options.sharedSlots) || options.sharedSlots < 2 )
+            {
+                cerr << "[ERROR]: --shared-slots expects a number greater than 1" << endl;
+                return false;
+            }
+        }
+        else if ( argument == "--profile" && hasValue )
+        {
+            options.profilePath = argv[++i];
+        }
+        else if ( argument == "--profile-every" && hasValue )
+        {
+            if ( !parseInt(argv[++i], options.profileInterval) || options.profileInterval < 0 )
+            {
+                cerr << "[ERROR]: --profile-every expects a positive number" << endl;
+                return false;
+            }
+        }
+        else
+        {
+            cerr << "[ERROR]: Unknown or incomplete option \"" << argument << "\"" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void printUsage(const char* programName)
+{
+    cout << "Usage: " << programName << " [options]" << endl
+         << "  -i, --input PATH    video to stabilize (default " << DEFAULT_INPUT_PATH << ")" << endl
+         << "  -o, --output PATH   stabilized video (default " << DEFAULT_OUTPUT_PATH << ")" << endl
+         << "  --no-output         do not export the stabilized video" << endl
+         << "  --codec FOURCC      codec of the stabilized video (default " << DEFAULT_CODEC << ")" << endl
+         << "  --frames N          stop after N frames" << endl
+         << "  --headless          no window and no wait, report the throughput at the end" << endl
+         << "  --pipeline          headless, decoding, stabilization and encoding on separate threads" << endl
+         << "  --workers N         pre processing threads of the pipeline (default: cores - 3)" << endl
+         << "  --chunks N          headless, split the video in chunks and detect their movements on N threads" << endl
+         << "                      (not with --detect-overlay, --detect-cuts or --estimation tracking)" << endl
+         << "  --streams A,B,...   headless, stabilize these videos or named pipes at once, on one pool of threads" << endl
+         << "                      (the stabilized videos are the output path suffixed by _0, _1...)" << endl
+         << "  --stream-threads N  threads shared by the streams (default: cores)" << endl
+         << "  --estimation MODE   movement detection: full (default), pyramid (coarse to fine)" << endl
+         << "                      or tracking (corners tracked from frame to frame)" << endl
+         << "  --mask-downscale N  compute the masks on frames reduced N times (default 1, full resolution)" << endl
+         << "  --detect-overlay    find the score overlay of the video instead of using the default panel" << endl
+         << "  --detect-cuts       no movement detection across cuts, close-ups go through as they are" << endl
+         << "                      (interactive, headless and --streams)" << endl
+         << "  --keyframes N       headless, detect the movement every N frames only, and predict it in between" << endl
+         << "  --adaptive-keyframes  with --keyframes: adapt the interval to the prediction error (N at most)" << endl
+         << "  --deadline MS       headless, real-time mode: lower the quality when the stabilization of a frame" << endl
+         << "                      takes more than MS ms on average, raise it again when there is time left" << endl
+         << "  --trajectory PATH   headless, save the detected movements (with --chunks too)" << endl
+         << "  --replay PATH       headless, render the video with the movements of a saved trajectory" << endl
+         << "  --crop X,Y,W,H      replay only: keep this area of the stabilized frames" << endl
+         << "  --output-scale S    replay only: scale of the rendered video" << endl
+         << "  --panorama PATH     save the panorama of the pitch built from the frames (image file)" << endl
+         << "  --panorama-scale S  scale of the panorama image (default 1)" << endl
+         << "  --mask-sidecar PATH headless, save the singularity and camera masks of every frame, run length encoded" << endl
+         << "  --shared-output NAME  headless, publish the stabilized frames, their movements and singularity masks" << endl
+         << "                      in the POSIX shared memory NAME (e.g. /stabilized) for other processes" << endl
+         << "  --shared-slots N    frames in the shared memory ring (default " << SHARED_FRAMES_DEFAULT_SLOTS << ")" << endl
+         << "  --profile PATH      write the per stage timings (p50 / p95 / p99) as JSON at exit" << endl
+         << "  --profile-every N   also write them every N frames" << endl
+         << "  -h, --help          print this help" << endl;
+}
@@ -0,0 +1,56 @@
+/*
+Command line configuration of the Main program
+*/
+
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <string>
+#include <vector>
+
+#include "stabilization.hpp"
+
+// Defaults
+#define DEFAULT_INPUT_PATH "samples/calme.mp4"
+#define DEFAULT_OUTPUT_PATH "stabilized_video.avi"
+#define DEFAULT_CODEC "PIM1"
+
+
+struct Options
+{
+    std::string inputPath;  // video to stabilize
+    std::string outputPath; // stabilized video, empty to disable the export
+    std::string codec;      // fourcc of the exported video
+    bool headless;          // no window, no wait: process the video as fast as possible
+    bool pipeline;          // headless, with the decoding, stabilization and encoding on separate threads
+    int workers;            // pre processing threads of the pipeline
+    int chunkThreads;       // headless, movement detection on chunks of the video in parallel (0 to disable)
+    std::vector<std::string> streamPaths; // headless, stabilize these streams at once instead of the input video
+    int streamThreads;      // threads shared by the streams
+    std::string trajectoryPath; // where to save the detected movements (headless and chunks), empty to disable
+    std::string replayPath; // headless, render the video with the movements of this trajectory, empty to disable
+    int crop[4];            // replay only: x, y, width, height of the kept area, width 0 for the whole frame
+    double outputScale;     // replay only: scale of the rendered video
+    int maxFrames;          // stop after this number of frames, 0 for the whole video
+    std::string panoramaPath; // interactive and headless, image of the panorama of the pitch, empty to disable
+    double panoramaScale;   // scale of the panorama image
+    std::string maskSidecarPath; // headless, save the run length encoded masks of every frame, empty to disable
+    std::string sharedOutputName; // headless, publish the stabilized frames in this shared memory ring, empty to disable
+    int sharedSlots;        // frames in the shared memory ring
+    std::string profilePath; // JSON report of the per stage timings, empty to disable the profiling
+    int profileInterval;    // write the report every N frames, 0 to write it at exit only
+    StabilizerSettings stabilizerSettings;
+    bool help;              // print the usage and quit
+
+    Options();
+};
+
+/*
+@param argc, argv: the arguments of main()
+@param options: filled with the parsed options
+@return false if the command line is invalid
+*/
+bool parseOptions(int argc, char ** argv, Options& options);
+void printUsage(const char* programName);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+Automatic detection of the score overlay.
+*/
+
+#include "overlay.hpp"
+#include "morphology.hpp"
+#include "profiler.hpp"
+
+
+ScoreOverlayDetector::ScoreOverlayDetector()
+{
+    reset();
+}
+
+void ScoreOverlayDetector::reset()
+{
+    previousGray.release();
+    staticCount.release();
+    learnedPairs = 0;
+    framesSinceDetection = 0;
+    detected = false;
+    regions.clear();
+    mask.release();
+}
+
+Mat ScoreOverlayDetector::process(const Mat frame)
+{
+    CV_Assert( frame.type() == CV_8UC3 );
+    if ( !mask.empty() && mask.size() != frame.size() )
+    {
+        // Another video
+        reset();
+    }
+    // The cached regions are used until the next check
+    if ( detected && ++framesSinceDetection < OVERLAY_RECHECK_INTERVAL )
+    {
+        return mask;
+    }
+    learn(frame);
+    if ( learnedPairs >= OVERLAY_LEARNING_PAIRS )
+    {
+        detectRegions(frame);
+        // The next check learns from scratch
+        previousGray.release();
+        staticCount.release();
+        learnedPairs = 0;
+        framesSinceDetection = 0;
+    }
+    return mask;
+}
+
+bool ScoreOverlayDetector::hasDetected() const
+{
+    return detected;
+}
+
+const vector<Rect>& ScoreOverlayDetector::getRegions() const
+{
+    return regions;
+}
+
+const Mat& ScoreOverlayDetector::getMask() const
+{
+    return mask;
+}
+
+/*
+Count the pixels that did not change since the previous frame.
+Whole frame operations only: no per pixel loop
+@param frame: the frame to learn from
+*/
+void ScoreOverlayDetector::learn(const Mat frame)
+{
+    PROFILE_STAGE("overlay learning");
+    Mat gray;
+    cvtColor(frame, gray, CV_BGR2GRAY);
+    if ( previousGray.size() != gray.size() )
+    {
+        // First frame of the window
+        staticCount = Mat::zeros(gray.size(), CV_8U);
+        learnedPairs = 0;
+        previousGray = gray;
+        return;
+    }
+
+    Mat difference, still;
+    absdiff(gray, previousGray, difference);
+    compare(difference, OVERLAY_STATIC_DIFFERENCE, still, CMP_LT);
+    // When the camera does not move, the whole frame is static: nothing to learn
+    if ( countNonZero(still) <= OVERLAY_STILL_CAMERA_RATIO * still.total() )
+    {
+        add(staticCount, Scalar(1), staticCount, still);
+        learnedPairs++;
+    }
+    previousGray = gray;
+}
+
+/*
+Group the static pixels in rectangular regions
+@param frame: the last frame of the window
+*/
+void ScoreOverlayDetector::detectRegions(const Mat frame)
+{
+    PROFILE_STAGE("overlay detection");
+    Mat candidates;
+    compare(staticCount, cvCeil(learnedPairs * OVERLAY_STATIC_RATIO), candidates, CMP_GE);
+    // A uniform area of grass looks static as well
+    candidates.setTo(Scalar(0), detectGrass(frame));
+    // Closing: the characters and the background of the overlay make one region
+    dilateRectangle(candidates, candidates, OVERLAY_CLOSING_SIZE);
+    erodeRectangle(candidates, candidates, OVERLAY_CLOSING_SIZE);
+
+    vector< vector<Point> > contours;
+    findContours(candidates, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+
+    const double maxArea = OVERLAY_MAX_AREA_RATIO * frame.total();
+    const Rect frameArea(0, 0, frame.cols, frame.rows);
+    vector<Rect> found;
+    // A new mask: the previous one may still be used by the frames being processed
+    Mat foundMask = Mat::zeros(frame.rows, frame.cols, CV_8U);
+    for ( size_t i = 0 ; i < contours.size() ; i++ )
+    {
+        Rect region = boundingRect(contours[i]);
+        if ( region.area() < OVERLAY_MIN_AREA || region.area() > maxArea )
+        {
+            continue;
+        }
+        region = Rect(region.x - OVERLAY_MARGIN, region.y - OVERLAY_MARGIN,
+                      region.width + 2 * OVERLAY_MARGIN, region.height + 2 * OVERLAY_MARGIN) & frameArea;
+        found.push_back(region);
+        foundMask(region).setTo(Scalar(255));
+    }
+    regions = found;
+    mask = foundMask;
+    detected = true;
+}
@@ -0,0 +1,62 @@
+/*
+Automatic detection of the score overlay (score, timer, channel logo...).
+The overlay is drawn over the video: its pixels stay the same while the camera moves.
+Over a learning window, a counter per pixel is incremented on every pair of frames where the pixel
+did not change. The overlay is made of the pixels static on most of the pairs that are not grass,
+grouped in rectangular regions. The regions are cached and only checked again every few minutes.
+*/
+
+#ifndef OVERLAY_HPP
+#define OVERLAY_HPP
+
+#include "stabilization.hpp"
+
+// Learning
+#define OVERLAY_STATIC_DIFFERENCE 8         // a pixel changing less than this (gray levels) is static
+#define OVERLAY_LEARNING_PAIRS 75           // pairs of frames learned before detecting the regions (3 s at 25 fps, < 256)
+#define OVERLAY_STILL_CAMERA_RATIO 0.8      // pairs with more static pixels than this are ignored: the camera did not move
+#define OVERLAY_STATIC_RATIO 0.9            // a pixel static on this part of the pairs is part of the overlay
+#define OVERLAY_RECHECK_INTERVAL 1500       // frames between two detections (1 min at 25 fps)
+
+// Regions
+#define OVERLAY_CLOSING_SIZE 4              // merge the characters of the overlay
+#define OVERLAY_MARGIN 4                    // pixels added around the regions
+#define OVERLAY_MIN_AREA 400                // smaller regions are noise
+#define OVERLAY_MAX_AREA_RATIO 0.1          // bigger regions (part of the frame) are a still background
+
+
+class ScoreOverlayDetector
+{
+public:
+    ScoreOverlayDetector();
+
+    // Forget the learning and the detected regions (new video)
+    void reset();
+
+    /*
+    Learn from the next frame of the video, and detect the regions at the end of a learning window
+    @param frame: the frame (CV_8UC3, not stabilized)
+    @return the mask of the overlay (255 on the regions), empty until the first detection
+    */
+    Mat process(const Mat frame);
+
+    bool hasDetected() const;
+    // Regions of the last detection, in frame coordinates
+    const vector<Rect>& getRegions() const;
+    // Mask of the last detection, empty until the first one. Shared: not to be modified
+    const Mat& getMask() const;
+
+private:
+    void learn(const Mat frame);
+    void detectRegions(const Mat frame);
+
+    Mat previousGray;
+    Mat staticCount;        // CV_8U, pairs where the pixel was static
+    int learnedPairs;
+    int framesSinceDetection;
+    bool detected;
+    vector<Rect> regions;
+    Mat mask;
+};
+
+#endif
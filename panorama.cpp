@@ -0,0 +1,284 @@
+/*
+Panorama of the pitch built from the stabilized video.
+*/
+
+#include "panorama.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+
+
+/*
+The movements are detected on the bordered frames, where addBlackBorder() shifted the pixels by o on both axes:
+q + o = A (p + o) + t, so on the frames q = A p + (t + A o - o)
+@param homography: 2x3 movement of the bordered frames
+@return the 3x3 movement of the frames
+*/
+static Mat toFrameCoordinates(const Mat homography)
+{
+    const double offset = BORDER_WIDTH / 2;
+    Mat result = Mat::eye(3, 3, CV_64F);
+    for ( int row = 0 ; row < 2 ; row++ )
+    {
+        double a = homography.at<double>(row, 0);
+        double b = homography.at<double>(row, 1);
+        result.at<double>(row, 0) = a;
+        result.at<double>(row, 1) = b;
+        result.at<double>(row, 2) = homography.at<double>(row, 2) + (a + b) * offset - offset;
+    }
+    return result;
+}
+
+Panorama::Panorama(const string& spillPrefix, int maxTilesInMemory)
+    : spillPrefix(spillPrefix)
+    , maxTilesInMemory(MAX(maxTilesInMemory, 1))
+    , transform(Mat::eye(3, 3, CV_64F))
+{
+}
+
+Panorama::~Panorama()
+{
+    for ( map< pair<int, int>, Tile >::iterator it = tiles.begin() ; it != tiles.end() ; ++it )
+    {
+        if ( it->second.spilled )
+        {
+            remove(tilePath(it->first.first, it->first.second).c_str());
+        }
+    }
+}
+
+void Panorama::addFrame(const Mat frame, const Mat homography, const Mat mask)
+{
+    CV_Assert( frame.type() == CV_8UC3 );
+    if ( !homography.empty() )
+    {
+        // Global -> previous frame -> this frame
+        transform = toFrameCoordinates(homography) * transform;
+    }
+
+    // Weight of each pixel of the frame
+    Mat weight = getFeather(frame.size()).clone();
+    if ( !mask.empty() )
+    {
+        CV_Assert( mask.size() == frame.size() && mask.type() == CV_8U );
+        weight.setTo(Scalar(0), mask);
+    }
+
+    // Area of the frame in the global coordinates
+    Mat inverse = transform.inv();
+    double minX = DBL_MAX, minY = DBL_MAX, maxX = -DBL_MAX, maxY = -DBL_MAX;
+    for ( int corner = 0 ; corner < 4 ; corner++ )
+    {
+        double x = corner % 2 == 0 ? 0 : frame.cols;
+        double y = corner / 2 == 0 ? 0 : frame.rows;
+        double globalX = inverse.at<double>(0, 0) * x + inverse.at<double>(0, 1) * y + inverse.at<double>(0, 2);
+        double globalY = inverse.at<double>(1, 0) * x + inverse.at<double>(1, 1) * y + inverse.at<double>(1, 2);
+        minX = MIN(minX, globalX);
+        maxX = MAX(maxX, globalX);
+        minY = MIN(minY, globalY);
+        maxY = MAX(maxY, globalY);
+    }
+
+    for ( int tileY = (int)floor(minY / PANORAMA_TILE_SIZE) ; tileY <= (int)floor(maxY / PANORAMA_TILE_SIZE) ; tileY++ )
+    {
+        for ( int tileX = (int)floor(minX / PANORAMA_TILE_SIZE) ; tileX <= (int)floor(maxX / PANORAMA_TILE_SIZE) ; tileX++ )
+        {
+            // Tile pixel -> global -> frame
+            Mat origin = Mat::eye(3, 3, CV_64F);
+            origin.at<double>(0, 2) = tileX * PANORAMA_TILE_SIZE;
+            origin.at<double>(1, 2) = tileY * PANORAMA_TILE_SIZE;
+            Mat tileTransform = transform * origin;
+            tileTransform = tileTransform.rowRange(0, 2);
+            Size tileSize(PANORAMA_TILE_SIZE, PANORAMA_TILE_SIZE);
+
+            Mat warpedWeight;
+            warpAffine(weight, warpedWeight, tileTransform, tileSize, INTER_LINEAR | WARP_INVERSE_MAP, BORDER_CONSTANT, Scalar(0));
+            if ( countNonZero(warpedWeight) == 0 )
+            {
+                // Only a corner of the bounding box
+                continue;
+            }
+            Mat warpedFrame, warpedFloat, weight3;
+            warpAffine(frame, warpedFrame, tileTransform, tileSize, INTER_LINEAR | WARP_INVERSE_MAP, BORDER_CONSTANT, Scalar::all(0));
+            warpedFrame.convertTo(warpedFloat, CV_32F);
+            cvtColor(warpedWeight, weight3, CV_GRAY2BGR);
+
+            Tile& tile = getTile(tileX, tileY);
+            accumulateProduct(warpedFloat, weight3, tile.accumulator);
+            accumulate(warpedWeight, tile.weight);
+        }
+    }
+    spillColdTiles();
+}
+
+Mat Panorama::getTransform() const
+{
+    return transform.clone();
+}
+
+Rect Panorama::getBounds() const
+{
+    if ( tiles.empty() )
+    {
+        return Rect();
+    }
+    int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+    for ( map< pair<int, int>, Tile >::const_iterator it = tiles.begin() ; it != tiles.end() ; ++it )
+    {
+        minX = MIN(minX, it->first.first);
+        maxX = MAX(maxX, it->first.first);
+        minY = MIN(minY, it->first.second);
+        maxY = MAX(maxY, it->first.second);
+    }
+    return Rect(minX * PANORAMA_TILE_SIZE, minY * PANORAMA_TILE_SIZE,
+                (maxX - minX + 1) * PANORAMA_TILE_SIZE, (maxY - minY + 1) * PANORAMA_TILE_SIZE);
+}
+
+Mat Panorama::render(double scale)
+{
+    Rect bounds = getBounds();
+    Mat result = Mat::zeros(cvRound(bounds.height * scale), cvRound(bounds.width * scale), CV_8UC3);
+    for ( map< pair<int, int>, Tile >::iterator it = tiles.begin() ; it != tiles.end() ; ++it )
+    {
+        int tileX = it->first.first, tileY = it->first.second;
+        Tile& tile = getTile(tileX, tileY);
+        Mat weight3, mean, mean8;
+        cvtColor(tile.weight, weight3, CV_GRAY2BGR);
+        divide(tile.accumulator, weight3, mean);
+        // Black where nothing was filmed: the float division gives NaN there (0 / 0) with OpenCV 3 and later
+        mean.setTo(Scalar::all(0), tile.weight == 0);
+        mean.convertTo(mean8, CV_8U);
+
+        int left = cvRound((tileX * PANORAMA_TILE_SIZE - bounds.x) * scale);
+        int right = cvRound(((tileX + 1) * PANORAMA_TILE_SIZE - bounds.x) * scale);
+        int top = cvRound((tileY * PANORAMA_TILE_SIZE - bounds.y) * scale);
+        int bottom = cvRound(((tileY + 1) * PANORAMA_TILE_SIZE - bounds.y) * scale);
+        if ( right > left && bottom > top )
+        {
+            Mat destination = result(Rect(left, top, right - left, bottom - top));
+            resize(mean8, destination, destination.size(), 0, 0, INTER_AREA);
+        }
+        // Rendering a big panorama must not load every tile at once
+        spillColdTiles();
+    }
+    return result;
+}
+
+int Panorama::getTileCount() const
+{
+    return tiles.size();
+}
+
+int Panorama::getTilesInMemory() const
+{
+    return recentTiles.size();
+}
+
+Panorama::Tile& Panorama::getTile(int x, int y)
+{
+    pair<int, int> key(x, y);
+    map< pair<int, int>, Tile >::iterator found = tiles.find(key);
+    if ( found == tiles.end() )
+    {
+        Tile& tile = tiles[key];
+        tile.accumulator = Mat::zeros(PANORAMA_TILE_SIZE, PANORAMA_TILE_SIZE, CV_32FC3);
+        tile.weight = Mat::zeros(PANORAMA_TILE_SIZE, PANORAMA_TILE_SIZE, CV_32F);
+        tile.spilled = false;
+        recentTiles.push_front(key);
+        tile.recent = recentTiles.begin();
+        return tile;
+    }
+
+    Tile& tile = found->second;
+    if ( !tile.spilled )
+    {
+        recentTiles.splice(recentTiles.begin(), recentTiles, tile.recent);
+        return tile;
+    }
+
+    // Load the spilled tile
+    tile.accumulator.create(PANORAMA_TILE_SIZE, PANORAMA_TILE_SIZE, CV_32FC3);
+    tile.weight.create(PANORAMA_TILE_SIZE, PANORAMA_TILE_SIZE, CV_32F);
+    string path = tilePath(x, y);
+    FILE* file = fopen(path.c_str(), "rb");
+    if ( file == NULL
+         || fread(tile.accumulator.data, sizeof(float) * 3, tile.accumulator.total(), file) != tile.accumulator.total()
+         || fread(tile.weight.data, sizeof(float), tile.weight.total(), file) != tile.weight.total() )
+    {
+        cerr << "[WARNING]: Could not read the panorama tile \"" << path << "\", it is lost" << endl;
+        tile.accumulator = Scalar::all(0);
+        tile.weight = Scalar(0);
+    }
+    if ( file != NULL )
+    {
+        fclose(file);
+    }
+    remove(path.c_str());
+    tile.spilled = false;
+    recentTiles.push_front(key);
+    tile.recent = recentTiles.begin();
+    return tile;
+}
+
+/*
+Write the least recently used tiles to disk until the memory budget is met
+*/
+void Panorama::spillColdTiles()
+{
+    while ( (int)recentTiles.size() > maxTilesInMemory )
+    {
+        pair<int, int> key = recentTiles.back();
+        Tile& tile = tiles[key];
+        string path = tilePath(key.first, key.second);
+        FILE* file = fopen(path.c_str(), "wb");
+        bool written = file != NULL
+                       && fwrite(tile.accumulator.data, sizeof(float) * 3, tile.accumulator.total(), file) == tile.accumulator.total()
+                       && fwrite(tile.weight.data, sizeof(float), tile.weight.total(), file) == tile.weight.total();
+        if ( file != NULL )
+        {
+            written = fclose(file) == 0 && written;
+        }
+        if ( !written )
+        {
+            // Keep every tile in memory rather than losing one
+            cerr << "[WARNING]: Could not spill the panorama tile \"" << path << "\", the memory is not bounded anymore" << endl;
+            remove(path.c_str());
+            maxTilesInMemory = INT_MAX;
+            return;
+        }
+        tile.accumulator.release();
+        tile.weight.release();
+        tile.spilled = true;
+        recentTiles.pop_back();
+    }
+}
+
+string Panorama::tilePath(int x, int y) const
+{
+    ostringstream path;
+    path << spillPrefix << "_" << x << "_" << y << ".tile";
+    return path.str();
+}
+
+/*
+@return the weight of the pixels of a frame: 1 inside, decreasing to 0 on the borders
+*/
+const Mat& Panorama::getFeather(Size size)
+{
+    if ( feather.size() != size )
+    {
+        feather.create(size, CV_32F);
+        for ( int y = 0 ; y < size.height ; y++ )
+        {
+            float* row = feather.ptr<float>(y);
+            int distanceY = MIN(y + 1, size.height - y);
+            for ( int x = 0 ; x < size.width ; x++ )
+            {
+                int distance = MIN(distanceY, MIN(x + 1, size.width - x));
+                row[x] = MIN(1.f, (float)distance / PANORAMA_FEATHER_WIDTH);
+            }
+        }
+    }
+    return feather;
+}
@@ -0,0 +1,78 @@
+/*
+Panorama of the pitch built from the stabilized video.
+The movements of the frames are chained into the coordinates of the first frame (the global coordinates).
+The panorama is a sparse grid of square tiles, allocated when a frame first covers them.
+Each tile accumulates the frames weighted by a feather (lower weight near the frame borders)
+and by a mask (players and score panel are not blended), the panorama is their weighted mean.
+Only the most recently used tiles stay in memory, the others are spilled to disk.
+*/
+
+#ifndef PANORAMA_HPP
+#define PANORAMA_HPP
+
+#include <list>
+#include <map>
+
+#include "stabilization.hpp"
+
+#define PANORAMA_TILE_SIZE 256
+#define PANORAMA_MAX_TILES_IN_MEMORY 256    // 256 tiles of 256x256: 256 MB of accumulators
+#define PANORAMA_FEATHER_WIDTH 64           // weight ramp along the frame borders, in pixels
+
+
+class Panorama
+{
+public:
+    /*
+    @param spillPrefix: the spilled tiles are the files spillPrefix_X_Y.tile
+    @param maxTilesInMemory: tiles kept in memory
+    */
+    explicit Panorama(const string& spillPrefix, int maxTilesInMemory = PANORAMA_MAX_TILES_IN_MEMORY);
+    ~Panorama();
+
+    /*
+    Blend a frame into the panorama
+    @param frame: the frame (CV_8UC3, not stabilized)
+    @param homography: the movement between the previous frame and this one, as returned by Stabilizer::estimate()
+                       (bordered coordinates). Empty for the first frame, or when the camera did not move
+    @param mask: pixels > 0 are not blended (may be empty)
+    */
+    void addFrame(const Mat frame, const Mat homography, const Mat mask = Mat());
+
+    // 3x3 transform from the global coordinates to the last frame
+    Mat getTransform() const;
+    // Area covered by the tiles, in global coordinates
+    Rect getBounds() const;
+    /*
+    @param scale: scale of the image (the whole panorama can be big)
+    @return the panorama, black where no frame was blended
+    */
+    Mat render(double scale = 1);
+
+    int getTileCount() const;
+    int getTilesInMemory() const;
+
+private:
+    struct Tile
+    {
+        Mat accumulator;    // CV_32FC3, sum of the weighted pixels
+        Mat weight;         // CV_32F, sum of the weights
+        bool spilled;       // the accumulators are on disk
+        list< pair<int, int> >::iterator recent;
+    };
+
+    // @return the tile, created or loaded if needed
+    Tile& getTile(int x, int y);
+    void spillColdTiles();
+    string tilePath(int x, int y) const;
+    const Mat& getFeather(Size size);
+
+    string spillPrefix;
+    int maxTilesInMemory;
+    map< pair<int, int>, Tile > tiles;
+    list< pair<int, int> > recentTiles; // tiles in memory, most recently used first
+    Mat transform;
+    Mat feather;
+};
+
+#endif
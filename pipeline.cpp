@@ -0,0 +1,171 @@
+/*
+Pipelined stabilization: decoding, pre processing, movement detection and encoding
+run on separate threads, connected by bounded queues.
+*/
+
+#include "pipeline.hpp"
+#include "overlay.hpp"
+
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+
+
+// A frame and its position in the video
+struct DecodedFrame
+{
+    int index;
+    Mat frame;
+    Mat scoreMask;  // the detected score overlay, empty for the default panel
+};
+
+struct PreparedFrameItem
+{
+    int index;
+    PreparedFrame prepared;
+};
+
+/*
+@return the current time in ms
+*/
+static double now()
+{
+    return (double)cvGetTickCount() / ((double)cvGetTickFrequency() * 1000.);
+}
+
+PipelineStats::PipelineStats()
+    : frames(0)
+    , totalTime(0)
+    , decodingTime(0)
+    , preparationTime(0)
+    , estimationTime(0)
+    , encodingTime(0)
+{
+}
+
+PipelineStats runPipeline(VideoCapture& videoBuffer, VideoWriter& exportVideoWriter, int lastFrameNumber, int workers,
+                          const StabilizerSettings& settings, volatile int& stopSignal)
+{
+    PipelineStats stats;
+    double startTime = now();
+    workers = MAX(workers, 1);
+
+    BoundedQueue<DecodedFrame> decodedFrames(PIPELINE_QUEUE_CAPACITY);
+    BoundedQueue<PreparedFrameItem> preparedFrames(PIPELINE_QUEUE_CAPACITY);
+    BoundedQueue<Mat> stabilizedFrames(PIPELINE_QUEUE_CAPACITY);
+    // The workers may finish the frames out of order: the frames waiting for their turn before the
+    // movement detection are bounded by the frames in flight between the decoding and the encoding
+    TokenWindow framesInFlight(PIPELINE_QUEUE_CAPACITY + workers);
+
+    // Decoding, and the score overlay detection that needs the frames in order
+    std::thread decoder([&]()
+    {
+        ScoreOverlayDetector overlay;
+        for ( int index = 0 ; index < lastFrameNumber && !stopSignal ; index++ )
+        {
+            framesInFlight.acquire();
+            double stepTime = now();
+            DecodedFrame decoded;
+            decoded.index = index;
+            videoBuffer >> decoded.frame;
+            if ( decoded.frame.empty() )
+            {
+                framesInFlight.release();
+                break;
+            }
+            if ( settings.detectOverlay )
+            {
+                decoded.scoreMask = overlay.process(decoded.frame);
+            }
+            stats.decodingTime += now() - stepTime;
+            if ( !decodedFrames.push(decoded) )
+            {
+                break;
+            }
+        }
+        decodedFrames.close();
+    });
+
+    // Pre processing: every frame is independent
+    std::mutex preparationTimeMutex;
+    std::atomic<int> runningPreparers(workers);
+    std::vector<std::thread> preparers;
+    for ( int i = 0 ; i < workers ; i++ )
+    {
+        preparers.push_back(std::thread([&]()
+        {
+            DecodedFrame decoded;
+            double busyTime = 0;
+            while ( decodedFrames.pop(decoded) )
+            {
+                double stepTime = now();
+                PreparedFrameItem item;
+                item.index = decoded.index;
+                item.prepared = prepareFrame(decoded.frame, settings.maskDownscale, decoded.scoreMask);
+                busyTime += now() - stepTime;
+                if ( !preparedFrames.push(item) )
+                {
+                    break;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(preparationTimeMutex);
+                stats.preparationTime += busyTime;
+            }
+            // The last worker to leave closes the queue
+            if ( --runningPreparers == 0 )
+            {
+                preparedFrames.close();
+            }
+        }));
+    }
+
+    // Movement detection: needs the frames back in order
+    std::thread estimator([&]()
+    {
+        Stabilizer stabilizer(settings);
+        std::map<int, PreparedFrame> waitingFrames;
+        int nextIndex = 0;
+        PreparedFrameItem item;
+        while ( preparedFrames.pop(item) )
+        {
+            waitingFrames[item.index] = item.prepared;
+            std::map<int, PreparedFrame>::iterator next;
+            while ( ( next = waitingFrames.find(nextIndex) ) != waitingFrames.end() )
+            {
+                double stepTime = now();
+                Mat stabilizedFrame = stabilizer.stabilize(next->second);
+                stats.estimationTime += now() - stepTime;
+                waitingFrames.erase(next);
+                nextIndex++;
+                stabilizedFrames.push(stabilizedFrame);
+            }
+        }
+        stabilizedFrames.close();
+    });
+
+    // Encoding, on this thread
+    Mat stabilizedFrame;
+    while ( stabilizedFrames.pop(stabilizedFrame) )
+    {
+        double stepTime = now();
+        if ( exportVideoWriter.isOpened() )
+        {
+            exportVideoWriter << stabilizedFrame;
+        }
+        stats.encodingTime += now() - stepTime;
+        stats.frames++;
+        framesInFlight.release();
+    }
+
+    decoder.join();
+    for ( size_t i = 0 ; i < preparers.size() ; i++ )
+    {
+        preparers[i].join();
+    }
+    estimator.join();
+
+    stats.totalTime = now() - startTime;
+    return stats;
+}
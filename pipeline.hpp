@@ -0,0 +1,145 @@
+/*
+Pipelined stabilization: decoding, pre processing, movement detection and encoding
+run on separate threads, connected by bounded queues.
+*/
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include "stabilization.hpp"
+
+// Frames waiting between two stages
+#define PIPELINE_QUEUE_CAPACITY 8
+
+
+/*
+Blocking queue with a maximum size, shared by one or more producers and consumers
+*/
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity(capacity)
+        , closed(false)
+    {
+    }
+
+    // Wait for some room, then add the item. Returns false if the queue has been closed
+    bool push(const T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+        if ( closed )
+        {
+            return false;
+        }
+        items.push_back(item);
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Wait for an item. Returns false once the queue is closed and empty
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if ( items.empty() )
+        {
+            return false;
+        }
+        item = items.front();
+        items.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed: wake up every waiting thread
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+/*
+Counting semaphore: the frames allowed in the pipeline at once. A token is taken when a frame
+is decoded and given back when it is encoded
+*/
+class TokenWindow
+{
+public:
+    explicit TokenWindow(int tokens)
+        : tokens(tokens)
+    {
+    }
+
+    // Wait for a free token
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return tokens > 0; });
+        tokens--;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tokens++;
+        }
+        available.notify_one();
+    }
+
+private:
+    int tokens;
+    std::mutex mutex;
+    std::condition_variable available;
+};
+
+/*
+Busy time of each stage, in ms
+*/
+struct PipelineStats
+{
+    int frames;
+    double totalTime;
+    double decodingTime;
+    double preparationTime; // summed over the workers
+    double estimationTime;
+    double encodingTime;
+
+    PipelineStats();
+};
+
+/*
+Stabilize the video with one thread per stage and several pre processing workers.
+The stabilized frames are exported in order.
+@param videoBuffer: the opened video
+@param exportVideoWriter: the stabilized video, may not be opened
+@param lastFrameNumber: the number of the last frame to process
+@param workers: the number of pre processing threads
+@param settings: the parameters of the stabilization
+@param stopSignal: stop reading the video when it becomes non zero
+@return the time spent in every stage
+*/
+PipelineStats runPipeline(VideoCapture& videoBuffer, VideoWriter& exportVideoWriter, int lastFrameNumber, int workers,
+                          const StabilizerSettings& settings, volatile int& stopSignal);
+
+#endif
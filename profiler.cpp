@@ -0,0 +1,201 @@
+/*
+Per stage instrumentation of the stabilization.
+*/
+
+#include "profiler.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+using namespace cv;
+using namespace std;
+
+
+std::atomic<bool> profilingEnabled(false);
+
+/*
+The histogram of a stage. The samples are recorded from several threads (pipeline, chunks),
+so every counter is atomic: no lock on the recording path.
+*/
+struct StageHistogram
+{
+    char name[64];
+    atomic<uint64_t> buckets[PROFILER_BUCKETS];
+    atomic<uint64_t> count;
+    atomic<uint64_t> totalTicks;
+    atomic<int64_t> maxTicks;
+};
+
+static StageHistogram stages[PROFILER_MAX_STAGES];
+static atomic<int> stageCount(0);
+static mutex registrationMutex;
+
+static string reportPath;
+static int reportInterval = 0;
+static atomic<uint64_t> profiledFrames(0);
+static mutex reportMutex;
+
+
+void enableProfiling(const string& path, int interval)
+{
+    reportPath = path;
+    reportInterval = interval;
+    profilingEnabled = true;
+}
+
+bool isProfilingEnabled()
+{
+    return profilingEnabled;
+}
+
+int registerProfilingStage(const char* name)
+{
+    lock_guard<mutex> lock(registrationMutex);
+    int count = stageCount;
+    for ( int i = 0 ; i < count ; i++ )
+    {
+        if ( strcmp(stages[i].name, name) == 0 )
+        {
+            return i;
+        }
+    }
+    if ( count == PROFILER_MAX_STAGES )
+    {
+        cerr << "[WARNING]: Too many profiled stages, \"" << name << "\" is merged in \"" << stages[count - 1].name << "\"" << endl;
+        return count - 1;
+    }
+    StageHistogram& stage = stages[count];
+    strncpy(stage.name, name, sizeof(stage.name) - 1);
+    stage.name[sizeof(stage.name) - 1] = '\0';
+    for ( int i = 0 ; i < PROFILER_BUCKETS ; i++ )
+    {
+        stage.buckets[i] = 0;
+    }
+    stage.count = 0;
+    stage.totalTicks = 0;
+    stage.maxTicks = 0;
+    stageCount = count + 1;
+    return count;
+}
+
+/*
+@param microseconds: a duration
+@return its histogram bucket
+*/
+static int bucketOf(double microseconds)
+{
+    if ( microseconds < 1 )
+    {
+        return 0;
+    }
+    int bucket = 1 + (int)(log2(microseconds) * PROFILER_BUCKETS_PER_OCTAVE);
+    return MIN(bucket, PROFILER_BUCKETS - 1);
+}
+
+/*
+@return the upper bound of a histogram bucket, in ms
+*/
+static double bucketUpperBound(int bucket)
+{
+    return pow(2., (double)bucket / PROFILER_BUCKETS_PER_OCTAVE) / 1000.;
+}
+
+void recordProfilingSample(int stage, int64 ticks)
+{
+    static const double ticksPerMicrosecond = getTickFrequency() / 1e6;
+    StageHistogram& histogram = stages[stage];
+    histogram.buckets[bucketOf(ticks / ticksPerMicrosecond)].fetch_add(1, memory_order_relaxed);
+    histogram.count.fetch_add(1, memory_order_relaxed);
+    histogram.totalTicks.fetch_add(ticks, memory_order_relaxed);
+    int64_t maxTicks = histogram.maxTicks.load(memory_order_relaxed);
+    while ( ticks > maxTicks && !histogram.maxTicks.compare_exchange_weak(maxTicks, ticks, memory_order_relaxed) )
+    {
+    }
+}
+
+void profileFrameDone()
+{
+    if ( !profilingEnabled )
+    {
+        return;
+    }
+    uint64_t frames = profiledFrames.fetch_add(1) + 1;
+    if ( reportInterval > 0 && !reportPath.empty() && frames % reportInterval == 0 )
+    {
+        writeProfilingReport(reportPath);
+    }
+}
+
+/*
+@param histogram: the histogram of a stage
+@param count: the number of samples of the histogram
+@param percentile: between 0 and 1
+@return the upper bound of the bucket holding the percentile, in ms
+*/
+static double percentileOf(const uint64_t* histogram, uint64_t count, double percentile)
+{
+    uint64_t rank = (uint64_t)ceil(percentile * count);
+    uint64_t cumulated = 0;
+    for ( int i = 0 ; i < PROFILER_BUCKETS ; i++ )
+    {
+        cumulated += histogram[i];
+        if ( cumulated >= rank && cumulated > 0 )
+        {
+            return bucketUpperBound(i);
+        }
+    }
+    return 0;
+}
+
+bool writeProfilingReport(const string& path)
+{
+    lock_guard<mutex> lock(reportMutex);
+    // Written next to the report then renamed: the monitoring never reads a partial file
+    string temporaryPath = path + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "w");
+    if ( file == NULL )
+    {
+        cerr << "[WARNING]: Could not write the profiling report \"" << path << "\"" << endl;
+        return false;
+    }
+    double ticksPerMs = getTickFrequency() / 1000.;
+    fprintf(file, "{\n  \"frames\": %llu,\n  \"stages\": [", (unsigned long long)profiledFrames.load());
+    int count = stageCount;
+    bool first = true;
+    for ( int s = 0 ; s < count ; s++ )
+    {
+        const StageHistogram& stage = stages[s];
+        // Snapshot, the other threads may still record samples
+        uint64_t histogram[PROFILER_BUCKETS];
+        uint64_t samples = 0;
+        for ( int i = 0 ; i < PROFILER_BUCKETS ; i++ )
+        {
+            histogram[i] = stage.buckets[i].load(memory_order_relaxed);
+            samples += histogram[i];
+        }
+        if ( samples == 0 )
+        {
+            continue;
+        }
+        fprintf(file, "%s\n    { \"name\": \"%s\", \"count\": %llu, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f }",
+                first ? "" : ",", stage.name, (unsigned long long)samples,
+                stage.totalTicks.load() / ticksPerMs / MAX(stage.count.load(), (uint64_t)1),
+                percentileOf(histogram, samples, 0.50), percentileOf(histogram, samples, 0.95),
+                percentileOf(histogram, samples, 0.99), stage.maxTicks.load() / ticksPerMs);
+        first = false;
+    }
+    fprintf(file, "\n  ]\n}\n");
+    bool written = fclose(file) == 0;
+    return written && rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+void finishProfiling()
+{
+    if ( profilingEnabled && !reportPath.empty() )
+    {
+        writeProfilingReport(reportPath);
+    }
+}
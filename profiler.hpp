@@ -0,0 +1,105 @@
+/*
+Per stage instrumentation of the stabilization.
+Each stage is timed by a scoped timer:
+    {
+        PROFILE_STAGE("frame blur");
+        blur(frame, blurredFrame, Size(30, 30));
+    }
+The durations go in a latency histogram per stage (p50 / p95 / p99), written as JSON
+every N frames and at exit.
+When the profiling is not enabled, a timer costs one relaxed atomic load.
+Compiling with NO_PROFILING removes the timers entirely.
+*/
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+#define PROFILER_MAX_STAGES 64
+// Logarithmic histogram: bucket 0 holds the durations under 1 us,
+// bucket i the durations between 2^((i-1)/8) and 2^(i/8) us (about 9% wide)
+#define PROFILER_BUCKETS_PER_OCTAVE 8
+#define PROFILER_BUCKETS 256
+
+
+/*
+Start collecting the stage durations
+@param reportPath: the JSON report, empty to only collect
+@param reportInterval: write the report every reportInterval frames, 0 to write it at exit only
+*/
+void enableProfiling(const std::string& reportPath, int reportInterval);
+bool isProfilingEnabled();
+
+/*
+@param name: the name of the stage, stages with the same name share their histogram
+@return the id of the stage
+*/
+int registerProfilingStage(const char* name);
+
+/*
+@param stage: the id of the stage
+@param ticks: the duration, in cv::getTickCount() ticks
+*/
+void recordProfilingSample(int stage, int64 ticks);
+
+/*
+Count a processed frame, and write the report when the interval is reached
+*/
+void profileFrameDone();
+
+/*
+@param path: the JSON file to write
+@return false if the file could not be written
+*/
+bool writeProfilingReport(const std::string& path);
+
+/*
+Write the final report, if the profiling is enabled and has a report path
+*/
+void finishProfiling();
+
+
+extern std::atomic<bool> profilingEnabled;
+
+/*
+Time the enclosing scope, when the profiling is enabled
+*/
+class ScopedStageTimer
+{
+public:
+    explicit ScopedStageTimer(int stage)
+        : stage(stage)
+        , start(profilingEnabled.load(std::memory_order_relaxed) ? cv::getTickCount() : 0)
+    {
+    }
+
+    ~ScopedStageTimer()
+    {
+        if ( start != 0 )
+        {
+            recordProfilingSample(stage, cv::getTickCount() - start);
+        }
+    }
+
+private:
+    int stage;
+    int64 start;
+};
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+
+#ifdef NO_PROFILING
+#define PROFILE_STAGE(name)
+#else
+// The stage is registered once per call site
+#define PROFILE_STAGE(name) \
+    static const int PROFILER_CONCAT(profilerStage, __LINE__) = registerProfilingStage(name); \
+    ScopedStageTimer PROFILER_CONCAT(profilerTimer, __LINE__)(PROFILER_CONCAT(profilerStage, __LINE__))
+#endif
+
+#endif
@@ -0,0 +1,108 @@
+/*
+Real-time mode: a stabilization budget per frame.
+*/
+
+#include "realtime.hpp"
+
+#include <cstdio>
+
+
+QualityController::QualityController(const string& name, double deadline)
+    : name(name)
+    , deadline(deadline)
+    , average(0)
+    , level(QUALITY_FULL)
+    , frames(0)
+    , framesAtLevel(0)
+    , switches(0)
+    , missedDeadlines(0)
+{
+}
+
+QualityLevel QualityController::frameDone(double time)
+{
+    // The first frame has no previous frame to compare with: it starts the average
+    average = frames == 0 ? time : average + REALTIME_AVERAGE_WEIGHT * (time - average);
+    frames++;
+    framesAtLevel++;
+    if ( time > deadline )
+    {
+        missedDeadlines++;
+    }
+    if ( framesAtLevel < REALTIME_HOLD_FRAMES )
+    {
+        return getLevel();
+    }
+
+    if ( average > deadline && level < QUALITY_LEVELS - 1 )
+    {
+        switchLevel(level + 1);
+    }
+    else if ( average < REALTIME_RECOVERY_RATIO * deadline && level > QUALITY_FULL )
+    {
+        switchLevel(level - 1);
+    }
+    return getLevel();
+}
+
+QualityLevel QualityController::getLevel() const
+{
+    return (QualityLevel)level;
+}
+
+double QualityController::getAverage() const
+{
+    return average;
+}
+
+int QualityController::getSwitchCount() const
+{
+    return switches;
+}
+
+int QualityController::getMissedDeadlines() const
+{
+    return missedDeadlines;
+}
+
+/*
+@param newLevel: the level of the next frames
+*/
+void QualityController::switchLevel(int newLevel)
+{
+    char message[256];
+    snprintf(message, sizeof(message), "%s frame %d: %.2f ms on average for a deadline of %.2f ms, quality %s from %s to %s",
+             name.c_str(), frames, average, deadline, newLevel > level ? "lowered" : "raised",
+             getQualityLevelName((QualityLevel)level), getQualityLevelName((QualityLevel)newLevel));
+    if ( newLevel > level )
+    {
+        cerr << "[WARNING]: " << message << endl;
+    }
+    else
+    {
+        cout << message << endl;
+    }
+    level = newLevel;
+    framesAtLevel = 0;
+    switches++;
+}
+
+/*
+@param level: a quality level
+@return its name in the logs
+*/
+const char* getQualityLevelName(QualityLevel level)
+{
+    switch ( level )
+    {
+        case QUALITY_FULL:
+            return "full";
+        case QUALITY_REDUCED_MASKS:
+            return "reduced masks";
+        case QUALITY_REUSED_MASKS:
+            return "reused masks";
+        case QUALITY_REUSED_TRANSFORM:
+            return "reused transform";
+    }
+    return "unknown";
+}
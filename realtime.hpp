@@ -0,0 +1,55 @@
+/*
+Real-time mode: a stabilization budget per frame.
+The controller keeps a moving average of the stabilization times. When it exceeds the deadline,
+the work per frame is lowered one level at a time (reduced masks, then no mask refresh, then no
+movement detection). When the average is well under the deadline again, the quality is raised
+one level at a time. A level is kept a few frames before the next switch, so that the average
+has time to follow, and every switch is logged.
+*/
+
+#ifndef REALTIME_HPP
+#define REALTIME_HPP
+
+#include "stabilization.hpp"
+
+#define REALTIME_AVERAGE_WEIGHT 0.1     // weight of the last frame in the moving average
+#define REALTIME_RECOVERY_RATIO 0.6     // raise the quality when the average is under this part of the deadline
+#define REALTIME_HOLD_FRAMES 25         // frames at a level before the next switch (1 s at 25 fps)
+
+
+class QualityController
+{
+public:
+    // @param name: the stream in the logs
+    // @param deadline: the stabilization budget of a frame, in ms
+    QualityController(const string& name = "Video", double deadline = 0);
+
+    /*
+    Account for the stabilization time of a frame, and switch the level if needed
+    @param time: the stabilization time of the frame, in ms
+    @return the level of the next frame
+    */
+    QualityLevel frameDone(double time);
+
+    QualityLevel getLevel() const;
+    double getAverage() const;
+    int getSwitchCount() const;
+    // Frames stabilized in more time than the deadline
+    int getMissedDeadlines() const;
+
+private:
+    void switchLevel(int level);
+
+    string name;
+    double deadline;
+    double average;
+    int level;
+    int frames;
+    int framesAtLevel;
+    int switches;
+    int missedDeadlines;
+};
+
+const char* getQualityLevelName(QualityLevel level);
+
+#endif
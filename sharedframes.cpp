@@ -0,0 +1,372 @@
+/*
+Shared memory output of the stabilized frames.
+*/
+
+#include "sharedframes.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The ring is shared between processes: its atomics must not hide a lock
+#if ATOMIC_LLONG_LOCK_FREE != 2 || ATOMIC_INT_LOCK_FREE != 2
+#error "The shared frames need lock free 32 and 64 bit atomics"
+#endif
+
+
+/*
+@return the current time in ms
+*/
+static double now()
+{
+    return (double)cvGetTickCount() / ((double)cvGetTickFrequency() * 1000.);
+}
+
+/*
+@return size rounded up to the alignment of the ring
+*/
+static uint64_t align(uint64_t size)
+{
+    return ( size + SHARED_FRAMES_ALIGNMENT - 1 ) / SHARED_FRAMES_ALIGNMENT * SHARED_FRAMES_ALIGNMENT;
+}
+
+/*
+@param memory: the mapped ring
+@param sequence: the sequence number of a frame
+@return the slot of the frame
+*/
+static SharedFrameSlot* getSlot(uchar* memory, const SharedFramesHeader* header, uint64_t sequence)
+{
+    return (SharedFrameSlot*)( memory + align(sizeof(SharedFramesHeader)) + ( sequence % header->slotCount ) * header->slotSize );
+}
+
+
+//*************************************************************************
+//                                 WRITER                                 *
+//*************************************************************************
+
+SharedFrameWriter::SharedFrameWriter()
+    : memory(NULL)
+    , size(0)
+    , header(NULL)
+    , waitingTime(0)
+{
+}
+
+SharedFrameWriter::~SharedFrameWriter()
+{
+    close();
+}
+
+bool SharedFrameWriter::open(const string& name, Size frameSize, int slots)
+{
+    close();
+    CV_Assert( slots > 0 && frameSize.width > 0 && frameSize.height > 0 );
+    // A new object: readers still attached to an old one keep it until they close it
+    shm_unlink(name.c_str());
+    int descriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if ( descriptor < 0 )
+    {
+        cerr << "[ERROR]: Could not create the shared memory \"" << name << "\": " << strerror(errno) << endl;
+        return false;
+    }
+
+    const uint64_t frameStep = align(frameSize.width * 3), maskStep = align(frameSize.width);
+    const uint64_t frameOffset = align(sizeof(SharedFrameSlot));
+    const uint64_t maskOffset = frameOffset + frameStep * frameSize.height;
+    const uint64_t slotSize = align(maskOffset + maskStep * frameSize.height);
+    size = align(sizeof(SharedFramesHeader)) + slotSize * slots;
+    if ( ftruncate(descriptor, size) != 0 )
+    {
+        cerr << "[ERROR]: Could not allocate " << size << " bytes of shared memory: " << strerror(errno) << endl;
+        ::close(descriptor);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if ( mapped == MAP_FAILED )
+    {
+        cerr << "[ERROR]: Could not map the shared memory \"" << name << "\": " << strerror(errno) << endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+    memory = (uchar*)mapped;
+    this->name = name;
+
+    // ftruncate() fills the object with zeros: the atomics only need their constructors
+    header = new (memory) SharedFramesHeader();
+    header->version = SHARED_FRAMES_VERSION;
+    header->width = frameSize.width;
+    header->height = frameSize.height;
+    header->frameType = CV_8UC3;
+    header->maskType = CV_8U;
+    header->slotCount = slots;
+    header->slotSize = slotSize;
+    header->frameOffset = frameOffset;
+    header->maskOffset = maskOffset;
+    header->frameStep = frameStep;
+    header->maskStep = maskStep;
+    header->published.store(0);
+    header->closed.store(0);
+    for ( int i = 0 ; i < SHARED_FRAMES_MAX_READERS ; i++ )
+    {
+        header->readers[i].pid.store(0);
+        header->readers[i].next.store(0);
+    }
+    for ( int i = 0 ; i < slots ; i++ )
+    {
+        new (getSlot(memory, header, i)) SharedFrameSlot();
+    }
+    // Written last: a reader attaching now sees a complete header
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHARED_FRAMES_MAGIC;
+    return true;
+}
+
+bool SharedFrameWriter::isOpened() const
+{
+    return memory != NULL;
+}
+
+void SharedFrameWriter::close()
+{
+    if ( memory == NULL )
+    {
+        return;
+    }
+    header->closed.store(1, std::memory_order_release);
+    munmap(memory, size);
+    shm_unlink(name.c_str());
+    memory = NULL;
+    header = NULL;
+}
+
+/*
+@param sequence: the next frame to publish
+@return true if every active reader released the frame that was in its slot
+*/
+bool SharedFrameWriter::isSlotFree(uint64_t sequence)
+{
+    if ( sequence < header->slotCount )
+    {
+        return true;
+    }
+    const uint64_t overwritten = sequence - header->slotCount;
+    for ( int i = 0 ; i < SHARED_FRAMES_MAX_READERS ; i++ )
+    {
+        SharedFramesCursor& reader = header->readers[i];
+        int32_t pid = reader.pid.load(std::memory_order_acquire);
+        if ( pid == 0 || reader.next.load(std::memory_order_acquire) > overwritten )
+        {
+            continue;
+        }
+        if ( kill(pid, 0) != 0 && errno == ESRCH )
+        {
+            // The reader died without closing
+            cerr << "[WARNING]: The shared frames reader " << pid << " is gone, its cursor is freed" << endl;
+            reader.pid.compare_exchange_strong(pid, 0);
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool SharedFrameWriter::beginFrame(Mat& frame, Mat& mask, int timeout)
+{
+    CV_Assert( isOpened() );
+    const uint64_t sequence = header->published.load(std::memory_order_relaxed);
+    if ( !isSlotFree(sequence) )
+    {
+        const double start = now();
+        bool free = false;
+        while ( !free && ( timeout < 0 || now() - start < timeout ) )
+        {
+            usleep(SHARED_FRAMES_POLL_US);
+            free = isSlotFree(sequence);
+        }
+        waitingTime += now() - start;
+        if ( !free )
+        {
+            return false;
+        }
+    }
+    uchar* slot = (uchar*)getSlot(memory, header, sequence);
+    frame = Mat(header->height, header->width, CV_8UC3, slot + header->frameOffset, header->frameStep);
+    mask = Mat(header->height, header->width, CV_8U, slot + header->maskOffset, header->maskStep);
+    return true;
+}
+
+void SharedFrameWriter::commitFrame(const Mat homography, int frameIndex)
+{
+    CV_Assert( isOpened() );
+    const uint64_t sequence = header->published.load(std::memory_order_relaxed);
+    SharedFrameSlot* slot = getSlot(memory, header, sequence);
+    slot->frameIndex = frameIndex;
+    slot->hasHomography = homography.empty() ? 0 : 1;
+    if ( !homography.empty() )
+    {
+        Mat coefficients(2, 3, CV_64F, slot->homography);
+        homography.convertTo(coefficients, CV_64F);
+    }
+    slot->sequence.store(sequence, std::memory_order_relaxed);
+    // The frame, the mask and the metadata are visible before the new count
+    header->published.store(sequence + 1, std::memory_order_release);
+}
+
+Size SharedFrameWriter::getFrameSize() const
+{
+    return header != NULL ? Size(header->width, header->height) : Size();
+}
+
+uint64_t SharedFrameWriter::getPublishedCount() const
+{
+    return header != NULL ? header->published.load() : 0;
+}
+
+double SharedFrameWriter::getWaitingTime() const
+{
+    return waitingTime;
+}
+
+
+//*************************************************************************
+//                                 READER                                 *
+//*************************************************************************
+
+SharedFrameReader::SharedFrameReader()
+    : memory(NULL)
+    , size(0)
+    , header(NULL)
+    , cursor(NULL)
+    , holding(false)
+{
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+    close();
+}
+
+bool SharedFrameReader::open(const string& name)
+{
+    close();
+    int descriptor = shm_open(name.c_str(), O_RDWR, 0);
+    if ( descriptor < 0 )
+    {
+        cerr << "[ERROR]: Could not open the shared memory \"" << name << "\": " << strerror(errno) << endl;
+        return false;
+    }
+    struct stat status;
+    if ( fstat(descriptor, &status) != 0 || (size_t)status.st_size < sizeof(SharedFramesHeader) )
+    {
+        cerr << "[ERROR]: The shared memory \"" << name << "\" is not a ring of frames" << endl;
+        ::close(descriptor);
+        return false;
+    }
+    size = status.st_size;
+    void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if ( mapped == MAP_FAILED )
+    {
+        cerr << "[ERROR]: Could not map the shared memory \"" << name << "\": " << strerror(errno) << endl;
+        return false;
+    }
+    memory = (uchar*)mapped;
+    header = (SharedFramesHeader*)memory;
+    if ( header->magic != SHARED_FRAMES_MAGIC || header->version != SHARED_FRAMES_VERSION )
+    {
+        cerr << "[ERROR]: The shared memory \"" << name << "\" is not a ring of frames of version " << SHARED_FRAMES_VERSION << endl;
+        close();
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // Take a free cursor, starting at the next frame published
+    const int32_t pid = getpid();
+    for ( int i = 0 ; i < SHARED_FRAMES_MAX_READERS && cursor == NULL ; i++ )
+    {
+        int32_t free = 0;
+        if ( header->readers[i].pid.compare_exchange_strong(free, pid) )
+        {
+            cursor = &header->readers[i];
+            cursor->next.store(header->published.load(std::memory_order_acquire), std::memory_order_release);
+        }
+    }
+    if ( cursor == NULL )
+    {
+        cerr << "[ERROR]: The shared memory \"" << name << "\" already has " << SHARED_FRAMES_MAX_READERS << " readers" << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool SharedFrameReader::isOpened() const
+{
+    return memory != NULL;
+}
+
+void SharedFrameReader::close()
+{
+    if ( memory == NULL )
+    {
+        return;
+    }
+    if ( cursor != NULL )
+    {
+        cursor->pid.store(0, std::memory_order_release);
+        cursor = NULL;
+    }
+    munmap(memory, size);
+    memory = NULL;
+    header = NULL;
+    holding = false;
+}
+
+bool SharedFrameReader::next(SharedFrame& frame, int timeout)
+{
+    CV_Assert( isOpened() );
+    release();
+    const uint64_t sequence = cursor->next.load(std::memory_order_relaxed);
+    const double start = now();
+    while ( header->published.load(std::memory_order_acquire) <= sequence )
+    {
+        if ( header->closed.load(std::memory_order_acquire) || ( timeout >= 0 && now() - start >= timeout ) )
+        {
+            return false;
+        }
+        usleep(SHARED_FRAMES_POLL_US);
+    }
+
+    uchar* slot = (uchar*)getSlot(memory, header, sequence);
+    const SharedFrameSlot* metadata = (const SharedFrameSlot*)slot;
+    frame.sequence = sequence;
+    frame.frameIndex = metadata->frameIndex;
+    frame.frame = Mat(header->height, header->width, header->frameType, slot + header->frameOffset, header->frameStep);
+    frame.mask = Mat(header->height, header->width, header->maskType, slot + header->maskOffset, header->maskStep);
+    frame.homography = metadata->hasHomography ? Mat(2, 3, CV_64F, (void*)metadata->homography) : Mat();
+    holding = true;
+    return true;
+}
+
+void SharedFrameReader::release()
+{
+    if ( holding )
+    {
+        cursor->next.fetch_add(1, std::memory_order_release);
+        holding = false;
+    }
+}
+
+Size SharedFrameReader::getFrameSize() const
+{
+    return header != NULL ? Size(header->width, header->height) : Size();
+}
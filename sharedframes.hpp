@@ -0,0 +1,154 @@
+/*
+Shared memory output: the stabilized frames, their movement and their singularity mask published
+in a POSIX shared memory ring, for detectors running in other processes. Nothing is encoded:
+the writer stabilizes into the slots, and the readers use the frames in place.
+
+Layout of the shared memory object (host byte order, every part aligned on 64 bytes):
+    SharedFramesHeader
+    slot x slotCount: SharedFrameSlot, frame (height x frameStep), mask (height x maskStep)
+Frame n goes in slot n % slotCount. The header holds the number of published frames and one cursor
+per reader (the next frame it reads). The writer waits before overwriting a slot that an active reader
+has not released yet: a slow reader slows the writer down instead of losing frames. The cursor of a
+reader whose process died is freed by the writer.
+*/
+
+#ifndef SHAREDFRAMES_HPP
+#define SHAREDFRAMES_HPP
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+#define SHARED_FRAMES_MAGIC 0x42415453      // "STAB"
+#define SHARED_FRAMES_VERSION 1
+#define SHARED_FRAMES_MAX_READERS 8
+#define SHARED_FRAMES_DEFAULT_SLOTS 8
+#define SHARED_FRAMES_ALIGNMENT 64
+#define SHARED_FRAMES_POLL_US 200           // waiting time between two checks of the ring
+
+
+// Cursor of a reader, in the shared memory
+struct SharedFramesCursor
+{
+    std::atomic<int32_t> pid;       // process of the reader, 0 for a free cursor
+    std::atomic<uint64_t> next;     // sequence number of the next frame to read
+};
+
+struct SharedFramesHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t frameType;              // CV_8UC3
+    int32_t maskType;               // CV_8U
+    uint32_t slotCount;
+    uint64_t slotSize;              // bytes between two slots
+    uint64_t frameOffset;           // position of the frame in a slot
+    uint64_t maskOffset;            // position of the mask in a slot
+    uint64_t frameStep;
+    uint64_t maskStep;
+    std::atomic<uint64_t> published;    // frames published: sequence numbers 0 to published - 1
+    std::atomic<uint32_t> closed;       // the writer is gone
+    SharedFramesCursor readers[SHARED_FRAMES_MAX_READERS];
+};
+
+struct SharedFrameSlot
+{
+    std::atomic<uint64_t> sequence;     // sequence number of the frame in the slot
+    int32_t frameIndex;                 // index of the frame in the video
+    int32_t hasHomography;              // 0 when no movement was detected
+    double homography[6];               // movement from the previous frame, as returned by estimateRigidTransform
+};
+
+/*
+A published frame, in place in the shared memory: valid until the reader releases it
+*/
+struct SharedFrame
+{
+    uint64_t sequence;
+    int frameIndex;
+    Mat frame;
+    Mat mask;           // mask of irrelevant areas for singularities
+    Mat homography;     // 2x3 CV_64F, empty when no movement was detected
+};
+
+class SharedFrameWriter
+{
+public:
+    SharedFrameWriter();
+    ~SharedFrameWriter();
+
+    /*
+    Create the shared memory object (an object left with the same name is replaced)
+    @param name: the name of the object, as given to shm_open() ("/stabilized")
+    @param frameSize: the size of the frames
+    @param slots: the number of frames in the ring
+    */
+    bool open(const string& name, Size frameSize, int slots = SHARED_FRAMES_DEFAULT_SLOTS);
+    bool isOpened() const;
+    // Mark the ring as closed for the readers, and remove its name
+    void close();
+
+    /*
+    Wait until the next slot is released by every reader
+    @param frame, mask: filled with headers on the frame and the mask of the slot, to write in place
+    @param timeout: the longest wait in ms, negative to wait as long as needed
+    @return false if the readers did not release the slot in time
+    */
+    bool beginFrame(Mat& frame, Mat& mask, int timeout = -1);
+    // Publish the slot filled after beginFrame()
+    void commitFrame(const Mat homography, int frameIndex);
+
+    Size getFrameSize() const;
+    uint64_t getPublishedCount() const;
+    // Time spent waiting for the readers, in ms
+    double getWaitingTime() const;
+
+private:
+    bool isSlotFree(uint64_t sequence);
+
+    string name;
+    uchar* memory;
+    size_t size;
+    SharedFramesHeader* header;
+    double waitingTime;
+};
+
+class SharedFrameReader
+{
+public:
+    SharedFrameReader();
+    ~SharedFrameReader();
+
+    // Attach to the ring of a writer: the first frame read is the next one published
+    bool open(const string& name);
+    bool isOpened() const;
+    void close();
+
+    /*
+    Release the previous frame, and wait for the next one
+    @param frame: filled with headers on the frame in the shared memory (no copy)
+    @param timeout: the longest wait in ms, negative to wait as long as needed
+    @return false if no frame came in time, or if the writer closed the ring
+    */
+    bool next(SharedFrame& frame, int timeout = -1);
+    // Let the writer reuse the slot of the last frame
+    void release();
+
+    Size getFrameSize() const;
+
+private:
+    uchar* memory;
+    size_t size;
+    SharedFramesHeader* header;
+    SharedFramesCursor* cursor;
+    bool holding;   // the last frame is not released yet
+};
+
+#endif
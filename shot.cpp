@@ -0,0 +1,89 @@
+/*
+Cheap shot change detection, run before the movement detection.
+*/
+
+#include "shot.hpp"
+#include "stabilization.hpp"
+#include "profiler.hpp"
+
+#include <cmath>
+
+
+ShotDetector::ShotDetector()
+{
+    reset();
+}
+
+void ShotDetector::reset()
+{
+    previousHistograms.clear();
+    grassRatio = 0;
+    previousGrassRatio = 0;
+    distance = 0;
+}
+
+ShotTransition ShotDetector::process(const Mat frame)
+{
+    CV_Assert( frame.type() == CV_8UC3 );
+    PROFILE_STAGE("shot detection");
+    resize(frame, small, Size(MAX(frame.cols / SHOT_DOWNSCALE, 1), MAX(frame.rows / SHOT_DOWNSCALE, 1)), 0, 0, INTER_AREA);
+
+    detectGrass(small, grass);
+    grassRatio = (double)countNonZero(grass) / grass.total();
+
+    cvtColor(small, HSV, CV_BGR2HSV);
+    const int channels[] = { 0, 1 };
+    const int bins[] = { SHOT_HUE_BINS, SHOT_SATURATION_BINS };
+    const float hueRange[] = { 0, 180 };
+    const float saturationRange[] = { 0, 256 };
+    const float* ranges[] = { hueRange, saturationRange };
+    histograms.resize(SHOT_GRID * SHOT_GRID);
+    for ( int i = 0 ; i < SHOT_GRID * SHOT_GRID ; i++ )
+    {
+        int x = i % SHOT_GRID, y = i / SHOT_GRID;
+        Rect cellArea(x * HSV.cols / SHOT_GRID, y * HSV.rows / SHOT_GRID,
+                      (x + 1) * HSV.cols / SHOT_GRID - x * HSV.cols / SHOT_GRID, (y + 1) * HSV.rows / SHOT_GRID - y * HSV.rows / SHOT_GRID);
+        const Mat cell = HSV(cellArea);
+        calcHist(&cell, 1, channels, Mat(), histograms[i], 2, bins, ranges);
+        normalize(histograms[i], histograms[i], 1, 0, NORM_L1);
+    }
+
+    ShotTransition transition = SHOT_CONTINUOUS;
+    if ( previousHistograms.size() != histograms.size() )
+    {
+        distance = 1;
+        transition = SHOT_CUT;
+    }
+    else
+    {
+        distance = 0;
+        for ( size_t i = 0 ; i < histograms.size() ; i++ )
+        {
+            distance += compareHist(previousHistograms[i], histograms[i], CV_COMP_BHATTACHARYYA);
+        }
+        distance /= histograms.size();
+        if ( distance > SHOT_CUT_DISTANCE || fabs(grassRatio - previousGrassRatio) > SHOT_GRASS_CHANGE )
+        {
+            transition = SHOT_CUT;
+        }
+    }
+    if ( grassRatio < SHOT_MIN_GRASS_RATIO )
+    {
+        transition = SHOT_NON_PITCH;
+    }
+
+    // The histograms of this frame are the previous ones of the next frame
+    previousHistograms.swap(histograms);
+    previousGrassRatio = grassRatio;
+    return transition;
+}
+
+double ShotDetector::getGrassRatio() const
+{
+    return grassRatio;
+}
+
+double ShotDetector::getDistance() const
+{
+    return distance;
+}
@@ -0,0 +1,69 @@
+/*
+Cheap shot change detection, run before the movement detection.
+A broadcast cuts from one camera to another, to close-ups of the players, to the crowd and to replays.
+Across a cut, the movement detection spends its time on two unrelated frames and returns garbage or
+nothing; on a close-up, there is no pitch to stabilize on. Each frame is reduced, and compared to the
+previous one with the hue-saturation histograms of a grid of cells (the colors and their layout)
+and its share of grass:
+    - little grass: a shot that is not the pitch (close-up, crowd, graphics)
+    - a different histogram or share of grass: a cut
+    - otherwise the camera continues its movement
+*/
+
+#ifndef SHOT_HPP
+#define SHOT_HPP
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+using namespace std;
+
+#define SHOT_DOWNSCALE 8                // the frames are reduced this many times
+#define SHOT_GRID 3                     // the histograms are computed on SHOT_GRID x SHOT_GRID cells
+#define SHOT_HUE_BINS 16
+#define SHOT_SATURATION_BINS 16
+#define SHOT_CUT_DISTANCE 0.4           // mean Bhattacharyya distance of the cells over which the shot changed
+#define SHOT_GRASS_CHANGE 0.25          // change of the share of grass over which the shot changed
+#define SHOT_MIN_GRASS_RATIO 0.2        // a frame with less grass is not a view of the pitch
+
+
+// Relation of a frame with the previous one
+enum ShotTransition
+{
+    SHOT_CONTINUOUS,    // same shot of the pitch: the movement can be detected
+    SHOT_CUT,           // another shot of the pitch: nothing to compare with
+    SHOT_NON_PITCH      // close-up, crowd, graphics: nothing to stabilize on
+};
+
+class ShotDetector
+{
+public:
+    ShotDetector();
+
+    // Forget the previous frame
+    void reset();
+
+    /*
+    @param frame: the next frame of the video (CV_8UC3)
+    @return its relation with the previous frame (SHOT_CUT for the first frame)
+    */
+    ShotTransition process(const Mat frame);
+
+    double getGrassRatio() const;
+    // Histogram distance with the previous frame (0 for the same colors, 1 for no common color)
+    double getDistance() const;
+
+private:
+    Mat small;
+    Mat HSV;
+    Mat grass;
+    vector<Mat> histograms;         // one per cell
+    vector<Mat> previousHistograms;
+    double grassRatio;
+    double previousGrassRatio;
+    double distance;
+};
+
+#endif
@@ -4,93 +4,1314 @@ Maxime Touroute
 */
 
 #include "stabilization.hpp"
+#include "kernels.hpp"
+#include "profiler.hpp"
+#include "morphology.hpp"
+#include "grass.hpp"
+#include "warp.hpp"
+
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+//*************************************************************************
+//                              STABILIZATION                             *
+//*************************************************************************
+
+/*
+Pre processing applied on frames before stabilization
+The goal is to enhance camera stabilization precision 
+by swipping away interference with the camera movement
+@param frame : the frame to process
+@return Mat: the frame processed
+*/
+Mat preProccessingStabilization(const Mat frame)
+{
+    Mat mask;
+    return preProccessingStabilization(frame, mask);
+}
+
+/*
+Same as above, but also gives back the mask used
+@param frame : the frame to process
+@param mask : filled with the mask of irrelevant areas for camera stabilization
+@return Mat: the frame processed
+*/
+Mat preProccessingStabilization(const Mat frame, Mat& mask)
+{
+    // The frame is bordered: so is the panel
+    FrameAnalysis analysis(frame);
+    analysis.setScoreMask(detectScoreOverlayPanel(frame, BORDER_HEIGHT/2, BORDER_WIDTH/2));
+    return preProccessingStabilization(analysis, mask);
+}
+
+/*
+Same as above, reusing the masks of the frame analysis
+@param analysis : the analysis of the frame to process
+@param mask : filled with the mask of irrelevant areas for camera stabilization
+@return Mat: the frame processed
+*/
+Mat preProccessingStabilization(FrameAnalysis& analysis, Mat& mask)
+{
+    Mat resultFrame;
+    preProccessingStabilization(analysis, mask, resultFrame);
+    return resultFrame;
+}
+
+/*
+Same as above, in buffers given by the caller
+@param analysis : the analysis of the frame to process
+@param mask : filled with the mask of irrelevant areas for camera stabilization
+@param resultFrame : filled with the frame processed (not sharing the data of the frame)
+*/
+void preProccessingStabilization(FrameAnalysis& analysis, Mat& mask, Mat& resultFrame)
+{
+    const Mat frame = analysis.getFrame();
+    getMaskOfIrrelevantAreasForCameraStabilization(analysis, mask);
+    // Blur the areas of the mask: where the 30x30 blurred mask is not 0, the pixels are 30x30 blurred.
+    // Only the masked areas are blurred
+    frame.copyTo(resultFrame);
+    PROFILE_STAGE("masked blur");
+    blurMaskedPixels(mask, frame, resultFrame, 30);
+}
+
+/*
+Add the borders and pre process a frame, keeping every intermediate result
+@param frame : the frame to prepare
+@param maskDownscale : the masks are computed on the frame reduced by this factor
+@param scoreMask : the detected score overlay of the frame, empty for the default panel
+@return the prepared frame
+*/
+PreparedFrame prepareFrame(const Mat frame, int maskDownscale, const Mat scoreMask)
+{
+    PreparedFrame prepared;
+    prepareFrame(frame, prepared, maskDownscale, scoreMask);
+    return prepared;
+}
+
+/*
+Same as above, in the buffers of a frame prepared before (they must not be shared with another prepared frame)
+@param prepared : the prepared frame to fill
+*/
+void prepareFrame(const Mat frame, PreparedFrame& prepared, int maskDownscale, const Mat scoreMask)
+{
+    prepared.frame = frame;
+    prepared.analysis.reset(frame, maskDownscale);
+    if ( !scoreMask.empty() )
+    {
+        prepared.analysis.setScoreMask(scoreMask);
+    }
+    // Add a black border (seems to give better results with it)
+    addBlackBorder(frame, BORDER_WIDTH, BORDER_HEIGHT, prepared.borderedFrame);
+    // The grass of the borders is known: no need to classify them again
+    prepared.analysis.bordered(prepared.borderedFrame, BORDER_WIDTH, BORDER_HEIGHT, prepared.borderedAnalysis);
+    preProccessingStabilization(prepared.borderedAnalysis, prepared.mask, prepared.processedFrame);
+    prepared.pyramid.clear();
+}
+
+/*
+Same as above, with the mask of another frame: no mask is computed.
+The camera moves little from one frame to the next, so the mask of the previous frame is close enough
+@param mask : the mask of irrelevant areas for camera stabilization to use (bordered)
+*/
+void prepareFrameWithMask(const Mat frame, PreparedFrame& prepared, const Mat mask, int maskDownscale, const Mat scoreMask)
+{
+    prepared.frame = frame;
+    prepared.analysis.reset(frame, maskDownscale);
+    if ( !scoreMask.empty() )
+    {
+        prepared.analysis.setScoreMask(scoreMask);
+    }
+    addBlackBorder(frame, BORDER_WIDTH, BORDER_HEIGHT, prepared.borderedFrame);
+    prepared.borderedAnalysis.reset(prepared.borderedFrame, maskDownscale);
+    // Copied: the mask is kept with the frame, which may give it to the next one
+    if ( prepared.mask.data != mask.data )
+    {
+        mask.copyTo(prepared.mask);
+    }
+    prepared.borderedFrame.copyTo(prepared.processedFrame);
+    PROFILE_STAGE("masked blur");
+    blurMaskedPixels(prepared.mask, prepared.borderedFrame, prepared.processedFrame, 30);
+    prepared.pyramid.clear();
+}
+
+/*
+The main stabilization method
+@param previousFrame : the previousFrame of the video
+@param currentFrame : the currentFrame of the video
+@return the stabilized image
+*/
+Mat stabilize(const Mat previousFrame, const Mat currentFrame)
+{
+    Stabilizer stabilizer;
+    stabilizer.setReferenceFrame(previousFrame);
+    return stabilizer.stabilize(currentFrame);
+}
+
+/*
+Apply a detected movement to a frame
+@param frame : the frame to move
+@param homography : the movement, as returned by estimateRigidTransform (empty: the frame is not moved)
+@return the stabilized image
+*/
+Mat applyHomography(const Mat frame, const Mat homography)
+{
+    return applyHomography(frame, homography, Size(frame.cols, frame.rows));
+}
+
+/*
+Same as above, with another size for the stabilized image
+@param outputSize : the size of the stabilized image
+*/
+Mat applyHomography(const Mat frame, const Mat homography, Size outputSize)
+{
+    PROFILE_STAGE("warpAffine");
+    Mat stabilizedFrame;
+    // No movement detected: the frame is not moved
+    const Mat movement = homography.empty() ? Mat(Mat::eye(2, 3, CV_64F)) : homography;
+    if ( outputSize == frame.size() )
+    {
+        warpNearest(frame, movement, stabilizedFrame);
+        return stabilizedFrame;
+    }
+    warpAffine(frame, stabilizedFrame, movement, outputSize, INTER_NEAREST | WARP_INVERSE_MAP);
+    ////imshow("currentFrame", (frame, 2) );
+    ////imshow("stabilizedFrame", (stabilizedFrame, 2) );
+    return stabilizedFrame;
+}
+
+/*
+Same as the first one, into an image given by the caller
+@param stabilizedFrame : filled with the stabilized image (not sharing the data of the frame)
+*/
+void applyHomography(const Mat frame, const Mat homography, Mat& stabilizedFrame)
+{
+    PROFILE_STAGE("warpAffine");
+    if ( homography.empty() )
+    {
+        frame.copyTo(stabilizedFrame);
+        return;
+    }
+    // The cheapest kernel for the movement
+    warpNearest(frame, homography, stabilizedFrame);
+}
+
+//*************************************************************************
+//                               STABILIZER                               *
+//*************************************************************************
+
+StabilizerSettings::StabilizerSettings()
+    : estimationMode(ESTIMATION_FULL)
+    , maskDownscale(1)
+    , detectOverlay(false)
+    , deadline(0)
+    , keyframeInterval(0)
+    , adaptiveKeyframes(false)
+    , detectCuts(false)
+{
+}
+
+KeyframeState::KeyframeState()
+    : framesSinceKeyframe(0)
+    , interval(0)
+    , baseline(0)
+    , keyframes(0)
+    , forcedKeyframes(0)
+{
+}
+
+StabilizerBuffers::StabilizerBuffers()
+    : current(0)
+    , reallocations(0)
+    , settling(0)
+{
+}
+
+/*
+A buffer allocated once keeps its data from one frame to the next: count the ones that moved
+@param output : the stabilized frame given by the caller
+@param given : the data of the output given by the caller, which may change from one frame to the next
+*/
+void StabilizerBuffers::checkReallocations(const Mat& output, const uchar* given)
+{
+    collected.clear();
+    for ( int i = 0 ; i < 2 ; i++ )
+    {
+        collected.push_back(frames[i].borderedFrame);
+        collected.push_back(frames[i].mask);
+        collected.push_back(frames[i].processedFrame);
+        frames[i].analysis.getBuffers(collected);
+        frames[i].borderedAnalysis.getBuffers(collected);
+    }
+    stabilizedAnalysis.getBuffers(collected);
+
+    if ( given != NULL && output.data != given && settling == 0 )
+    {
+        // The output given by the caller did not have the size of the frame
+        reallocations++;
+    }
+    addresses.resize(collected.size(), NULL);
+    if ( settling > 0 )
+    {
+        // The new sizes are the first allocations
+        settling--;
+        addresses.assign(collected.size(), NULL);
+    }
+    for ( size_t i = 0 ; i < collected.size() ; i++ )
+    {
+        const uchar* data = collected[i].data;
+        if ( addresses[i] != NULL && data != NULL && data != addresses[i] )
+        {
+            reallocations++;
+        }
+        if ( data != NULL )
+        {
+            addresses[i] = data;
+        }
+    }
+    // Only the addresses are kept
+    collected.clear();
+}
+
+Stabilizer::Stabilizer(const StabilizerSettings& settings)
+    : settings(settings)
+    , hasPrevious(false)
+    , buffered(false)
+    , quality(QUALITY_FULL)
+    , lastShot(SHOT_CONTINUOUS)
+{
+}
+
+void Stabilizer::reset()
+{
+    previous = PreparedFrame();
+    hasPrevious = false;
+    tracker.reset();
+    lastHomography = Mat();
+    stabilizedAnalysis = FrameAnalysis();
+    buffered = false;
+    keyframes = KeyframeState();
+}
+
+bool Stabilizer::hasPreviousFrame() const
+{
+    return hasPrevious;
+}
+
+void Stabilizer::setReferenceFrame(const Mat frame)
+{
+    previous = prepareFrame(frame, settings.maskDownscale);
+    hasPrevious = true;
+    tracker.reset();
+}
+
+Mat Stabilizer::stabilize(const Mat currentFrame)
+{
+    return stabilize(prepareFrame(currentFrame, settings.maskDownscale));
+}
+
+/*
+@param currentFrame : the prepared currentFrame of the video
+@return the stabilized image
+*/
+Mat Stabilizer::stabilize(const PreparedFrame& currentFrame)
+{
+    buffered = false;
+    if ( !checkShot(currentFrame.frame) )
+    {
+        stabilizedAnalysis = currentFrame.analysis;
+        profileFrameDone();
+        return currentFrame.frame.clone();
+    }
+    Mat homography = estimate(currentFrame);
+    if ( homography.empty() )
+    {
+        stabilizedAnalysis = previous.analysis;
+        profileFrameDone();
+        return currentFrame.frame.clone();
+    }
+    // Apply the detected movement
+    Mat stabilizedFrame = applyHomography(currentFrame.frame, homography);
+    // The grass of the stabilized frame is the moved grass of the current frame
+    stabilizedAnalysis = previous.analysis.warped(stabilizedFrame, homography);
+    profileFrameDone();
+    return stabilizedFrame;
+}
+
+/*
+@param currentFrame : the currentFrame of the video
+@param stabilizedFrame : filled with the stabilized image, kept by the caller from one frame to the next
+                         (or another buffer of the frame size each time, as the slots of a ring, written in place)
+@param scoreMask : the detected score overlay of the frame, empty for the default panel
+*/
+void Stabilizer::stabilize(const Mat currentFrame, Mat& stabilizedFrame, const Mat scoreMask)
+{
+    CV_Assert( stabilizedFrame.empty() || stabilizedFrame.data != currentFrame.data );
+    const uchar* given = stabilizedFrame.data;
+    if ( buffers.frameSize != currentFrame.size() )
+    {
+        // Another resolution: new buffers, and no previous frame to compare with
+        reset();
+        buffers = StabilizerBuffers();
+        buffers.frameSize = currentFrame.size();
+    }
+    if ( !checkShot(currentFrame) )
+    {
+        // Off the pitch: the frame goes through as is
+        currentFrame.copyTo(stabilizedFrame);
+        buffers.stabilizedAnalysis.reset(stabilizedFrame, settings.maskDownscale);
+        if ( !scoreMask.empty() )
+        {
+            buffers.stabilizedAnalysis.setScoreMask(scoreMask);
+        }
+        buffered = true;
+        profileFrameDone();
+        return;
+    }
+    // The previous frame is in the other buffers
+    PreparedFrame& current = buffers.frames[buffers.current];
+    bool detection = settings.keyframeInterval <= 0 || needsKeyframe(currentFrame);
+    if ( quality == QUALITY_REUSED_TRANSFORM && hasPrevious )
+    {
+        detection = false;
+    }
+    // Between keyframes, the mask of the keyframe is carried from frame to frame
+    const bool reuseMask = ( quality >= QUALITY_REUSED_MASKS || !detection ) && hasPrevious && previous.mask.size() == Size(
+                               currentFrame.cols + BORDER_WIDTH, currentFrame.rows + BORDER_HEIGHT);
+    if ( reuseMask )
+    {
+        prepareFrameWithMask(currentFrame, current, previous.mask, settings.maskDownscale, scoreMask);
+    }
+    else
+    {
+        const int maskDownscale = quality >= QUALITY_REDUCED_MASKS ? settings.maskDownscale * QUALITY_MASK_DOWNSCALE
+                                                                   : settings.maskDownscale;
+        prepareFrame(currentFrame, current, maskDownscale, scoreMask);
+    }
+
+    Mat homography;
+    if ( !detection && settings.keyframeInterval > 0 )
+    {
+        homography = predictMovement();
+        previous = current;
+    }
+    else if ( !detection )
+    {
+        // Same movement as the last frame: the current frame is still the previous frame of the next step
+        homography = lastHomography;
+        previous = current;
+        tracker.reset();
+    }
+    else if ( settings.keyframeInterval > 0 )
+    {
+        homography = estimateKeyframe(current);
+    }
+    else
+    {
+        homography = estimate(current);
+    }
+    cv::swap(keyframes.previousSmall, keyframes.currentSmall);
+    if ( homography.empty() )
+    {
+        currentFrame.copyTo(stabilizedFrame);
+    }
+    else
+    {
+        applyHomography(currentFrame, homography, stabilizedFrame);
+    }
+    if ( reuseMask )
+    {
+        // No grass computed on the current frame: the analysis of the stabilized frame is computed when asked
+        buffers.stabilizedAnalysis.reset(stabilizedFrame, settings.maskDownscale);
+        if ( !scoreMask.empty() )
+        {
+            buffers.stabilizedAnalysis.setScoreMask(scoreMask);
+        }
+    }
+    else
+    {
+        current.analysis.warped(stabilizedFrame, homography, buffers.stabilizedAnalysis);
+    }
+    buffered = true;
+
+    buffers.checkReallocations(stabilizedFrame, given);
+    buffers.current = 1 - buffers.current;
+    profileFrameDone();
+}
+
+/*
+Classify the frame against the previous one, when the cuts are detected. After a cut, the frame is the
+first one of a new shot: the previous frame is forgotten. Off the pitch, there is nothing to detect
+@param currentFrame : the currentFrame of the video
+@return false if the frame must go through without movement detection
+*/
+bool Stabilizer::checkShot(const Mat currentFrame)
+{
+    if ( !settings.detectCuts )
+    {
+        lastShot = SHOT_CONTINUOUS;
+        return true;
+    }
+    lastShot = shots.process(currentFrame);
+    if ( lastShot != SHOT_CONTINUOUS )
+    {
+        reset();
+    }
+    return lastShot != SHOT_NON_PITCH;
+}
+
+/*
+Movement detection only: the frame is not moved
+@param currentFrame : the prepared currentFrame of the video
+@return the movement between the previous frame and this one, empty for the first frame
+*/
+Mat Stabilizer::estimate(const PreparedFrame& currentFrame)
+{
+    if ( !hasPrevious )
+    {
+        previous = currentFrame;
+        hasPrevious = true;
+        tracker.reset();
+        lastHomography = Mat();
+        return lastHomography;
+    }
+    //imshow("processedFrame", (previous.processedFrame, 4) );
+    //imshow("processedFrame", (currentFrame.processedFrame, 4) );
+    // Movement detection between the two frames
+    if ( settings.estimationMode == ESTIMATION_TRACKING )
+    {
+        {
+            PROFILE_STAGE("feature tracking");
+            lastHomography = tracker.track(previous, currentFrame);
+        }
+        if ( lastHomography.empty() )
+        {
+            // Lost: detect the movement on the whole frames
+            PROFILE_STAGE("estimateRigidTransform");
+            lastHomography = estimateRigidTransform(previous.processedFrame, currentFrame.processedFrame, false);
+        }
+        previous = currentFrame;
+    }
+    else if ( settings.estimationMode == ESTIMATION_PYRAMID )
+    {
+        // The pyramid of the current frame is kept for the next step
+        PreparedFrame current = currentFrame;
+        PROFILE_STAGE("pyramid estimation");
+        lastHomography = estimatePyramidTransform(previous, current);
+        previous = current;
+    }
+    else
+    {
+        PROFILE_STAGE("estimateRigidTransform");
+        lastHomography = estimateRigidTransform(previous.processedFrame, currentFrame.processedFrame, false);
+        // The current frame is the previous frame of the next step
+        previous = currentFrame;
+    }
+    return lastHomography;
+}
+
+//*************************************************************************
+//                         KEYFRAME DETECTION                             *
+//*************************************************************************
+
+/*
+@param homography : a movement as returned by estimateRigidTransform (2x3)
+@return the same movement as a 3x3 matrix
+*/
+static Mat toSquareMatrix(const Mat homography)
+{
+    Mat square = Mat::eye(3, 3, CV_64F);
+    homography.convertTo(square.rowRange(0, 2), CV_64F);
+    return square;
+}
+
+/*
+@param homography : a movement in the coordinates of the bordered frames (3x3)
+@param scale : the reduction of the frames
+@return the same movement between the frames without border, reduced scale times (2x3)
+*/
+static Mat toReducedCoordinates(const Mat homography, double scale)
+{
+    const Mat offset = (Mat_<double>(3, 3) << 1, 0, BORDER_WIDTH / 2, 0, 1, BORDER_HEIGHT / 2, 0, 0, 1);
+    const Mat reduction = (Mat_<double>(3, 3) << 1. / scale, 0, 0, 0, 1. / scale, 0, 0, 0, 1);
+    Mat reduced = reduction * offset.inv() * homography * offset * reduction.inv();
+    return reduced.rowRange(0, 2).clone();
+}
+
+/*
+@param movement : a movement (3x3)
+@param size : the size of the frames
+@return the mean distance (px) between the corners of the frame moved by the movement and by the identity
+*/
+static double getMovementAmplitude(const Mat movement, Size size)
+{
+    const Point2d corners[] = { Point2d(0, 0), Point2d(size.width, 0), Point2d(0, size.height), Point2d(size.width, size.height) };
+    double amplitude = 0;
+    for ( int i = 0 ; i < 4 ; i++ )
+    {
+        const Point2d& c = corners[i];
+        double dx = ( movement.at<double>(0, 0) - 1 ) * c.x + movement.at<double>(0, 1) * c.y + movement.at<double>(0, 2);
+        double dy = movement.at<double>(1, 0) * c.x + ( movement.at<double>(1, 1) - 1 ) * c.y + movement.at<double>(1, 2);
+        amplitude += sqrt(dx * dx + dy * dy);
+    }
+    return amplitude / 4;
+}
+
+/*
+Mean difference between a reduced previous frame and the reduced current frame moved back by a movement
+@param previousSmall, currentSmall : the reduced gray frames
+@param homography : the movement between them, in the bordered coordinates (3x3)
+@return the mean absolute difference inside the frames (gray levels)
+*/
+static double getResidual(const Mat previousSmall, const Mat currentSmall, const Mat homography)
+{
+    Mat moved, difference;
+    warpAffine(currentSmall, moved, toReducedCoordinates(homography, KEYFRAME_RESIDUAL_DOWNSCALE), currentSmall.size(),
+               INTER_LINEAR | WARP_INVERSE_MAP);
+    absdiff(previousSmall, moved, difference);
+    // The borders may come from outside of the frame
+    Rect inside(difference.cols / 8, difference.rows / 8, difference.cols * 3 / 4, difference.rows * 3 / 4);
+    return mean(difference(inside))[0];
+}
+
+/*
+Reduce the current frame for the residual check, and decide if its movement has to be detected
+@param currentFrame : the currentFrame of the video
+@return true for a keyframe
+*/
+bool Stabilizer::needsKeyframe(const Mat currentFrame)
+{
+    PROFILE_STAGE("keyframe residual");
+    KeyframeState& state = keyframes;
+    Mat reduced;
+    resize(currentFrame, reduced, Size(currentFrame.cols / KEYFRAME_RESIDUAL_DOWNSCALE, currentFrame.rows / KEYFRAME_RESIDUAL_DOWNSCALE),
+           0, 0, INTER_AREA);
+    cvtColor(reduced, state.currentSmall, CV_BGR2GRAY);
+
+    if ( !hasPrevious || state.movement.empty() || state.previousSmall.size() != state.currentSmall.size() )
+    {
+        return true;
+    }
+    if ( state.framesSinceKeyframe + 1 >= state.interval )
+    {
+        return true;
+    }
+    double residual = getResidual(state.previousSmall, state.currentSmall, state.movement);
+    if ( residual > KEYFRAME_RESIDUAL_RATIO * state.baseline + KEYFRAME_RESIDUAL_MARGIN )
+    {
+        // The camera changed its movement
+        state.forcedKeyframes++;
+        return true;
+    }
+    return false;
+}
+
+/*
+Detect the movement between the last keyframe and the current frame
+@param currentFrame : the prepared currentFrame of the video, the next keyframe
+@return the movement between the previous frame and this one: the detected movement without the predictions
+made since the last keyframe, empty for the first frame
+*/
+Mat Stabilizer::estimateKeyframe(const PreparedFrame& currentFrame)
+{
+    KeyframeState& state = keyframes;
+    if ( state.interval == 0 )
+    {
+        state.interval = settings.adaptiveKeyframes ? MIN(KEYFRAME_MIN_INTERVAL, settings.keyframeInterval) : settings.keyframeInterval;
+    }
+    Mat homography;
+    if ( hasPrevious && state.keyframes > 0 )
+    {
+        // The reference of the detection is the last keyframe
+        previous = state.reference;
+        Mat detected = estimate(currentFrame);
+        if ( !detected.empty() )
+        {
+            const int frames = state.framesSinceKeyframe + 1;
+            Mat total = toSquareMatrix(detected);
+            Mat pairwise = total * state.predicted.inv();
+            homography = pairwise.rowRange(0, 2).clone();
+            if ( settings.adaptiveKeyframes && !state.movement.empty() )
+            {
+                // The prediction of the whole interval against the detected movement
+                double error = getMovementAmplitude(state.movement * state.predicted * total.inv(), currentFrame.frame.size());
+                if ( error < KEYFRAME_STABLE_ERROR )
+                {
+                    state.interval = MIN(state.interval + 1, settings.keyframeInterval);
+                }
+                else if ( error > KEYFRAME_UNSTABLE_ERROR )
+                {
+                    state.interval = MAX(state.interval / 2, KEYFRAME_MIN_INTERVAL);
+                }
+            }
+            // Linear interpolation of the movement over the interval
+            Mat identity = Mat::eye(3, 3, CV_64F);
+            state.movement = identity + ( total - identity ) / frames;
+            if ( state.previousSmall.size() == state.currentSmall.size() )
+            {
+                state.baseline = getResidual(state.previousSmall, state.currentSmall, pairwise);
+            }
+        }
+        else
+        {
+            state.movement = Mat();
+        }
+        lastHomography = homography;
+    }
+    else
+    {
+        // First keyframe: detected against the previous frame, if any
+        homography = estimate(currentFrame);
+        state.movement = homography.empty() ? Mat() : toSquareMatrix(homography);
+    }
+
+    // The current frame is the reference of the next detection: copied out of the buffers of the Stabilizer
+    PreparedFrame& reference = state.reference;
+    reference.frame = previous.frame;
+    reference.analysis = FrameAnalysis();
+    reference.borderedAnalysis = FrameAnalysis();
+    previous.borderedFrame.copyTo(reference.borderedFrame);
+    previous.mask.copyTo(reference.mask);
+    previous.processedFrame.copyTo(reference.processedFrame);
+    reference.pyramid.resize(previous.pyramid.size());
+    for ( size_t i = 0 ; i < previous.pyramid.size() ; i++ )
+    {
+        previous.pyramid[i].copyTo(reference.pyramid[i]);
+    }
+    state.predicted = Mat::eye(3, 3, CV_64F);
+    state.framesSinceKeyframe = 0;
+    state.keyframes++;
+    return homography;
+}
+
+/*
+Move a frame between two keyframes with the predicted movement
+@return the predicted movement between the previous frame and this one
+*/
+Mat Stabilizer::predictMovement()
+{
+    KeyframeState& state = keyframes;
+    state.framesSinceKeyframe++;
+    if ( state.movement.empty() )
+    {
+        lastHomography = Mat();
+        return lastHomography;
+    }
+    state.predicted = state.movement * state.predicted;
+    lastHomography = state.movement.rowRange(0, 2).clone();
+    return lastHomography;
+}
+
+ShotTransition Stabilizer::getLastShot() const
+{
+    return lastShot;
+}
+
+int Stabilizer::getKeyframeCount() const
+{
+    return keyframes.keyframes;
+}
+
+int Stabilizer::getForcedKeyframeCount() const
+{
+    return keyframes.forcedKeyframes;
+}
+
+int Stabilizer::getKeyframeInterval() const
+{
+    return keyframes.interval;
+}
+
+Mat Stabilizer::getLastHomography() const
+{
+    return lastHomography;
+}
+
+int Stabilizer::getTrackCount() const
+{
+    return settings.estimationMode == ESTIMATION_TRACKING ? tracker.getTrackCount() : 0;
+}
+
+FrameAnalysis& Stabilizer::getStabilizedFrameAnalysis()
+{
+    return buffered ? buffers.stabilizedAnalysis : stabilizedAnalysis;
+}
+
+const PreparedFrame& Stabilizer::getPreviousFrame() const
+{
+    return previous;
+}
+
+int Stabilizer::getReallocationCount() const
+{
+    return buffers.reallocations;
+}
+
+void Stabilizer::setQualityLevel(QualityLevel level)
+{
+    if ( level != quality )
+    {
+        // The masks of the two buffered frames change of size
+        buffers.settling = 2;
+    }
+    quality = level;
+}
+
+QualityLevel Stabilizer::getQualityLevel() const
+{
+    return quality;
+}
+
+//*************************************************************************
+//                           PYRAMID DETECTION                            *
+//*************************************************************************
+
+/*
+Build the gray pyramid of the processed frame, if not done yet
+@param frame : the prepared frame
+*/
+static void buildPyramid(PreparedFrame& frame)
+{
+    if ( !frame.pyramid.empty() )
+    {
+        return;
+    }
+    frame.pyramid.resize(PYRAMID_COARSE_LEVEL + 1);
+    cvtColor(frame.processedFrame, frame.pyramid[0], CV_BGR2GRAY);
+    for ( int level = 1 ; level <= PYRAMID_COARSE_LEVEL ; level++ )
+    {
+        pyrDown(frame.pyramid[level - 1], frame.pyramid[level]);
+    }
+}
+
+/*
+Change the scale of a movement: the linear part is kept, the translation is scaled
+@param homography : the 2x3 movement
+@param scale : the scale factor
+@return the scaled movement
+*/
+static Mat scaleHomography(const Mat homography, double scale)
+{
+    Mat scaled = homography.clone();
+    scaled.at<double>(0, 2) *= scale;
+    scaled.at<double>(1, 2) *= scale;
+    return scaled;
+}
+
+/*
+Refine a movement on one level of the pyramids.
+Corners are taken on the relevant areas of the previous frame (the grass, without the players),
+moved with the current estimation and tracked in the current frame.
+@param previousLevel, currentLevel : the gray frames of the level
+@param relevantArea : where to take the corners (non zero)
+@param homography : the estimation at this level
+@return the refined estimation, or an empty Mat if there is not enough points
+*/
+static Mat refineHomography(const Mat previousLevel, const Mat currentLevel, const Mat relevantArea, const Mat homography)
+{
+    vector<Point2f> previousPoints, currentPoints;
+    goodFeaturesToTrack(previousLevel, previousPoints, PYRAMID_REFINEMENT_POINTS, 0.01, 8, relevantArea);
+    if ( (int)previousPoints.size() < PYRAMID_MIN_REFINEMENT_POINTS )
+    {
+        return Mat();
+    }
+    // Start the tracking from the estimated positions
+    const double* h = homography.ptr<double>(0);
+    for ( size_t i = 0 ; i < previousPoints.size() ; i++ )
+    {
+        const Point2f& p = previousPoints[i];
+        currentPoints.push_back(Point2f(h[0] * p.x + h[1] * p.y + h[2], h[3] * p.x + h[4] * p.y + h[5]));
+    }
+
+    // Single level tracking: the movement left to find is small
+    vector<uchar> status;
+    vector<float> error;
+    calcOpticalFlowPyrLK(previousLevel, currentLevel, previousPoints, currentPoints, status, error, Size(15, 15), 0,
+                         TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, 20, 0.03), OPTFLOW_USE_INITIAL_FLOW);
+
+    vector<Point2f> trackedPrevious, trackedCurrent;
+    for ( size_t i = 0 ; i < status.size() ; i++ )
+    {
+        if ( status[i] )
+        {
+            trackedPrevious.push_back(previousPoints[i]);
+            trackedCurrent.push_back(currentPoints[i]);
+        }
+    }
+    if ( (int)trackedPrevious.size() < PYRAMID_MIN_REFINEMENT_POINTS )
+    {
+        return Mat();
+    }
+    return estimateRigidTransform(trackedPrevious, trackedCurrent, false);
+}
+
+/*
+The areas where corners can be used to detect the camera movement:
+not masked, and away from the black borders
+@param mask : the mask of irrelevant areas for camera stabilization (bordered)
+@return 255 on the relevant areas, 0 elsewhere
+*/
+Mat getRelevantAreaForCameraStabilization(const Mat mask)
+{
+    Mat relevantArea = cv::Mat::zeros(mask.size(), CV_8U);
+    Rect insideBorders(BORDER_WIDTH, BORDER_HEIGHT, mask.cols - 2 * BORDER_WIDTH, mask.rows - 2 * BORDER_HEIGHT);
+    relevantArea(insideBorders).setTo(Scalar(255), mask(insideBorders) == 0);
+    return relevantArea;
+}
+
+/*
+Coarse to fine movement detection: estimateRigidTransform on the coarse level of the pyramids,
+then refinement on the relevant areas of the finer levels.
+@param previousFrame : the prepared previousFrame of the video
+@param currentFrame : the prepared currentFrame of the video
+@return the movement at full resolution, same as estimateRigidTransform
+*/
+Mat estimatePyramidTransform(PreparedFrame& previousFrame, PreparedFrame& currentFrame)
+{
+    buildPyramid(previousFrame);
+    buildPyramid(currentFrame);
+
+    Mat homography = estimateRigidTransform(previousFrame.pyramid[PYRAMID_COARSE_LEVEL],
+                                            currentFrame.pyramid[PYRAMID_COARSE_LEVEL], false);
+    if ( homography.empty() )
+    {
+        // Nothing to refine: try the full resolution detection
+        return estimateRigidTransform(previousFrame.processedFrame, currentFrame.processedFrame, false);
+    }
+
+    Mat relevantArea = getRelevantAreaForCameraStabilization(previousFrame.mask);
+
+    for ( int level = PYRAMID_COARSE_LEVEL - 1 ; level >= PYRAMID_FINEST_LEVEL ; level-- )
+    {
+        homography = scaleHomography(homography, 2);
+        Mat levelArea;
+        resize(relevantArea, levelArea, previousFrame.pyramid[level].size(), 0, 0, INTER_NEAREST);
+        Mat refined = refineHomography(previousFrame.pyramid[level], currentFrame.pyramid[level], levelArea, homography);
+        if ( !refined.empty() )
+        {
+            homography = refined;
+        }
+    }
+    return scaleHomography(homography, 1 << PYRAMID_FINEST_LEVEL);
+}
+
+//*************************************************************************
+//                            FEATURE TRACKING                            *
+//*************************************************************************
+
+FeatureTracker::FeatureTracker()
+{
+}
+
+void FeatureTracker::reset()
+{
+    previousGray = Mat();
+    points.clear();
+}
+
+int FeatureTracker::getTrackCount() const
+{
+    return (int)points.size();
+}
+
+/*
+Add new corners on the relevant areas of the frame, away from the current tracks
+@param frame : the frame of previousGray
+*/
+void FeatureTracker::detectCorners(const PreparedFrame& frame)
+{
+    const int minDistance = 10;
+    Mat relevantArea = getRelevantAreaForCameraStabilization(frame.mask);
+    for ( size_t i = 0 ; i < points.size() ; i++ )
+    {
+        circle(relevantArea, Point(cvRound(points[i].x), cvRound(points[i].y)), minDistance, Scalar(0), -1);
+    }
+    vector<Point2f> corners;
+    goodFeaturesToTrack(previousGray, corners, TRACKING_MAX_POINTS - (int)points.size(), 0.01, minDistance, relevantArea);
+    points.insert(points.end(), corners.begin(), corners.end());
+}
+
+/*
+@param previousFrame : the prepared previousFrame of the video
+@param currentFrame : the prepared currentFrame of the video
+@return the movement between the two frames, or an empty Mat
+*/
+Mat FeatureTracker::track(const PreparedFrame& previousFrame, const PreparedFrame& currentFrame)
+{
+    if ( previousGray.empty() )
+    {
+        cvtColor(previousFrame.processedFrame, previousGray, CV_BGR2GRAY);
+        points.clear();
+    }
+    Mat currentGray;
+    cvtColor(currentFrame.processedFrame, currentGray, CV_BGR2GRAY);
+
+    if ( (int)points.size() < TRACKING_MIN_POINTS )
+    {
+        detectCorners(previousFrame);
+    }
+
+    vector<Point2f> trackedPrevious, trackedCurrent;
+    if ( !points.empty() )
+    {
+        vector<Point2f> nextPoints;
+        vector<uchar> status;
+        vector<float> error;
+        calcOpticalFlowPyrLK(previousGray, currentGray, points, nextPoints, status, error, Size(21, 21), 3);
+
+        // Keep the tracks that are still on the relevant areas (a player may have come over them)
+        Rect frameArea(0, 0, currentFrame.mask.cols, currentFrame.mask.rows);
+        for ( size_t i = 0 ; i < points.size() ; i++ )
+        {
+            Point position(cvRound(nextPoints[i].x), cvRound(nextPoints[i].y));
+            if ( status[i] && frameArea.contains(position) && currentFrame.mask.at<uchar>(position) == 0 )
+            {
+                trackedPrevious.push_back(points[i]);
+                trackedCurrent.push_back(nextPoints[i]);
+            }
+        }
+    }
+
+    // The current frame is the previous frame of the next step
+    previousGray = currentGray;
+    points.clear();
+    if ( (int)trackedPrevious.size() < TRACKING_MIN_FIT_POINTS )
+    {
+        return Mat();
+    }
+
+    // RANSAC fit of the movement
+    Mat homography = estimateRigidTransform(trackedPrevious, trackedCurrent, false);
+    if ( homography.empty() )
+    {
+        return homography;
+    }
+
+    // The outliers (moving objects, bad tracks) are dropped
+    const double* h = homography.ptr<double>(0);
+    for ( size_t i = 0 ; i < trackedPrevious.size() ; i++ )
+    {
+        const Point2f& p = trackedPrevious[i];
+        Point2f expected(h[0] * p.x + h[1] * p.y + h[2], h[3] * p.x + h[4] * p.y + h[5]);
+        Point2f residual = trackedCurrent[i] - expected;
+        if ( residual.x * residual.x + residual.y * residual.y <= TRACKING_MAX_RESIDUAL * TRACKING_MAX_RESIDUAL )
+        {
+            points.push_back(trackedCurrent[i]);
+        }
+    }
+    return homography;
+}
 
 //*************************************************************************
-//                              STABILIZATION                             *
+//                             FRAME ANALYSIS                             *
 //*************************************************************************
 
+FrameAnalysis::FrameAnalysis()
+{
+    reset(Mat());
+}
+
+FrameAnalysis::FrameAnalysis(const Mat frame, int maskDownscale)
+{
+    reset(frame, maskDownscale);
+}
+
+void FrameAnalysis::reset(const Mat frame, int maskDownscale)
+{
+    this->frame = frame;
+    this->maskDownscale = maskDownscale;
+    hasReducedFrame = false;
+    hasGrassMask = false;
+    hasFieldMask = false;
+    hasPublicMask = false;
+    hasScoreMask = false;
+}
+
+const Mat& FrameAnalysis::getFrame() const
+{
+    return frame;
+}
+
+int FrameAnalysis::getMaskDownscale() const
+{
+    return maskDownscale;
+}
+
+const Mat& FrameAnalysis::getMaskFrame()
+{
+    if ( maskDownscale <= 1 )
+    {
+        return frame;
+    }
+    if ( !hasReducedFrame )
+    {
+        PROFILE_STAGE("mask downscale");
+        resize(frame, reducedFrame, Size(), 1. / maskDownscale, 1. / maskDownscale, INTER_AREA);
+        hasReducedFrame = true;
+    }
+    return reducedFrame;
+}
+
 /*
-Pre processing applied on frames before stabilization
-The goal is to enhance camera stabilization precision 
-by swipping away interference with the camera movement
-@param frame : the frame to process
-@return Mat: the frame processed
+The morphology sizes are tuned for the full resolution: at a lower resolution they are reduced,
+keeping at least a 3x3 element
 */
-Mat preProccessingStabilization(const Mat frame)
+int FrameAnalysis::scaledMorphologySize(int size) const
+{
+    if ( maskDownscale <= 1 || size == 0 )
+    {
+        return size;
+    }
+    return MAX(1, cvRound((double)size / maskDownscale));
+}
+
+const Mat& FrameAnalysis::getGrassMask()
 {
-    Mat mask = getMaskOfIrrelevantAreasForCameraStabilization(frame);
-    // Blur the areas of the mask
-    Mat blurredMask, blurredFrame, resultFrame = frame.clone();
-    blur(mask, blurredMask, Size(30, 30) );
-    blur(frame, blurredFrame, Size(30, 30) );
+    if ( !hasGrassMask )
+    {
+        detectGrass(getMaskFrame(), grassMask);
+        hasGrassMask = true;
+    }
+    return grassMask;
+}
 
-    for ( int y = 0 ; y < resultFrame.rows ; y++ )
+const Mat& FrameAnalysis::getFieldMask()
+{
+    if ( !hasFieldMask )
     {
-        for ( int x = 0 ; x < resultFrame.cols ; x++ )
+        getGrassMask().copyTo(fieldMask);
+        ////imshow( "maskGrass step 1/3", scaleGrayFrame(fieldMask , 2));
+
+        // Dilate to remove any left artefacts on the field (field lines)
         {
-            if ( blurredMask.at<uchar>(y, x) > 0 )
-            {
-               resultFrame.at<Vec3b>(y, x) = blurredFrame.at<Vec3b>(y, x);
-            }
+            PROFILE_STAGE("field dilation");
+            dilateMask(fieldMask, scaledMorphologySize(FIELD_MASK_DILATION_SIZE));
+        }
+        ////imshow( "maskGrass step 2/3", scaleGrayFrame(fieldMask , 2));
+
+        // Erode to clearly separate elements that are not part of the field (mostly players)
+        {
+            PROFILE_STAGE("field erosion");
+            erodeMask(fieldMask, scaledMorphologySize(FIELD_MASK_EROSION_SIZE));
         }
+        ////imshow( "maskGrass step 3/3", scaleGrayFrame(fieldMask , 2));
+        hasFieldMask = true;
     }
-    return resultFrame;
+    return fieldMask;
+}
+
+const Mat& FrameAnalysis::getPublicMask()
+{
+    if ( !hasPublicMask )
+    {
+        getGrassMask().copyTo(publicMask);
+        ////imshow("maskPublic step 1/4", scaleGrayFrame(publicMask, 2));
+
+        // Dilate to remove any left artefacts out the field (in the public)
+        {
+            PROFILE_STAGE("public erosion");
+            erodeMask(publicMask, scaledMorphologySize(PUBLIC_MASK_EROSION_SIZE));
+        }
+        ////imshow( "maskPublic step 2/4", scaleGrayFrame(publicMask , 2));
+
+        // Dilate to remove everything on the field
+        {
+            PROFILE_STAGE("public dilation");
+            dilateMask(publicMask, scaledMorphologySize(PUBLIC_MASK_DILATION_SIZE));
+        }
+        ////imshow( "maskPublic step 3/4", scaleGrayFrame(publicMask , 2));
+
+        // Inverting the mask: 255 - mask, in place
+        {
+            PROFILE_STAGE("public inversion");
+            bitwise_not(publicMask, publicMask);
+        }
+        ////imshow( "maskPublic step 4/4", scaleGrayFrame(publicMask , 2));
+        hasPublicMask = true;
+    }
+    return publicMask;
+}
+
+const Mat& FrameAnalysis::getScoreMask()
+{
+    if ( !hasScoreMask )
+    {
+        detectScoreOverlayPanel(frame, ownScoreMask);
+        scoreMask = ownScoreMask;
+        hasScoreMask = true;
+    }
+    return scoreMask;
+}
+
+void FrameAnalysis::setScoreMask(const Mat scoreMask)
+{
+    CV_Assert( scoreMask.size() == frame.size() && scoreMask.type() == CV_8U );
+    this->scoreMask = scoreMask;
+    hasScoreMask = true;
+}
+
+FrameAnalysis FrameAnalysis::bordered(const Mat borderedFrame, int borderWidth, int borderHeight)
+{
+    FrameAnalysis result;
+    bordered(borderedFrame, borderWidth, borderHeight, result);
+    return result;
 }
 
 /*
-The main stabilization method
-@param previousFrame : the previousFrame of the video
-@param currentFrame : the currentFrame of the video
-@return the stabilized image
+The grass detection is a per pixel test, and black pixels are not grass:
+the grass mask of the bordered frame is the grass mask of the frame with black borders.
+The score overlay is moved by the border as well.
+@param borderedFrame: the frame returned by addBlackBorder
+@param result: filled with the analysis of the bordered frame
 */
-Mat stabilize(const Mat previousFrame, const Mat currentFrame)
+void FrameAnalysis::bordered(const Mat borderedFrame, int borderWidth, int borderHeight, FrameAnalysis& result)
 {
-    // Add a black border (seems to give better results with it)
-    Mat currentFrameBordered = addBlackBorder(currentFrame, BORDER_WIDTH, BORDER_HEIGHT);
-    Mat previousFrameBordered = addBlackBorder(previousFrame, BORDER_WIDTH, BORDER_HEIGHT);
-    // Pre Process of frames
-    Mat processedPreviousFrame = preProccessingStabilization(previousFrameBordered);
-    Mat processedCurrentFrame = preProccessingStabilization(currentFrameBordered);
-    //imshow("processedFrame", (processedPreviousFrame, 4) );
-    //imshow("processedFrame", (processedCurrentFrame, 4) );
-    // Movement detection between the two frames
-    Mat homography = estimateRigidTransform(processedPreviousFrame, processedCurrentFrame, false);
-    // Apply the detected movement
-    Mat stabilizedFrame;
-    warpAffine(currentFrame, stabilizedFrame, homography, Size(currentFrame.cols, currentFrame.rows), INTER_NEAREST | WARP_INVERSE_MAP);
-    ////imshow("currentFrame", (currentFrame, 2) );
-    ////imshow("stabilizedFrame", (stabilizedFrame, 2) );
-    return stabilizedFrame;
+    result.reset(borderedFrame, maskDownscale);
+    addBlackBorder(getScoreMask(), borderWidth, borderHeight, result.ownScoreMask);
+    result.setScoreMask(result.ownScoreMask);
+    // The reduced frames are not aligned on the border: at a lower resolution the grass is detected again
+    if ( maskDownscale == 1 )
+    {
+        addBlackBorder(getGrassMask(), borderWidth, borderHeight, result.grassMask);
+        result.hasGrassMask = true;
+    }
+}
+
+FrameAnalysis FrameAnalysis::warped(const Mat warpedFrame, const Mat homography)
+{
+    FrameAnalysis result;
+    warped(warpedFrame, homography, result);
+    return result;
+}
+
+/*
+For the same reason, the grass mask of a frame moved by applyHomography() is the moved grass mask.
+The morphology does not commute with the movement, so the field and public masks are computed again.
+The score overlay does not move with the camera: it is kept as is.
+@param warpedFrame: the frame returned by applyHomography
+@param homography: the movement applied to the frame, empty if the frame was not moved
+@param result: filled with the analysis of the moved frame
+*/
+void FrameAnalysis::warped(const Mat warpedFrame, const Mat homography, FrameAnalysis& result)
+{
+    result.reset(warpedFrame, maskDownscale);
+    result.setScoreMask(getScoreMask());
+    if ( maskDownscale == 1 )
+    {
+        if ( homography.empty() )
+        {
+            getGrassMask().copyTo(result.grassMask);
+        }
+        else
+        {
+            applyHomography(getGrassMask(), homography, result.grassMask);
+        }
+        result.hasGrassMask = true;
+    }
+}
+
+void FrameAnalysis::getBuffers(vector<Mat>& buffers) const
+{
+    buffers.push_back(reducedFrame);
+    buffers.push_back(grassMask);
+    buffers.push_back(fieldMask);
+    buffers.push_back(publicMask);
+    buffers.push_back(ownScoreMask);
+}
+
+// The grass thresholds, and the lookup table built from them on first use
+static mutex grassMutex;
+static Scalar grassLower = GRASS_HSV_LOWER;
+static Scalar grassUpper = GRASS_HSV_UPPER;
+static shared_ptr<const GrassClassifier> grassClassifier;
+
+/*
+@return the lookup table of the current thresholds, built if needed.
+The table is shared by the threads and never modified: new thresholds give a new table
+*/
+static shared_ptr<const GrassClassifier> getGrassClassifier()
+{
+    lock_guard<mutex> lock(grassMutex);
+    if ( !grassClassifier )
+    {
+        PROFILE_STAGE("grass table");
+        shared_ptr<GrassClassifier> classifier = make_shared<GrassClassifier>();
+        classifier->setThresholds(grassLower, grassUpper);
+        grassClassifier = classifier;
+    }
+    return grassClassifier;
+}
+
+/*
+Change the HSV bounds of the grass, the lookup table is built again on next use
+@param lower, upper: inclusive bounds, as given to inRange()
+*/
+void setGrassThresholds(const Scalar& lower, const Scalar& upper)
+{
+    lock_guard<mutex> lock(grassMutex);
+    if ( lower != grassLower || upper != grassUpper )
+    {
+        grassLower = lower;
+        grassUpper = upper;
+        grassClassifier.reset();
+    }
+}
+
+void getGrassThresholds(Scalar& lower, Scalar& upper)
+{
+    lock_guard<mutex> lock(grassMutex);
+    lower = grassLower;
+    upper = grassUpper;
 }
 
 /*
 Detect... the grass. based on color.
 Might not properly work if the players are green
+Same result as converting the frame to HSV and thresholding it with inRange(), in a single pass
+on the BGR frame with a lookup table
 param frame: the frame to compute
 @return mask of the field
 */
 Mat detectGrass(const Mat frame)
 {
-    Mat HSV;
-    Mat threshold;
-    cvtColor(frame, HSV, CV_BGR2HSV);
-    inRange(HSV, Scalar(35, 50, 100), Scalar(70, 255, 200), threshold);
-    ////imshow("thr", scaleGrayFrame(threshold, 2));
-    return threshold;
+    Mat grass;
+    detectGrass(frame, grass);
+    return grass;
+}
+
+/*
+Same as above, into a mask given by the caller
+@param grass: filled with the mask of the field
+*/
+void detectGrass(const Mat frame, Mat& grass)
+{
+    shared_ptr<const GrassClassifier> classifier = getGrassClassifier();
+    PROFILE_STAGE("grass classification");
+    classifier->classify(frame, grass);
 }
 
 /*
-TODO : use a smart algorithm instead (panelDetector() method)
 Manually creates the perfect match for France-Sweden match sample
+Default panel, used until a ScoreOverlayDetector found the overlay of the video (--detect-overlay)
 */
 Mat detectScoreOverlayPanel(const Mat frame, int height_offset/* = 0*/, int width_offset/* = 0*/)
 {
-    Mat mask = cv::Mat::zeros(frame.rows, frame.cols, CV_8U);
-    mask(Rect(80 + height_offset, 40 + width_offset, 290, 40)) = 255;
+    Mat mask;
+    detectScoreOverlayPanel(frame, mask, height_offset, width_offset);
     ////imshow("info layer mask", mask);
     return mask;
 }
 
+/*
+Same as above, into a mask given by the caller
+*/
+void detectScoreOverlayPanel(const Mat frame, Mat& mask, int height_offset/* = 0*/, int width_offset/* = 0*/)
+{
+    mask.create(frame.rows, frame.cols, CV_8U);
+    mask.setTo(Scalar(0));
+    mask(Rect(80 + height_offset, 40 + width_offset, 290, 40)) = 255;
+}
+
 /*
 @return the mask of areas to not use for camera stabilization
 
@@ -102,62 +1323,62 @@ The mask includes:
 */
 Mat getMaskOfIrrelevantAreasForCameraStabilization(const Mat frame)
 {
-    Mat maskGrass = detectGrass(frame);
-    ////imshow( "maskGrass step 1/3", scaleGrayFrame(maskGrass , 2));
-
-    // Dilate to remove any left artefacts on the field (field lines)
-    dilateMask(maskGrass, FIELD_MASK_DILATION_SIZE);
-    ////imshow( "maskGrass step 2/3", scaleGrayFrame(maskGrass , 2));
-
-    // Erode to clearly separate elements that are not part of the field (mostly players)
-    erodeMask(maskGrass, FIELD_MASK_EROSION_SIZE);
-    ////imshow( "maskGrass step 3/3", scaleGrayFrame(maskGrass , 2));
-
-    Mat maskPublic = detectGrass(frame);
-    ////imshow("maskPublic step 1/4", scaleGrayFrame(maskPublic, 2));
-
-    // Dilate to remove any left artefacts out the field (in the public)
-    erodeMask(maskPublic, PUBLIC_MASK_EROSION_SIZE);
-    ////imshow( "maskPublic step 2/4", scaleGrayFrame(maskPublic , 2));
+    // The frame is bordered: so is the panel
+    FrameAnalysis analysis(frame);
+    analysis.setScoreMask(detectScoreOverlayPanel(frame, BORDER_HEIGHT/2, BORDER_WIDTH/2));
+    return getMaskOfIrrelevantAreasForCameraStabilization(analysis);
+}
 
-    // Dilate to remove everything on the field
-    dilateMask(maskPublic, PUBLIC_MASK_DILATION_SIZE);
-    ////imshow( "maskPublic step 3/4", scaleGrayFrame(maskPublic , 2));
+/*
+Same as above, reusing the grass, public and score masks of the frame analysis
+@param analysis: the analysis of the frame
+*/
+Mat getMaskOfIrrelevantAreasForCameraStabilization(FrameAnalysis& analysis)
+{
+    Mat finalMask;
+    getMaskOfIrrelevantAreasForCameraStabilization(analysis, finalMask);
+    return finalMask;
+}
 
-    // Inverting the mask
-    maskPublic = 255 - maskPublic;
-    ////imshow( "maskPublic step 4/4", scaleGrayFrame(maskPublic , 2));
+/*
+Same as above, into a mask given by the caller
+@param finalMask: filled with the mask
+*/
+void getMaskOfIrrelevantAreasForCameraStabilization(FrameAnalysis& analysis, Mat& finalMask)
+{
+    const Mat frame = analysis.getFrame();
+    Mat maskGrass = analysis.getFieldMask();
+    Mat maskPublic = analysis.getPublicMask();
 
-    Mat maskScore = detectScoreOverlayPanel(frame, BORDER_HEIGHT/2, BORDER_WIDTH/2);
-    
-    // We use those three masks to create the final mask
-    Mat finalMask = cv::Mat::zeros(frame.rows, frame.cols, CV_8U);
-    for ( int y = 0 ; y < frame.rows ; y++ )
+    Mat maskScore;
     {
-        for ( int x = 0 ; x < frame.cols ; x++ )
+        PROFILE_STAGE("camera mask composition");
+        maskScore = analysis.getScoreMask();
+    
+        // We use those three masks to create the final mask:
+        // add everything that is not grass, remove the public, add infosLayer mask
+        if ( maskGrass.size() == frame.size() )
         {
-            // add everything that is not grass
-            if ( maskGrass.at<uchar>(y, x) < 10 )
-            {
-                finalMask.at<uchar>(y, x) = 255;
-            }
-
-            // Remove the public 
-            if ( maskPublic.at<uchar>(y, x) > 250 )
-            {
-                finalMask.at<uchar>(y, x) = 0;
-            }
-
-            // Add infosLayer mask
-            if ( maskScore.at<uchar>(y, x) > 250 )
-            {
-                finalMask.at<uchar>(y, x) = 255;
-            }
+            composeCameraStabilizationMask(maskGrass, maskPublic, maskScore, finalMask);
+        }
+        else
+        {
+            // Reduced masks: composed at their resolution, upsampled, then the score panel is added at full resolution
+            Mat reducedMask;
+            composeCameraStabilizationMask(maskGrass, maskPublic, cv::Mat::zeros(maskGrass.size(), CV_8U), reducedMask);
+            resize(reducedMask, finalMask, frame.size(), 0, 0, INTER_NEAREST);
+            bitwise_or(finalMask, maskScore, finalMask);
         }
     }
     //imshow("final mask camstab", scaleGrayFrame(finalMask,3));
 
+#ifdef DISPLAY_MASKS
     // Visualization    
+    if ( maskGrass.size() != frame.size() )
+    {
+        resize(maskGrass, maskGrass, frame.size(), 0, 0, INTER_NEAREST);
+        resize(maskPublic, maskPublic, frame.size(), 0, 0, INTER_NEAREST);
+    }
     Mat displayFrame = frame.clone();
     for ( int y = 0 ; y < displayFrame.rows ; y++ )
     {
@@ -188,7 +1409,7 @@ Mat getMaskOfIrrelevantAreasForCameraStabilization(const Mat frame)
         }
     }
     //imshow("displayFrame", (displayFrame, 2));
-    return finalMask;
+#endif
 }
 
 /*
@@ -201,50 +1422,63 @@ The mask includes:
 */
 Mat getMaskOfIrrelevantAreasForSingularities(const Mat frame)
 {
-    Mat maskPublic = detectGrass(frame);
-    ////imshow("maskPublic step 1/4", scaleGrayFrame(maskPublic, 2));
+    FrameAnalysis analysis(frame);
+    return getMaskOfIrrelevantAreasForSingularities(analysis);
+}
 
-    // Dilate to remove any left artefacts out the field (in the public)
-    erodeMask(maskPublic, PUBLIC_MASK_EROSION_SIZE);
-    ////imshow( "maskPublic step 2/4", scaleGrayFrame(maskPublic , 2));
+/*
+Same as above, reusing the public and score masks of the frame analysis
+@param analysis: the analysis of the frame
+*/
+Mat getMaskOfIrrelevantAreasForSingularities(FrameAnalysis& analysis)
+{
+    Mat finalMask;
+    getMaskOfIrrelevantAreasForSingularities(analysis, finalMask);
+    return finalMask;
+}
 
-    // Dilate to remove everything on the field
-    dilateMask(maskPublic, PUBLIC_MASK_DILATION_SIZE);
-    ////imshow( "maskPublic step 3/4", scaleGrayFrame(maskPublic , 2));
+/*
+Same as above, into a mask given by the caller
+@param finalMask: filled with the mask (written in place when it has the size of the frame)
+*/
+/*
+The border band of the singularity mask only depends on the resolution: built once per thread,
+and again only when the resolution changes
+@param size: the frame size
+@return the mask of the borders
+*/
+static const Mat& getSingularityBorderMask(Size size)
+{
+    static thread_local Mat maskBorders;
+    if ( maskBorders.size() != size )
+    {
+        maskBorders = getBorderMask(size.height, size.width, SINGULARITY_MASK_BORDER);
+    }
+    return maskBorders;
+}
 
-    // Inverting the mask
-    maskPublic = 255 - maskPublic;
-    //imshow( "maskPublic step 4/4", scaleGrayFrame(maskPublic , 2));
+void getMaskOfIrrelevantAreasForSingularities(FrameAnalysis& analysis, Mat& finalMask)
+{
+    const Mat frame = analysis.getFrame();
+    Mat maskPublic = analysis.getPublicMask();
+    if ( maskPublic.size() != frame.size() )
+    {
+        resize(maskPublic, maskPublic, frame.size(), 0, 0, INTER_NEAREST);
+    }
 
-    Mat maskScore = detectScoreOverlayPanel(frame);
-    Mat maskBorders = getBorderMask(frame.rows, frame.cols, SINGULARITY_MASK_BORDER);
-    // We use those  masks to create the final mask
-    Mat finalMask = cv::Mat::zeros(frame.rows, frame.cols, CV_8U);
-    for ( int y = 0 ; y < frame.rows ; y++ )
+    Mat maskScore;
+    const Mat& maskBorders = getSingularityBorderMask(frame.size());
     {
-        for ( int x = 0 ; x < frame.cols ; x++ )
-        {
-            // Add the public 
-            if ( maskPublic.at<uchar>(y, x) > 250 )
-            {
-                finalMask.at<uchar>(y, x) = 255;
-            }
-            // Add infosLayer mask
-            if ( maskScore.at<uchar>(y, x) > 250 )
-            {
-                finalMask.at<uchar>(y, x) = 255;
-            }
-            // Add infosLayer mask
-            if ( maskBorders.at<uchar>(y, x) > 250 )
-            {
-                finalMask.at<uchar>(y, x) = 255;
-            }
-        }
+        PROFILE_STAGE("singularity mask composition");
+        maskScore = analysis.getScoreMask();
+        // We use those  masks to create the final mask: add the public, the infosLayer and the borders
+        composeSingularityMask(maskPublic, maskScore, maskBorders, finalMask);
     }
 
     // TODO: add some kind of borders ?
     ////imshow("final mask", finalMask);
 
+#ifdef DISPLAY_MASKS
     // Visualisation    
     Mat displayFrame = frame.clone();
     for ( int y = 0 ; y < displayFrame.rows ; y++ )
@@ -278,122 +1512,32 @@ Mat getMaskOfIrrelevantAreasForSingularities(const Mat frame)
         }
     }
     //imshow("mask singularities display", (displayFrame, 2));
-    return finalMask;
+#endif
 }
 
 
-
-/*
-Status : WIP
-
-delete all pixels that have moved between the two frames
-IMPORTANT: the two frames must have the same dimension
-EVEN MORE IMPORTANT: if the info layer is not perfectly opaque, might give terrible results
-@param previousFrame : the previousFrame of the video (COLOR)
-@param currentFrame : the currentFrame of the video (COLOR)
-
-@return the processed image
-*/
-/*
-Mat panelDetector(Mat previousFrame, Mat currentFrame)
-{
-    // The sensibility of the thing. Between 0-255
-    // Even the panel pixels changes a bit so better not put a 0 here.
-    const int SENSIBILITY = 20;
-
-    // Black and white matrices
-    Mat bw_previousFrame, bw_currentFrame;
-    Mat processedFrame = currentFrame.clone();
-
-    cvtColor(previousFrame, bw_previousFrame, CV_BGR2GRAY);
-    cvtColor(currentFrame, bw_currentFrame, CV_BGR2GRAY);
-
-
-    // Black & White method: 30ms on my laptop, might take a few seconds to identify the panel area
-    /*for (int y = 0 ; y < bw_currentFrame.rows ; y++)
-    {
-        for (int x = 0 ; x < bw_currentFrame.cols ; x++)
-        {
-            // TODO: a mask ? so we don't go back twice on the same *bip*
-
-           // if( bw_currentFrame.at<uchar>(y, x) != 0 )
-            {
-                // If the pixel value has changed A LOT, it's moving !
-                // TODO: maybe KEEP the PREVIOUS value or return the PREVIOUS frame just to be sure it's not changing ?
-                if ( (bw_currentFrame.at<uchar>(y, x) < bw_previousFrame.at<uchar>(y, x)-SENSIBILITY)
-                    ||  bw_currentFrame.at<uchar>(y, x) > bw_previousFrame.at<uchar>(y, x)+SENSIBILITY )
-                {
-                    // We delete it. On the colour frame
-                    currentFrame.at<Vec3b>(y,x) = Vec3b(0,0,0);
-                }
-            }
-        }
-    }
-
-    // Color method
-    for ( int y = 0 ; y < currentFrame.rows ; y++ )
-    {
-        for ( int x = 0 ; x < currentFrame.cols ; x++ )
-        {
-            // TODO: a mask ? so we don't go back twice on the same *bip*
-            // if(bw_currentFrame.at<uchar>(y, x) != 0)
-            {
-                // If the pixel value has changed
-                if ( (currentFrame.at<Vec3b>(y, x)[0] < previousFrame.at<Vec3b>(y, x)[0] - SENSIBILITY)
-                        ||  currentFrame.at<Vec3b>(y, x)[0] > previousFrame.at<Vec3b>(y, x)[0] + SENSIBILITY )
-                {
-                    // We delete it. On the colour frame
-                    currentFrame.at<Vec3b>(y, x) = Vec3b(0, 0, 0);
-                }
-
-                // If the pixel value has changed
-                else if ( (currentFrame.at<Vec3b>(y, x)[1] < previousFrame.at<Vec3b>(y, x)[1] - SENSIBILITY)
-                          ||  currentFrame.at<Vec3b>(y, x)[1] > previousFrame.at<Vec3b>(y, x)[1] + SENSIBILITY )
-                {
-                    // We delete it. On the colour frame
-                    currentFrame.at<Vec3b>(y, x) = Vec3b(0, 0, 0);
-                }
-
-                // If the pixel value has changed
-                else if ( (currentFrame.at<Vec3b>(y, x)[2] < previousFrame.at<Vec3b>(y, x)[2] - SENSIBILITY)
-                          ||  currentFrame.at<Vec3b>(y, x)[2] > previousFrame.at<Vec3b>(y, x)[2] + SENSIBILITY )
-                {
-                    // We delete it. On the colour frame
-                    currentFrame.at<Vec3b>(y, x) = Vec3b(0, 0, 0);
-                }
-            }
-        }
-    }
-    return currentFrame;
-}*/
-
-
 //*************************************************************************
 //                                  UTILS                                 *
 //*************************************************************************
 
 /*
+Same as erode() with a (2 * erosionSize + 1) MORPH_RECT element, at a cost independent of its size
 @param mask : the mask to erode
 @param erosionSize : the size of the erosion
 */
 void erodeMask(Mat& mask, int erosionSize)
 {
-    int erosion_type = MORPH_RECT;
-    Mat erode_element = getStructuringElement( erosion_type, Size( 2 * erosionSize + 1, 2 * erosionSize + 1 ),
-                        Point( erosionSize, erosionSize ) );
-    erode( mask, mask, erode_element );
+    erodeRectangle(mask, mask, erosionSize);
 }
 
 /*
+Same as dilate() with a (2 * dilationSize + 1) MORPH_RECT element, at a cost independent of its size
 @param mask: the mask to dilate
 @param dilationSize: the size of the dilation
 */
 void dilateMask(Mat& mask, int dilationSize)
 {
-    int dilation_type = MORPH_RECT;
-    Mat dilate_element = getStructuringElement( dilation_type, Size( 2 * dilationSize + 1, 2 * dilationSize + 1 ),
-                         Point( dilationSize, dilationSize ) );
-    dilate( mask, mask, dilate_element );
+    dilateRectangle(mask, mask, dilationSize);
 }
 
 /*
@@ -422,12 +1566,23 @@ wrap the frame in a bigger frame with margins
 Mat addBlackBorder(Mat frame, int borderWidth, int borderHeight)
 {
     Mat borderFrame;
-    Size frameSize(static_cast<int>(frame.cols + borderWidth), static_cast<int>(frame.rows + borderHeight));
-    borderFrame = Mat::zeros(frameSize, frame.type());
-    frame.copyTo(borderFrame(Rect(borderWidth / 2, borderWidth / 2, frame.cols, frame.rows)));
+    addBlackBorder(frame, borderWidth, borderHeight, borderFrame);
     return borderFrame;
 }
 
+/*
+Same as above, into a frame given by the caller
+@param borderedFrame: filled with the bordered frame (not sharing the data of the frame)
+*/
+void addBlackBorder(const Mat frame, int borderWidth, int borderHeight, Mat& borderedFrame)
+{
+    PROFILE_STAGE("border addition");
+    // The frame is at (borderWidth / 2, borderWidth / 2). Isolated: a ROI does not take the pixels of its parent
+    const int offset = borderWidth / 2;
+    copyMakeBorder(frame, borderedFrame, offset, borderHeight - offset, offset, borderWidth - offset,
+                   BORDER_CONSTANT | BORDER_ISOLATED, Scalar::all(0));
+}
+
 /*
 Add axis to the frame
 @param frame: the frame to draw an
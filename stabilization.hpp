@@ -3,6 +3,9 @@ Maxime Touroute
 28 July 2015
 */
 
+#ifndef STABILIZATION_HPP
+#define STABILIZATION_HPP
+
 // OpenCV libs
 #include <opencv2/video/tracking.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -14,12 +17,19 @@ Maxime Touroute
 #include <stdio.h>
 #include <string>
 #include <sstream>
+#include <climits>
+
+#include "shot.hpp"
 
 
 // Black borders constants
 #define BORDER_WIDTH 60
 #define BORDER_HEIGHT 60
 
+// HSV bounds of the grass (inclusive, as given to inRange())
+#define GRASS_HSV_LOWER Scalar(35, 50, 100)
+#define GRASS_HSV_UPPER Scalar(70, 255, 200)
+
 // Parameters of the stabilization mask
 #define FIELD_MASK_DILATION_SIZE 1
 #define FIELD_MASK_EROSION_SIZE 5
@@ -29,26 +39,323 @@ Maxime Touroute
 // Parameters of the singularity mask
 #define SINGULARITY_MASK_BORDER 80
 
+// Parameters of the keyframe movement detection
+#define KEYFRAME_MIN_INTERVAL 2         // adaptive mode: shortest interval between two keyframes
+#define KEYFRAME_STABLE_ERROR 1.        // adaptive mode: prediction error (px) under which the interval grows
+#define KEYFRAME_UNSTABLE_ERROR 4.      // adaptive mode: prediction error (px) over which the interval is halved
+#define KEYFRAME_RESIDUAL_DOWNSCALE 4   // the residual check compares frames reduced this many times
+#define KEYFRAME_RESIDUAL_RATIO 1.5     // a residual over this many times the one of the last keyframe...
+#define KEYFRAME_RESIDUAL_MARGIN 2.     // ...plus this margin (gray levels) forces a keyframe
+
+// Parameters of the pyramid movement detection
+#define PYRAMID_COARSE_LEVEL 3          // coarse detection at 1/8 of the resolution
+#define PYRAMID_FINEST_LEVEL 1          // refined up to 1/2 of the resolution
+#define PYRAMID_REFINEMENT_POINTS 150   // points tracked on the grass at each refinement level
+#define PYRAMID_MIN_REFINEMENT_POINTS 20
+
+// Parameters of the feature tracking movement detection
+#define TRACKING_MAX_POINTS 300         // corners detected on the relevant areas
+#define TRACKING_MIN_POINTS 120         // detect new corners below this number of tracks
+#define TRACKING_MIN_FIT_POINTS 20      // fall back to estimateRigidTransform on the frames below
+#define TRACKING_MAX_RESIDUAL 2.0       // tracks further than this from the fitted movement are dropped (pixels)
+
 
 using namespace cv;
 using namespace std;
 
 
+class FrameAnalysis;
+
 void drawAxis(Mat& frame);
 Mat scaleGrayFrame(Mat frame, int scale);
 Mat scaleColorFrame(Mat frame, int scale);
 
 Mat getBorderMask(const int rows, const int cols, const int borderSize);
 Mat addBlackBorder(Mat frame, int borderWidth, int borderHeight);
+void addBlackBorder(const Mat frame, int borderWidth, int borderHeight, Mat& borderedFrame);
 Mat preProccessingStabilization(const Mat frame);
+Mat preProccessingStabilization(const Mat frame, Mat& mask);
+Mat preProccessingStabilization(FrameAnalysis& analysis, Mat& mask);
+void preProccessingStabilization(FrameAnalysis& analysis, Mat& mask, Mat& resultFrame);
 Mat stabilize(const Mat previousFrame, const Mat currentFrame);
+Mat applyHomography(const Mat frame, const Mat homography);
+Mat applyHomography(const Mat frame, const Mat homography, Size outputSize);
+void applyHomography(const Mat frame, const Mat homography, Mat& stabilizedFrame);
 
 void erodeMask(Mat& mask, int erosionSize);
 void dilateMask(Mat& mask, int dilationSize);
 Mat detectGrass(const Mat frame);
+void detectGrass(const Mat frame, Mat& grass);
+void setGrassThresholds(const Scalar& lower, const Scalar& upper);
+void getGrassThresholds(Scalar& lower, Scalar& upper);
 
 Mat detectScoreOverlayPanel(const Mat frame, int height_offset = 0, int width_offset = 0);
+void detectScoreOverlayPanel(const Mat frame, Mat& mask, int height_offset = 0, int width_offset = 0);
 Mat getMaskOfIrrelevantAreasForCameraStabilization(const Mat frame);
+Mat getMaskOfIrrelevantAreasForCameraStabilization(FrameAnalysis& analysis);
+void getMaskOfIrrelevantAreasForCameraStabilization(FrameAnalysis& analysis, Mat& finalMask);
 Mat getMaskOfIrrelevantAreasForSingularities(const Mat frame);
+Mat getMaskOfIrrelevantAreasForSingularities(FrameAnalysis& analysis);
+void getMaskOfIrrelevantAreasForSingularities(FrameAnalysis& analysis, Mat& finalMask);
+
+
+/*
+Analysis of a frame shared by the masks.
+The grass mask and the masks derived from it are computed once, on first use.
+With a mask downscale factor, they are computed on the frame reduced by this factor,
+with the morphology sizes reduced as well: only the final masks are at the frame resolution.
+An analysis can be reset to another frame: the masks are then computed in the buffers of the previous one.
+*/
+class FrameAnalysis
+{
+public:
+    FrameAnalysis();
+    explicit FrameAnalysis(const Mat frame, int maskDownscale = 1);
+
+    // Analyse another frame, reusing the buffers of the masks (they must not be shared with another analysis)
+    void reset(const Mat frame, int maskDownscale = 1);
+
+    const Mat& getFrame() const;
+    int getMaskDownscale() const;
+    // detectGrass() of the frame
+    const Mat& getGrassMask();
+    // Grass mask without the field lines and the players
+    const Mat& getFieldMask();
+    // Inverted grass mask without the field (255 on the public)
+    const Mat& getPublicMask();
+    // Score overlay of the frame (255 on the overlay): the detected one if given, detectScoreOverlayPanel() otherwise
+    const Mat& getScoreMask();
+    // Use a detected overlay (frame resolution) instead of the default panel
+    void setScoreMask(const Mat scoreMask);
+
+    // Analysis of the frame wrapped by addBlackBorder(), reusing the grass and score masks
+    FrameAnalysis bordered(const Mat borderedFrame, int borderWidth, int borderHeight);
+    void bordered(const Mat borderedFrame, int borderWidth, int borderHeight, FrameAnalysis& result);
+    // Analysis of the frame moved by applyHomography(), reusing the grass and score masks
+    FrameAnalysis warped(const Mat warpedFrame, const Mat homography);
+    void warped(const Mat warpedFrame, const Mat homography, FrameAnalysis& result);
+
+    // Add the buffers of the masks to the list (to check that they are reused)
+    void getBuffers(vector<Mat>& buffers) const;
+
+private:
+    // The frame, reduced by the mask downscale factor
+    const Mat& getMaskFrame();
+    // Size of a morphology element at the resolution of the masks
+    int scaledMorphologySize(int size) const;
+
+    int maskDownscale;
+    Mat frame;
+    Mat reducedFrame;
+    Mat grassMask;
+    Mat fieldMask;
+    Mat publicMask;
+    Mat scoreMask;      // the default panel (in ownScoreMask) or the mask given to setScoreMask()
+    Mat ownScoreMask;
+    // The results computed for this frame: the others may hold the results of the previous frame
+    bool hasReducedFrame;
+    bool hasGrassMask;
+    bool hasFieldMask;
+    bool hasPublicMask;
+    bool hasScoreMask;
+};
+
+// Movement detection methods
+enum EstimationMode
+{
+    ESTIMATION_FULL,    // estimateRigidTransform on the full resolution frames
+    ESTIMATION_PYRAMID, // coarse estimateRigidTransform on a reduced frame, refined on the grass of finer levels
+    ESTIMATION_TRACKING // corners tracked from frame to frame, detected again only when too many are lost
+};
+
+// Work done per frame by Stabilizer::stabilize(frame, output), from the best to the cheapest
+enum QualityLevel
+{
+    QUALITY_FULL,               // masks and movement detection on every frame
+    QUALITY_REDUCED_MASKS,      // masks computed on frames reduced QUALITY_MASK_DOWNSCALE times more
+    QUALITY_REUSED_MASKS,       // mask of the previous frame: no mask computed
+    QUALITY_REUSED_TRANSFORM    // mask and movement of the previous frame: no movement detection
+};
+#define QUALITY_LEVELS 4
+#define QUALITY_MASK_DOWNSCALE 2
+
+/*
+Parameters of a Stabilizer
+*/
+struct StabilizerSettings
+{
+    EstimationMode estimationMode;
+    int maskDownscale;  // the masks are computed on frames reduced by this factor (1 for the full resolution)
+    bool detectOverlay; // find the score overlay with a ScoreOverlayDetector instead of using the default panel
+    double deadline;    // real-time mode: stabilization budget of a frame in ms, 0 to disable
+    int keyframeInterval;   // keyframe mode: the movement is detected every N frames and predicted in between (0 to disable)
+    bool adaptiveKeyframes; // keyframe mode: the interval follows the prediction error, keyframeInterval at most
+    bool detectCuts;        // classify each frame with a ShotDetector: no movement detection across cuts and off the pitch
+
+    StabilizerSettings();
+};
+
+/*
+Everything computed on a frame before the movement detection.
+A frame is the "current" frame at step N and the "previous" frame at step N+1,
+so this is computed once and carried forward by the Stabilizer.
+*/
+struct PreparedFrame
+{
+    Mat frame;              // the original frame
+    FrameAnalysis analysis; // analysis of the original frame
+    Mat borderedFrame;      // the frame wrapped in black borders
+    FrameAnalysis borderedAnalysis; // analysis of the bordered frame
+    Mat mask;               // mask of irrelevant areas for camera stabilization (bordered)
+    Mat processedFrame;     // the bordered frame with the irrelevant areas blurred
+    vector<Mat> pyramid;    // gray pyramid of the processed frame (pyramid detection only)
+};
+
+PreparedFrame prepareFrame(const Mat frame, int maskDownscale = 1, const Mat scoreMask = Mat());
+void prepareFrame(const Mat frame, PreparedFrame& prepared, int maskDownscale = 1, const Mat scoreMask = Mat());
+void prepareFrameWithMask(const Mat frame, PreparedFrame& prepared, const Mat mask, int maskDownscale = 1, const Mat scoreMask = Mat());
+Mat estimatePyramidTransform(PreparedFrame& previousFrame, PreparedFrame& currentFrame);
+Mat getRelevantAreaForCameraStabilization(const Mat mask);
+
+/*
+Sparse corners tracked from one frame to the next with a pyramidal Lucas-Kanade.
+The corners are taken on the relevant areas for camera stabilization, and detected again
+only when too many tracks are lost: most frames skip the detection.
+*/
+class FeatureTracker
+{
+public:
+    FeatureTracker();
+
+    void reset();
+
+    // Track the corners from the previous frame to the current one
+    // @return the movement fitted on the tracks, or an empty Mat if there are not enough of them
+    Mat track(const PreparedFrame& previousFrame, const PreparedFrame& currentFrame);
+
+    int getTrackCount() const;
+
+private:
+    void detectCorners(const PreparedFrame& frame);
+
+    Mat previousGray;
+    vector<Point2f> points; // positions of the tracks in previousGray
+};
+
+/*
+Keyframe movement detection: the movement is only detected between keyframes. The frames in between
+are moved by the per frame movement of the last keyframe interval (its movement divided by its length),
+and the movement of a keyframe corrects the predictions made since the previous one, so that the chained
+movements are the detected ones at every keyframe. A cheap residual check (the difference between
+reduced frames once moved) forces a keyframe as soon as the prediction no longer fits the frames.
+*/
+struct KeyframeState
+{
+    PreparedFrame reference;    // the last keyframe, with its own buffers
+    Mat movement;               // predicted movement of every frame after the last keyframe (3x3), empty if unknown
+    Mat predicted;              // chained predictions since the last keyframe (3x3)
+    int framesSinceKeyframe;
+    int interval;               // frames between two keyframes
+    Mat previousSmall;          // reduced gray previous frame, for the residual check
+    Mat currentSmall;
+    double baseline;            // residual of the last keyframe
+    int keyframes;
+    int forcedKeyframes;        // keyframes forced by the residual check
+
+    KeyframeState();
+};
+
+/*
+Buffers of a Stabilizer for one resolution, reused from one frame to the next
+*/
+struct StabilizerBuffers
+{
+    Size frameSize;
+    PreparedFrame frames[2];            // the current frame is prepared in one, the other is the previous frame
+    int current;
+    FrameAnalysis stabilizedAnalysis;
+    int reallocations;                  // buffers that moved after their first allocation
+    vector<const uchar*> addresses;     // data of every buffer after the last frame
+    vector<Mat> collected;
+    int settling;                       // frames not checked: the buffers take the sizes of a new quality level
+
+    StabilizerBuffers();
+
+    // Count the buffers whose data moved since the last call
+    void checkReallocations(const Mat& output, const uchar* given);
+};
+
+/*
+Stateful stabilization of a video, frame after frame.
+Keeps the prepared previous frame so that each frame is only pre processed once.
+*/
+class Stabilizer
+{
+public:
+    Stabilizer(const StabilizerSettings& settings = StabilizerSettings());
+
+    // Forget the previous frame (new video, cut...)
+    void reset();
+    bool hasPreviousFrame() const;
+
+    // Use this frame as the previous frame of the next call to stabilize()
+    void setReferenceFrame(const Mat frame);
+
+    // Stabilize the frame against the previous one, then keep it as the new previous frame.
+    // Without any previous frame, the frame is kept and returned as is.
+    Mat stabilize(const Mat currentFrame);
+    Mat stabilize(const PreparedFrame& currentFrame);
+    // Same as above, into a frame given by the caller (not the current frame). Every intermediate result
+    // is computed in buffers kept from one frame to the next: once they have the size of the frames,
+    // no buffer is allocated. The only heap allocations left are inside OpenCV: estimateRigidTransform()
+    // (its points and the movement it returns), and warpAffine() for the movements with a rotation
+    // (./Benchmark buffers counts them)
+    void stabilize(const Mat currentFrame, Mat& stabilizedFrame, const Mat scoreMask = Mat());
+    // Same as stabilize(), without moving the frame: returns the detected movement.
+    // Every stabilize() counts its frame in the profiling, estimate() does not: its caller does
+    Mat estimate(const PreparedFrame& currentFrame);
+
+    // Relation of the last frame with the previous one (SHOT_CONTINUOUS when the cuts are not detected)
+    ShotTransition getLastShot() const;
+
+    // Keyframe mode: frames whose movement was detected, and the ones forced by the residual check
+    int getKeyframeCount() const;
+    int getForcedKeyframeCount() const;
+    int getKeyframeInterval() const;
+
+    // Work done by the next calls to stabilize(frame, output) (QUALITY_FULL by default)
+    void setQualityLevel(QualityLevel level);
+    QualityLevel getQualityLevel() const;
+
+    // The movement detected by the last call to stabilize()
+    Mat getLastHomography() const;
+    // Tracks used by the last detection (tracking detection only)
+    int getTrackCount() const;
+    // Analysis of the frame returned by the last call to stabilize()
+    FrameAnalysis& getStabilizedFrameAnalysis();
+    // The last prepared frame: the previous frame of the next step
+    const PreparedFrame& getPreviousFrame() const;
+    // Buffers of stabilize(frame, output) reallocated after their first allocation (0 expected)
+    int getReallocationCount() const;
+
+private:
+    bool checkShot(const Mat currentFrame);
+    bool needsKeyframe(const Mat currentFrame);
+    Mat estimateKeyframe(const PreparedFrame& currentFrame);
+    Mat predictMovement();
+
+    StabilizerSettings settings;
+    PreparedFrame previous;
+    FeatureTracker tracker;
+    bool hasPrevious;
+    Mat lastHomography;
+    FrameAnalysis stabilizedAnalysis;
+    StabilizerBuffers buffers;
+    bool buffered;  // the last frame was stabilized in the buffers
+    QualityLevel quality;
+    KeyframeState keyframes;
+    ShotDetector shots;
+    ShotTransition lastShot;
+};
 
-// Mat panelDetector(Mat previousFrame, Mat currentFrame); WIP
\ No newline at end of file
+#endif
@@ -0,0 +1,202 @@
+/*
+Stabilization of several video streams at once.
+*/
+
+#include "streams.hpp"
+#include "overlay.hpp"
+#include "realtime.hpp"
+#include "taskpool.hpp"
+
+#include <algorithm>
+
+
+// Framerate of the exported streams when the container does not give it
+#define STREAM_DEFAULT_FRAMERATE 25
+
+
+/*
+Stabilization context of a stream: only used by the task of its next frame
+*/
+struct StreamContext
+{
+    string input;
+    string output;
+    VideoCapture capture;
+    VideoWriter writer;
+    Stabilizer stabilizer;
+    ScoreOverlayDetector overlay;
+    QualityController quality;  // real-time mode only
+    Mat stabilizedFrame;    // kept from one frame to the next: the stabilizer writes in the same buffer
+    vector<double> latencies;
+    double submitTime;
+    double endTime;
+    bool opened;
+    bool failed;
+};
+
+/*
+@return the current time in ms
+*/
+static double now()
+{
+    return (double)cvGetTickCount() / ((double)cvGetTickFrequency() * 1000.);
+}
+
+StreamStats::StreamStats()
+    : frames(0)
+    , totalTime(0)
+    , meanLatency(0)
+    , p50Latency(0)
+    , p95Latency(0)
+    , maxLatency(0)
+    , missedDeadlines(0)
+    , qualitySwitches(0)
+    , failed(false)
+{
+}
+
+/*
+Open the stream, from its first task: opening a named pipe waits for its writer
+@return false if the stream can not be read
+*/
+static bool openStream(StreamContext& stream)
+{
+    stream.opened = true;
+    if ( !stream.capture.open(stream.input) )
+    {
+        cerr << "[ERROR]: Could not open the stream \"" << stream.input << "\"" << endl;
+        stream.failed = true;
+        return false;
+    }
+    return true;
+}
+
+/*
+Stabilize the next frame of a stream, then submit the task of the following frame
+*/
+static void processNextFrame(TaskPool& pool, StreamContext& stream, const string& codec, int maxFrames,
+                             const StabilizerSettings& settings, volatile int& stopSignal)
+{
+    if ( !stream.opened && !openStream(stream) )
+    {
+        return;
+    }
+    if ( stopSignal || ( maxFrames > 0 && (int)stream.latencies.size() >= maxFrames ) )
+    {
+        return;
+    }
+    // A new Mat each frame: the stabilizer keeps a reference on the previous one
+    Mat frame;
+    stream.capture >> frame;
+    if ( frame.empty() )
+    {
+        return;
+    }
+
+    double stabilizationStart = now();
+    stream.stabilizer.stabilize(frame, stream.stabilizedFrame, settings.detectOverlay ? stream.overlay.process(frame) : Mat());
+    if ( settings.deadline > 0 )
+    {
+        stream.stabilizer.setQualityLevel(stream.quality.frameDone(now() - stabilizationStart));
+    }
+
+    if ( !stream.output.empty() )
+    {
+        if ( !stream.writer.isOpened() )
+        {
+            double framerate = stream.capture.get(CV_CAP_PROP_FPS);
+            stream.writer.open(stream.output, CV_FOURCC(codec[0], codec[1], codec[2], codec[3]),
+                               framerate > 0 ? framerate : STREAM_DEFAULT_FRAMERATE, frame.size(), true);
+            if ( !stream.writer.isOpened() )
+            {
+                cerr << "[ERROR]: Could not create the video named \"" << stream.output << "\"" << endl;
+                stream.output = "";
+            }
+        }
+        if ( stream.writer.isOpened() )
+        {
+            stream.writer << stream.stabilizedFrame;
+        }
+    }
+
+    stream.endTime = now();
+    stream.latencies.push_back(stream.endTime - stream.submitTime);
+    // The following frame waits behind the frames of the other streams
+    stream.submitTime = now();
+    pool.submit([&pool, &stream, &codec, maxFrames, &settings, &stopSignal]()
+    {
+        processNextFrame(pool, stream, codec, maxFrames, settings, stopSignal);
+    });
+}
+
+/*
+@param stream: a finished stream
+@param startTime: the start of the service
+@return its statistics
+*/
+static StreamStats getStreamStats(StreamContext& stream, double startTime)
+{
+    StreamStats stats;
+    stats.input = stream.input;
+    stats.failed = stream.failed;
+    stats.missedDeadlines = stream.quality.getMissedDeadlines();
+    stats.qualitySwitches = stream.quality.getSwitchCount();
+    stats.frames = stream.latencies.size();
+    if ( stats.frames == 0 )
+    {
+        return stats;
+    }
+    vector<double>& latencies = stream.latencies;
+    double sum = 0;
+    for ( size_t i = 0 ; i < latencies.size() ; i++ )
+    {
+        sum += latencies[i];
+    }
+    std::sort(latencies.begin(), latencies.end());
+    stats.totalTime = stream.endTime - startTime;
+    stats.meanLatency = sum / latencies.size();
+    stats.p50Latency = latencies[(latencies.size() - 1) / 2];
+    stats.p95Latency = latencies[(size_t)((latencies.size() - 1) * 0.95)];
+    stats.maxLatency = latencies.back();
+    return stats;
+}
+
+vector<StreamStats> runStreams(const vector<string>& inputs, const vector<string>& outputs, const string& codec, int threads,
+                               int maxFrames, const StabilizerSettings& settings, volatile int& stopSignal, long& stolenTasks)
+{
+    // The pool is the only parallelism: OpenCV runs its functions on the calling thread
+    int openCVThreads = getNumThreads();
+    setNumThreads(1);
+
+    double startTime = now();
+    vector<StreamContext> streams(inputs.size());
+    {
+        TaskPool pool(threads);
+        for ( size_t i = 0 ; i < streams.size() ; i++ )
+        {
+            StreamContext& stream = streams[i];
+            stream.input = inputs[i];
+            stream.output = i < outputs.size() ? outputs[i] : "";
+            stream.stabilizer = Stabilizer(settings);
+            stream.quality = QualityController(stream.input, settings.deadline);
+            stream.submitTime = startTime;
+            stream.endTime = startTime;
+            stream.opened = false;
+            stream.failed = false;
+            pool.submit([&pool, &stream, &codec, maxFrames, &settings, &stopSignal]()
+            {
+                processNextFrame(pool, stream, codec, maxFrames, settings, stopSignal);
+            });
+        }
+        pool.wait();
+        stolenTasks = pool.getStolenCount();
+    }
+    setNumThreads(openCVThreads);
+
+    vector<StreamStats> stats;
+    for ( size_t i = 0 ; i < streams.size() ; i++ )
+    {
+        stats.push_back(getStreamStats(streams[i], startTime));
+    }
+    return stats;
+}
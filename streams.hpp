@@ -0,0 +1,49 @@
+/*
+Stabilization of several video streams at once (camera feeds, as files or named pipes).
+Every stream has its own stabilization context (previous frame, masks, score overlay, output),
+and the streams share one work stealing pool: a task stabilizes the next frame of a stream,
+then submits the following one behind the tasks of the other streams. Each stream has one frame
+in flight at most, and the streams get one frame each in turn.
+*/
+
+#ifndef STREAMS_HPP
+#define STREAMS_HPP
+
+#include "stabilization.hpp"
+
+
+/*
+Statistics of a stream. The latency of a frame is the time from the moment its task is submitted
+(the previous frame is done) to the moment it is exported: the waiting time in the pool is included
+*/
+struct StreamStats
+{
+    string input;
+    int frames;
+    double totalTime;   // from the start of the service to the last frame, in ms
+    double meanLatency; // in ms
+    double p50Latency;
+    double p95Latency;
+    double maxLatency;
+    int missedDeadlines;    // real-time mode: frames stabilized in more time than the deadline
+    int qualitySwitches;
+    bool failed;        // the stream could not be opened
+
+    StreamStats();
+};
+
+/*
+@param inputs: the videos or named pipes to stabilize
+@param outputs: the stabilized videos, one per input (empty paths to disable the export)
+@param codec: fourcc of the stabilized videos
+@param threads: the number of threads of the pool
+@param maxFrames: stop every stream after this number of frames, 0 for the whole streams
+@param settings: the parameters of the stabilization, for every stream
+@param stopSignal: stop when it becomes non zero
+@param stolenTasks: filled with the number of tasks run by another thread than the one they were submitted to
+@return the statistics of every stream
+*/
+vector<StreamStats> runStreams(const vector<string>& inputs, const vector<string>& outputs, const string& codec, int threads,
+                               int maxFrames, const StabilizerSettings& settings, volatile int& stopSignal, long& stolenTasks);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+Synthetic soccer sequences with a known camera movement, for the benchmarks.
+*/
+
+#include "synthetic.hpp"
+
+#include <cmath>
+
+#define SYNTHETIC_PLAYERS 22
+
+
+struct SyntheticPlayer
+{
+    Point2f position;   // on the pitch
+    Point2f speed;      // pitch pixels per frame
+    Scalar shirt;
+};
+
+/*
+Camera of frame t: frame pixel x films the pitch pixel zoom * R(roll) x + offset
+*/
+struct SyntheticCamera
+{
+    double zoom;
+    double roll;
+    Point2d offset;
+};
+
+SyntheticMotion::SyntheticMotion()
+    : zoomAmplitude(0.1)
+    , rollNoise(0)
+{
+}
+
+/*
+The pitch: mowing stripes, noise, white lines, and colorful stands on the top
+@param size: the size of the pitch image
+*/
+static Mat generatePitch(Size size, RNG& rng)
+{
+    // Grass, inside the HSV range of detectGrass()
+    Mat pitch(size, CV_8UC3, Scalar(100, 160, 60));
+    int stripeWidth = MAX(size.width / 24, 1);
+    for ( int x = 0 ; x < size.width ; x += 2 * stripeWidth )
+    {
+        rectangle(pitch, Rect(x, 0, MIN(stripeWidth, size.width - x), size.height), Scalar(110, 175, 70), CV_FILLED);
+    }
+    Mat noise(size, CV_8UC3);
+    randn(noise, Scalar::all(0), Scalar::all(6));
+    pitch += noise;
+
+    // Field lines
+    int standsHeight = size.height / 4;
+    Rect field(size.width / 20, standsHeight + size.height / 20, size.width * 9 / 10, size.height - standsHeight - size.height / 10);
+    int lineWidth = MAX(size.height / 300, 2);
+    rectangle(pitch, field, Scalar(235, 235, 235), lineWidth);
+    line(pitch, Point(field.x + field.width / 2, field.y), Point(field.x + field.width / 2, field.y + field.height), Scalar(235, 235, 235), lineWidth);
+    circle(pitch, Point(field.x + field.width / 2, field.y + field.height / 2), field.height / 6, Scalar(235, 235, 235), lineWidth);
+
+    // The public: random colorful blocks
+    int block = MAX(size.height / 120, 2);
+    for ( int y = 0 ; y < standsHeight ; y += block )
+    {
+        for ( int x = 0 ; x < size.width ; x += block )
+        {
+            rectangle(pitch, Rect(x, y, block, block), Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256)), CV_FILLED);
+        }
+    }
+    return pitch;
+}
+
+static SyntheticCamera cameraAt(int frame, Size frameSize, Size pitchSize, const SyntheticMotion& motion, RNG& rollRng)
+{
+    SyntheticCamera camera;
+    camera.zoom = 1 + motion.zoomAmplitude * sin(frame / 40.);
+    camera.roll = motion.rollNoise > 0 ? rollRng.gaussian(motion.rollNoise) : 0;
+    camera.offset.x = (pitchSize.width - frameSize.width * camera.zoom) * (0.5 + 0.4 * sin(frame / 60.));
+    camera.offset.y = pitchSize.height * 0.15 + frameSize.height * 0.05 * sin(frame / 35.);
+    return camera;
+}
+
+/*
+@return the camera as a 3x3 matrix: frame pixel to pitch pixel
+*/
+static Mat cameraMatrix(const SyntheticCamera& camera)
+{
+    const double c = camera.zoom * cos(camera.roll), s = camera.zoom * sin(camera.roll);
+    return (Mat_<double>(3, 3) << c, -s, camera.offset.x, s, c, camera.offset.y, 0, 0, 1);
+}
+
+SyntheticSequence generateSyntheticSequence(Size frameSize, int frameCount, unsigned seed, const SyntheticMotion& motion)
+{
+    RNG rng(seed);
+    // Its own generator: the textures and players do not depend on the roll
+    RNG rollRng(seed + 1);
+    Size pitchSize(frameSize.width * 3, frameSize.height * 2);
+    Mat pitch = generatePitch(pitchSize, rng);
+
+    vector<SyntheticPlayer> players(SYNTHETIC_PLAYERS);
+    const Scalar shirts[] = { Scalar(40, 40, 200), Scalar(200, 80, 30), Scalar(20, 20, 20) };
+    for ( size_t i = 0 ; i < players.size() ; i++ )
+    {
+        players[i].position = Point2f(rng.uniform(0.1f, 0.9f) * pitchSize.width, rng.uniform(0.35f, 0.9f) * pitchSize.height);
+        players[i].speed = Point2f(rng.uniform(-3.f, 3.f), rng.uniform(-1.5f, 1.5f)) * (pitchSize.height / 1000.);
+        players[i].shirt = shirts[i % 3];
+    }
+    int playerRadius = MAX(frameSize.height / 45, 3);
+    double borderOffset = BORDER_WIDTH / 2; // addBlackBorder() shifts the frame by this on both axes
+
+    SyntheticSequence sequence;
+    SyntheticCamera previousCamera;
+    for ( int t = 0 ; t < frameCount ; t++ )
+    {
+        SyntheticCamera camera = cameraAt(t, frameSize, pitchSize, motion, rollRng);
+        Mat filming = cameraMatrix(camera);
+        Mat frame;
+        warpAffine(pitch, frame, filming.rowRange(0, 2), frameSize, INTER_LINEAR | WARP_INVERSE_MAP);
+
+        // Players, filmed by the camera
+        Mat toFrame = filming.inv();
+        for ( size_t i = 0 ; i < players.size() ; i++ )
+        {
+            players[i].position = players[i].position + players[i].speed;
+            const double* row0 = toFrame.ptr<double>(0);
+            const double* row1 = toFrame.ptr<double>(1);
+            Point2d onFrame(row0[0] * players[i].position.x + row0[1] * players[i].position.y + row0[2],
+                            row1[0] * players[i].position.x + row1[1] * players[i].position.y + row1[2]);
+            int radius = cvRound(playerRadius / camera.zoom);
+            ellipse(frame, Point(cvRound(onFrame.x), cvRound(onFrame.y)), Size(radius, 2 * radius), 0, 0, 360, players[i].shirt, CV_FILLED);
+        }
+
+        // Static score overlay, where detectScoreOverlayPanel() expects it
+        rectangle(frame, Rect(80, 40, 290, 40), Scalar(40, 20, 20), CV_FILLED);
+        putText(frame, "FRA 1 - 0 SWE   42:17", Point(90, 68), FONT_HERSHEY_SIMPLEX, 0.7, Scalar(255, 255, 255), 2);
+
+        sequence.frames.push_back(frame);
+
+        // Frame pixel p of t-1 and q of t film the same pitch pixel: q = C(t)^-1 C(t-1) p
+        Mat homography;
+        if ( t > 0 )
+        {
+            Mat H = toFrame * cameraMatrix(previousCamera);
+            // In the bordered coordinates: b + H(p - b)
+            const Mat border = (Mat_<double>(3, 3) << 1, 0, borderOffset, 0, 1, borderOffset, 0, 0, 1);
+            homography = Mat(border * H * border.inv()).rowRange(0, 2).clone();
+        }
+        sequence.homographies.push_back(homography);
+        previousCamera = camera;
+    }
+    return sequence;
+}
+
+double homographyError(const Mat estimated, const Mat groundTruth, Size frameSize)
+{
+    const Point2d corners[] = { Point2d(0, 0), Point2d(frameSize.width, 0), Point2d(0, frameSize.height), Point2d(frameSize.width, frameSize.height) };
+    double error = 0;
+    for ( int i = 0 ; i < 4 ; i++ )
+    {
+        const Point2d& c = corners[i];
+        double dx = 0, dy = 0;
+        for ( int col = 0 ; col < 3 ; col++ )
+        {
+            double coordinate = col == 0 ? c.x : ( col == 1 ? c.y : 1 );
+            dx += ( estimated.at<double>(0, col) - groundTruth.at<double>(0, col) ) * coordinate;
+            dy += ( estimated.at<double>(1, col) - groundTruth.at<double>(1, col) ) * coordinate;
+        }
+        error += sqrt(dx * dx + dy * dy);
+    }
+    return error / 4;
+}
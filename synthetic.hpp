@@ -0,0 +1,45 @@
+/*
+Synthetic soccer sequences with a known camera movement, for the benchmarks.
+A textured pitch with field lines and stands is filmed by a camera panning and zooming along a smooth path.
+Players move on the pitch, and a static score overlay is drawn over every frame.
+*/
+
+#ifndef SYNTHETIC_HPP
+#define SYNTHETIC_HPP
+
+#include "stabilization.hpp"
+
+
+// Camera path of a sequence
+struct SyntheticMotion
+{
+    double zoomAmplitude;   // relative zoom change along the path (0.1 by default, 0 to only pan)
+    double rollNoise;       // standard deviation of the camera roll of every frame (rad), 0 by default: a shaky camera
+
+    SyntheticMotion();
+};
+
+struct SyntheticSequence
+{
+    vector<Mat> frames;
+    // Ground truth movement of every frame, in the bordered coordinates used by the Stabilizer
+    // (the movement detected between the previous frame and this one, empty for the first frame)
+    vector<Mat> homographies;
+};
+
+/*
+@param frameSize: the resolution of the frames
+@param frameCount: the number of frames
+@param seed: the seed of the textures, players and camera roll
+@param motion: the camera path
+@return the generated sequence
+*/
+SyntheticSequence generateSyntheticSequence(Size frameSize, int frameCount, unsigned seed = 42,
+                                            const SyntheticMotion& motion = SyntheticMotion());
+
+/*
+@return the mean distance, in pixels, between the frame corners moved by the two movements
+*/
+double homographyError(const Mat estimated, const Mat groundTruth, Size frameSize);
+
+#endif
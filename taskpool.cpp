@@ -0,0 +1,150 @@
+/*
+Work stealing task pool.
+*/
+
+#include "taskpool.hpp"
+
+#include <exception>
+#include <iostream>
+
+
+// The pool and the worker of the calling thread, if it is a worker
+static thread_local TaskPool* currentPool = NULL;
+static thread_local int currentWorker = -1;
+
+TaskPool::TaskPool(int threads)
+    : queued(0)
+    , pending(0)
+    , nextWorker(0)
+    , stolen(0)
+    , stopping(false)
+{
+    threads = threads < 1 ? 1 : threads;
+    for ( int i = 0 ; i < threads ; i++ )
+    {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for ( int i = 0 ; i < threads ; i++ )
+    {
+        this->threads.push_back(std::thread(&TaskPool::run, this, i));
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    taskAdded.notify_all();
+    for ( size_t i = 0 ; i < threads.size() ; i++ )
+    {
+        threads[i].join();
+    }
+}
+
+void TaskPool::submit(const Task& task)
+{
+    int index = currentPool == this ? currentWorker : nextWorker++ % (int)workers.size();
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(task);
+    }
+    {
+        // Counted under the lock of the sleeping workers: a worker going to sleep sees it
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued++;
+    }
+    taskAdded.notify_one();
+}
+
+void TaskPool::wait()
+{
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    allDone.wait(lock, [this] { return pending == 0; });
+}
+
+int TaskPool::getThreadCount() const
+{
+    return threads.size();
+}
+
+long TaskPool::getStolenCount() const
+{
+    return stolen;
+}
+
+/*
+@param index: the worker looking for a task
+@param task: filled with the task
+@return false if every queue is empty
+*/
+bool TaskPool::takeTask(int index, Task& task)
+{
+    // The oldest task of its own queue
+    {
+        Worker& worker = *workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if ( !worker.tasks.empty() )
+        {
+            task = worker.tasks.front();
+            worker.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    // Or the newest task of another queue, starting from the next worker
+    const int count = workers.size();
+    for ( int offset = 1 ; offset < count ; offset++ )
+    {
+        Worker& victim = *workers[(index + offset) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if ( !victim.tasks.empty() )
+        {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            queued--;
+            stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::run(int index)
+{
+    currentPool = this;
+    currentWorker = index;
+    Task task;
+    while ( true )
+    {
+        if ( !takeTask(index, task) )
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            taskAdded.wait(lock, [this] { return queued > 0 || stopping; });
+            if ( stopping && queued == 0 )
+            {
+                return;
+            }
+            continue;
+        }
+
+        try
+        {
+            task();
+        }
+        catch ( const std::exception& exception )
+        {
+            std::cerr << "[ERROR]: A task failed: " << exception.what() << std::endl;
+        }
+        task = Task();
+
+        if ( --pending == 0 )
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            allDone.notify_all();
+        }
+    }
+}
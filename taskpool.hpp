@@ -0,0 +1,61 @@
+/*
+Work stealing task pool.
+Every worker thread has its own queue of tasks. A task submitted by a worker goes to its own queue,
+a task submitted from outside the pool goes to the queues in turn. A worker runs the tasks of its queue
+in order (oldest first); when it is empty, it steals the newest task of another queue.
+*/
+
+#ifndef TASKPOOL_HPP
+#define TASKPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class TaskPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // @param threads: the number of worker threads (at least 1)
+    explicit TaskPool(int threads);
+    // Wait for every task, then stop the workers
+    ~TaskPool();
+
+    void submit(const Task& task);
+    // Wait until every task is done, including the tasks they submitted
+    void wait();
+
+    int getThreadCount() const;
+    // Tasks run by another worker than the one they were submitted to
+    long getStolenCount() const;
+
+private:
+    struct Worker
+    {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+    };
+
+    void run(int index);
+    bool takeTask(int index, Task& task);
+
+    std::vector< std::unique_ptr<Worker> > workers;
+    std::vector<std::thread> threads;
+    std::mutex sleepMutex;
+    std::condition_variable taskAdded;
+    std::condition_variable allDone;
+    std::atomic<int> queued;    // tasks in the queues
+    std::atomic<int> pending;   // tasks submitted and not finished
+    std::atomic<int> nextWorker;
+    std::atomic<long> stolen;
+    bool stopping;
+};
+
+#endif
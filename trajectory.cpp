@@ -0,0 +1,230 @@
+/*
+Trajectory files: the movement detected for every frame of a video, with some quality metadata.
+*/
+
+#include "trajectory.hpp"
+
+#include <cstring>
+
+
+//*************************************************************************
+//                                 RECORD                                 *
+//*************************************************************************
+
+TrajectoryRecord::TrajectoryRecord()
+    : frameIndex(0)
+    , valid(0)
+    , reserved(0)
+    , trackCount(0)
+    , estimationTime(0)
+{
+    setHomography(Mat());
+}
+
+Mat TrajectoryRecord::getHomography() const
+{
+    Mat result(2, 3, CV_64F);
+    for ( int i = 0 ; i < 6 ; i++ )
+    {
+        result.at<double>(i / 3, i % 3) = homography[i];
+    }
+    return result;
+}
+
+void TrajectoryRecord::setHomography(const Mat homography)
+{
+    valid = !homography.empty();
+    for ( int i = 0 ; i < 6 ; i++ )
+    {
+        // Identity when there is no movement
+        this->homography[i] = valid ? homography.at<double>(i / 3, i % 3) : ( i == 0 || i == 4 ? 1 : 0 );
+    }
+}
+
+
+//*************************************************************************
+//                                 WRITER                                 *
+//*************************************************************************
+
+TrajectoryWriter::TrajectoryWriter()
+    : file(NULL)
+{
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    close();
+}
+
+bool TrajectoryWriter::open(const string& path, Size frameSize, double framerate, EstimationMode estimationMode)
+{
+    close();
+    file = fopen(path.c_str(), "wb");
+    if ( file == NULL )
+    {
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAJECTORY_MAGIC, 4);
+    header.version = TRAJECTORY_VERSION;
+    header.recordSize = sizeof(TrajectoryRecord);
+    header.frameWidth = frameSize.width;
+    header.frameHeight = frameSize.height;
+    header.framerate = framerate;
+    header.estimationMode = estimationMode;
+    header.frameCount = 0;
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool TrajectoryWriter::isOpened() const
+{
+    return file != NULL;
+}
+
+bool TrajectoryWriter::write(const TrajectoryRecord& record)
+{
+    if ( file == NULL || fwrite(&record, sizeof(record), 1, file) != 1 )
+    {
+        return false;
+    }
+    header.frameCount++;
+    return true;
+}
+
+void TrajectoryWriter::close()
+{
+    if ( file == NULL )
+    {
+        return;
+    }
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    file = NULL;
+}
+
+
+//*************************************************************************
+//                                 READER                                 *
+//*************************************************************************
+
+TrajectoryReader::TrajectoryReader()
+    : file(NULL)
+{
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+    close();
+}
+
+bool TrajectoryReader::open(const string& path)
+{
+    close();
+    file = fopen(path.c_str(), "rb");
+    if ( file == NULL )
+    {
+        return false;
+    }
+    if ( fread(&header, sizeof(header), 1, file) != 1
+         || memcmp(header.magic, TRAJECTORY_MAGIC, 4) != 0
+         || header.version != TRAJECTORY_VERSION
+         || header.recordSize != sizeof(TrajectoryRecord) )
+    {
+        cerr << "[ERROR]: \"" << path << "\" is not a trajectory file, or not of this version" << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool TrajectoryReader::isOpened() const
+{
+    return file != NULL;
+}
+
+void TrajectoryReader::close()
+{
+    if ( file != NULL )
+    {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+const TrajectoryHeader& TrajectoryReader::getHeader() const
+{
+    return header;
+}
+
+int TrajectoryReader::getFrameCount() const
+{
+    return (int)header.frameCount;
+}
+
+Size TrajectoryReader::getFrameSize() const
+{
+    return Size(header.frameWidth, header.frameHeight);
+}
+
+bool TrajectoryReader::read(int frameIndex, TrajectoryRecord& record)
+{
+    if ( file == NULL || frameIndex < 0 || frameIndex >= getFrameCount() )
+    {
+        return false;
+    }
+    long offset = sizeof(TrajectoryHeader) + (long)frameIndex * header.recordSize;
+    return fseek(file, offset, SEEK_SET) == 0 && fread(&record, sizeof(record), 1, file) == 1;
+}
+
+
+//*************************************************************************
+//                               RENDERING                                *
+//*************************************************************************
+
+/*
+applyHomography() maps each pixel x of the stabilized frame to the pixel A x + t of the frame.
+- at another resolution r, the frame pixel p is the trajectory pixel p / r: A x + r t
+- cropping at c: A (x + c) + r t
+- scaling the crop by s: A (x / s + c) + r t
+*/
+Mat adaptHomography(const Mat homography, double resolutionRatio, Rect crop, double outputScale)
+{
+    Mat adapted(2, 3, CV_64F);
+    for ( int row = 0 ; row < 2 ; row++ )
+    {
+        double a = homography.at<double>(row, 0);
+        double b = homography.at<double>(row, 1);
+        double t = homography.at<double>(row, 2);
+        adapted.at<double>(row, 0) = a / outputScale;
+        adapted.at<double>(row, 1) = b / outputScale;
+        adapted.at<double>(row, 2) = a * crop.x + b * crop.y + resolutionRatio * t;
+    }
+    return adapted;
+}
+
+int replayTrajectory(VideoCapture& videoBuffer, VideoWriter& exportVideoWriter, TrajectoryReader& trajectory,
+                     Rect crop, double outputScale, volatile int& stopSignal)
+{
+    Size frameSize(cvRound(crop.width * outputScale), cvRound(crop.height * outputScale));
+    int exportedFrames = 0;
+    Mat frame;
+    TrajectoryRecord record;
+    for ( int index = 0 ; index < trajectory.getFrameCount() && !stopSignal ; index++ )
+    {
+        videoBuffer >> frame;
+        if ( frame.empty() || !trajectory.read(index, record) )
+        {
+            break;
+        }
+        double resolutionRatio = (double)frame.cols / trajectory.getFrameSize().width;
+        Mat homography = adaptHomography(record.getHomography(), resolutionRatio, crop, outputScale);
+        Mat stabilizedFrame = applyHomography(frame, homography, frameSize);
+        if ( exportVideoWriter.isOpened() )
+        {
+            exportVideoWriter << stabilizedFrame;
+        }
+        exportedFrames++;
+    }
+    return exportedFrames;
+}
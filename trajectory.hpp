@@ -0,0 +1,116 @@
+/*
+Trajectory files: the movement detected for every frame of a video, with some quality metadata.
+A trajectory lets a video be rendered again (other resolution, crop...) without detecting its movements again.
+
+Layout (host byte order):
+    TrajectoryHeader
+    TrajectoryRecord x frameCount, one per frame, in order
+The records have a fixed size: the header is the index, record i is at
+sizeof(TrajectoryHeader) + i * recordSize.
+*/
+
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+#include <cstdio>
+#include <stdint.h>
+
+#include "stabilization.hpp"
+
+#define TRAJECTORY_MAGIC "STRJ"
+#define TRAJECTORY_VERSION 1
+
+
+#pragma pack(push, 1)
+struct TrajectoryHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t recordSize;
+    int32_t frameWidth;     // resolution of the frames used for the movement detection
+    int32_t frameHeight;
+    double framerate;
+    uint32_t estimationMode;
+    uint64_t frameCount;    // written when the file is closed
+};
+
+struct TrajectoryRecord
+{
+    int32_t frameIndex;
+    uint8_t valid;          // 0 when no movement was found (first frame, detection failure)
+    uint8_t reserved;
+    uint16_t trackCount;    // tracks used for the fit (tracking detection only)
+    float estimationTime;   // ms
+    double homography[6];   // the 2x3 movement, as returned by estimateRigidTransform
+
+    TrajectoryRecord();
+    // @return the movement, or the identity if the record is not valid
+    Mat getHomography() const;
+    void setHomography(const Mat homography);
+};
+#pragma pack(pop)
+
+
+class TrajectoryWriter
+{
+public:
+    TrajectoryWriter();
+    ~TrajectoryWriter();
+
+    bool open(const string& path, Size frameSize, double framerate, EstimationMode estimationMode);
+    bool isOpened() const;
+    bool write(const TrajectoryRecord& record);
+    // Write the frame count in the header
+    void close();
+
+private:
+    FILE* file;
+    TrajectoryHeader header;
+};
+
+class TrajectoryReader
+{
+public:
+    TrajectoryReader();
+    ~TrajectoryReader();
+
+    bool open(const string& path);
+    bool isOpened() const;
+    void close();
+
+    const TrajectoryHeader& getHeader() const;
+    int getFrameCount() const;
+    Size getFrameSize() const;
+
+    // Random access to the record of a frame
+    bool read(int frameIndex, TrajectoryRecord& record);
+
+private:
+    FILE* file;
+    TrajectoryHeader header;
+};
+
+/*
+Adapt a movement detected on frames of the trajectory resolution to another rendering
+@param homography: the movement of the trajectory
+@param resolutionRatio: width of the rendered video / width of the trajectory frames
+@param crop: the kept area of the stabilized frame, in the coordinates of the rendered video
+@param outputScale: scale applied to the cropped area
+@return the movement to give to applyHomography() to render the scaled crop directly
+*/
+Mat adaptHomography(const Mat homography, double resolutionRatio, Rect crop, double outputScale);
+
+/*
+Render the video again with the movements of a trajectory: decoding, moving and encoding only
+@param videoBuffer: the video, opened at its first frame
+@param exportVideoWriter: the rendered video, may not be opened
+@param trajectory: the opened trajectory of the video
+@param crop: the kept area of the stabilized frame, in the coordinates of the video
+@param outputScale: scale applied to the cropped area
+@param stopSignal: stop when it becomes non zero
+@return the number of exported frames
+*/
+int replayTrajectory(VideoCapture& videoBuffer, VideoWriter& exportVideoWriter, TrajectoryReader& trajectory,
+                     Rect crop, double outputScale, volatile int& stopSignal);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+Warp of the frames by the detected movement, with a kernel per motion model.
+*/
+
+#include "warp.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+/*
+Workspace of the kernels, per thread: grows to the widest frame, then is reused
+*/
+struct WarpBuffers
+{
+    std::vector<int> adelta;    // A(x)
+    std::vector<int> bdelta;    // B(x)
+    std::vector<int> columns;   // source column of every pixel of a row
+};
+
+static thread_local WarpBuffers warpBuffers;
+
+/*
+Fixed point coordinates of the columns, computed as warpAffine() does
+@param M: the movement (6 doubles)
+@param width: the width of the frame
+@return the model of the movement for this width
+*/
+static MotionModel computeColumnDeltas(const double* M, int width)
+{
+    std::vector<int>& adelta = warpBuffers.adelta;
+    std::vector<int>& bdelta = warpBuffers.bdelta;
+    if ( (int)adelta.size() < width )
+    {
+        adelta.resize(width);
+        bdelta.resize(width);
+    }
+    bool shifted = true, sameRow = true;
+    for ( int x = 0 ; x < width ; x++ )
+    {
+        adelta[x] = cvRound(M[0] * x * WARP_AB_SCALE);
+        bdelta[x] = cvRound(M[3] * x * WARP_AB_SCALE);
+        shifted = shifted && adelta[x] == x << WARP_AB_BITS;
+        sameRow = sameRow && bdelta[x] == 0;
+    }
+    if ( !sameRow )
+    {
+        return MOTION_AFFINE;
+    }
+    return shifted ? MOTION_TRANSLATION : MOTION_SIMILARITY;
+}
+
+/*
+Snap the movement to a cheaper model when its source pixels move by at most WARP_SNAP_TOLERANCE across the row
+@param M: the movement (6 doubles), modified
+@param width: the width of the frame
+@return the model of the snapped movement for this width
+*/
+static MotionModel snapCoefficients(double* M, int width)
+{
+    // The removed term is kept at the middle of the row: the source pixels move by at most half the row times
+    // the term, on each side. The source row drifts by M10 along the row, the source column by M00 - 1
+    const double halfSpan = MAX(width - 1, 0) / 2.;
+    if ( fabs(M[3]) * halfSpan <= WARP_SNAP_TOLERANCE )
+    {
+        M[5] += M[3] * halfSpan;
+        M[3] = 0;
+        if ( fabs(M[0] - 1) * halfSpan <= WARP_SNAP_TOLERANCE )
+        {
+            M[2] += ( M[0] - 1 ) * halfSpan;
+            M[0] = 1;
+        }
+    }
+    return computeColumnDeltas(M, width);
+}
+
+/*
+@param homography: the movement (2x3)
+@param M: filled with its coefficients
+*/
+static void getCoefficients(const Mat homography, double M[6])
+{
+    CV_Assert( homography.rows == 2 && homography.cols == 3 );
+    Mat coefficients(2, 3, CV_64F, M);
+    homography.convertTo(coefficients, CV_64F);
+}
+
+MotionModel classifyMotion(const Mat homography, Size size)
+{
+    double M[6];
+    getCoefficients(homography, M);
+    return snapCoefficients(M, size.width);
+}
+
+MotionModel classifyMotion(const Mat homography, Size size, Mat& snapped)
+{
+    snapped.create(2, 3, CV_64F);
+    double* M = snapped.ptr<double>(0);
+    getCoefficients(homography, M);
+    MotionModel model = snapCoefficients(M, size.width);
+    if ( model == MOTION_AFFINE )
+    {
+        // Left to warpAffine() as it is
+        getCoefficients(homography, M);
+    }
+    return model;
+}
+
+
+//*************************************************************************
+//                                KERNELS                                 *
+//*************************************************************************
+
+/*
+Translation: the row y is the source row Y0(y) >> 10 shifted by X0(y) >> 10, black outside of the frame
+*/
+static void warpTranslationRows(const Mat& frame, const double* M, Mat& warped)
+{
+    const int width = frame.cols, height = frame.rows;
+    const size_t pixelSize = frame.elemSize();
+    for ( int y = 0 ; y < height ; y++ )
+    {
+        uchar* dst = warped.ptr<uchar>(y);
+        int X0 = cvRound((M[1] * y + M[2]) * WARP_AB_SCALE) + WARP_AB_SCALE / 2;
+        int Y0 = cvRound((M[4] * y + M[5]) * WARP_AB_SCALE) + WARP_AB_SCALE / 2;
+        int sourceRow = Y0 >> WARP_AB_BITS;
+        int shift = X0 >> WARP_AB_BITS;
+        // Columns of the row taken from the frame
+        int first = MIN(MAX(-shift, 0), width);
+        int last = MAX(MIN(width - shift, width), first);
+        if ( sourceRow < 0 || sourceRow >= height )
+        {
+            first = last = 0;
+        }
+        memset(dst, 0, first * pixelSize);
+        if ( last > first )
+        {
+            memcpy(dst + first * pixelSize, frame.ptr<uchar>(sourceRow) + (first + shift) * pixelSize, (last - first) * pixelSize);
+        }
+        memset(dst + last * pixelSize, 0, (width - last) * pixelSize);
+    }
+}
+
+/*
+Source columns of a row: (X0 + A(x)) >> 10
+*/
+static void computeRowColumns(int X0, int width, int* columns)
+{
+    const int* adelta = &warpBuffers.adelta[0];
+    int x = 0;
+#if defined(__SSE2__)
+    {
+        const __m128i origin = _mm_set1_epi32(X0);
+        for ( ; x <= width - 4 ; x += 4 )
+        {
+            __m128i delta = _mm_loadu_si128((const __m128i*)(adelta + x));
+            _mm_storeu_si128((__m128i*)(columns + x), _mm_srai_epi32(_mm_add_epi32(origin, delta), WARP_AB_BITS));
+        }
+    }
+#endif
+    for ( ; x < width ; x++ )
+    {
+        columns[x] = ( X0 + adelta[x] ) >> WARP_AB_BITS;
+    }
+}
+
+#if defined(__AVX2__)
+/*
+Copy the source pixels of a row 8 at a time: a 32 bit word is gathered at each source column,
+the columns outside of the frame are masked and give black pixels.
+A word reads past its pixel, up to 3 bytes: the source row must not be the last row of the frame
+@param src: the source row
+@param columns: the source column of every pixel of the row
+@param width: the width of the row
+@param dst: the row to fill
+@return the first pixel left to the scalar loop
+*/
+template<int channels>
+static int gatherRowAVX2(const uchar* src, const int* columns, int width, uchar* dst)
+{
+    const __m256i limit = _mm256_set1_epi32(width);
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+    const int* words = (const int*)src;
+    int x = 0;
+    if ( channels == 3 )
+    {
+        // The 3 bytes of each pixel packed at the start of each 128 bit half: 12 bytes per half
+        const __m256i packPixels = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                                    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        // The second half is written 16 bytes at 12 bytes from the first one: the row must hold 28 bytes
+        for ( ; x <= width - 10 ; x += 8 )
+        {
+            __m256i column = _mm256_loadu_si256((const __m256i*)(columns + x));
+            __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi32(limit, column), _mm256_cmpgt_epi32(column, minusOne));
+            __m256i offset = _mm256_add_epi32(column, _mm256_add_epi32(column, column));
+            __m256i pixels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words, offset, inside, 1);
+            pixels = _mm256_shuffle_epi8(pixels, packPixels);
+            _mm_storeu_si128((__m128i*)(dst + 3 * x), _mm256_castsi256_si128(pixels));
+            _mm_storeu_si128((__m128i*)(dst + 3 * x + 12), _mm256_extracti128_si256(pixels, 1));
+        }
+    }
+    else
+    {
+        const __m256i lowByte = _mm256_set1_epi32(0xFF);
+        for ( ; x <= width - 8 ; x += 8 )
+        {
+            __m256i column = _mm256_loadu_si256((const __m256i*)(columns + x));
+            __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi32(limit, column), _mm256_cmpgt_epi32(column, minusOne));
+            __m256i pixels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words, column, inside, 1);
+            pixels = _mm256_and_si256(pixels, lowByte);
+            // Narrowed to bytes: lanes 0-3 in the low 4 bytes of each 128 bit half
+            pixels = _mm256_packus_epi16(_mm256_packus_epi32(pixels, pixels), _mm256_packus_epi32(pixels, pixels));
+            int low = _mm256_cvtsi256_si32(pixels);
+            int high = _mm_cvtsi128_si32(_mm256_extracti128_si256(pixels, 1));
+            memcpy(dst + x, &low, 4);
+            memcpy(dst + x + 4, &high, 4);
+        }
+    }
+    return x;
+}
+#endif
+
+/*
+Similarity: the row y is resampled from the source row Y0(y) >> 10, black outside of the frame
+*/
+template<int channels>
+static void warpSimilarityRows(const Mat& frame, const double* M, Mat& warped)
+{
+    const int width = frame.cols, height = frame.rows;
+    std::vector<int>& columns = warpBuffers.columns;
+    if ( (int)columns.size() < width )
+    {
+        columns.resize(width);
+    }
+    for ( int y = 0 ; y < height ; y++ )
+    {
+        uchar* dst = warped.ptr<uchar>(y);
+        int Y0 = cvRound((M[4] * y + M[5]) * WARP_AB_SCALE) + WARP_AB_SCALE / 2;
+        int sourceRow = Y0 >> WARP_AB_BITS;
+        if ( sourceRow < 0 || sourceRow >= height )
+        {
+            memset(dst, 0, width * channels);
+            continue;
+        }
+        const uchar* src = frame.ptr<uchar>(sourceRow);
+        computeRowColumns(cvRound((M[1] * y + M[2]) * WARP_AB_SCALE) + WARP_AB_SCALE / 2, width, &columns[0]);
+        int x = 0;
+#if defined(__AVX2__)
+        if ( sourceRow < height - 1 )
+        {
+            x = gatherRowAVX2<channels>(src, &columns[0], width, dst);
+        }
+#endif
+        for ( ; x < width ; x++ )
+        {
+            const int column = columns[x];
+            uchar* pixel = dst + x * channels;
+            if ( (unsigned)column < (unsigned)width )
+            {
+                const uchar* source = src + column * channels;
+                for ( int c = 0 ; c < channels ; c++ )
+                {
+                    pixel[c] = source[c];
+                }
+            }
+            else
+            {
+                for ( int c = 0 ; c < channels ; c++ )
+                {
+                    pixel[c] = 0;
+                }
+            }
+        }
+    }
+}
+
+template<>
+void warpNearest<MOTION_TRANSLATION>(const Mat& frame, const Mat& homography, Mat& warped)
+{
+    double M[6];
+    getCoefficients(homography, M);
+    CV_Assert( snapCoefficients(M, frame.cols) == MOTION_TRANSLATION );
+    CV_Assert( warped.empty() || warped.data != frame.data );
+    warped.create(frame.size(), frame.type());
+    warpTranslationRows(frame, M, warped);
+}
+
+template<>
+void warpNearest<MOTION_SIMILARITY>(const Mat& frame, const Mat& homography, Mat& warped)
+{
+    double M[6];
+    getCoefficients(homography, M);
+    CV_Assert( snapCoefficients(M, frame.cols) != MOTION_AFFINE );
+    CV_Assert( frame.type() == CV_8U || frame.type() == CV_8UC3 );
+    CV_Assert( warped.empty() || warped.data != frame.data );
+    warped.create(frame.size(), frame.type());
+    if ( frame.channels() == 3 )
+    {
+        warpSimilarityRows<3>(frame, M, warped);
+    }
+    else
+    {
+        warpSimilarityRows<1>(frame, M, warped);
+    }
+}
+
+template<>
+void warpNearest<MOTION_AFFINE>(const Mat& frame, const Mat& homography, Mat& warped)
+{
+    warpAffine(frame, warped, homography, frame.size(), INTER_NEAREST | WARP_INVERSE_MAP);
+}
+
+void warpNearest(const Mat& frame, const Mat& homography, Mat& warped)
+{
+    switch ( classifyMotion(homography, frame.size()) )
+    {
+        case MOTION_TRANSLATION:
+            warpNearest<MOTION_TRANSLATION>(frame, homography, warped);
+            break;
+        case MOTION_SIMILARITY:
+            warpNearest<MOTION_SIMILARITY>(frame, homography, warped);
+            break;
+        default:
+            warpNearest<MOTION_AFFINE>(frame, homography, warped);
+            break;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+Warp of the frames by the detected movement, with a kernel per motion model.
+Same result as warpAffine(frame, warped, homography, frame.size(), INTER_NEAREST | WARP_INVERSE_MAP),
+which maps the pixel (x, y) of the warped frame to the pixel ((X0(y) + A(x)) >> 10, (Y0(y) + B(x)) >> 10)
+of the frame, with the fixed point coordinates:
+    A(x) = round(M00 x 1024)              B(x) = round(M10 x 1024)
+    X0(y) = round((M01 y + M02) 1024) + 512   Y0(y) = round((M11 y + M12) 1024) + 512
+Soccer cameras pan and zoom, and barely rotate, so most movements fall in the cheaper models:
+    - translation: A(x) = 1024 x and B(x) = 0, each row is a shifted copy of a source row (memcpy)
+    - similarity: B(x) = 0, each row is resampled from one source row (zoom, no visible rotation)
+    - affine: anything else, left to warpAffine()
+The estimated movements are never exactly of a cheaper model: they carry a small rotation and scale from the
+estimation noise, and the camera zooms. A movement whose source pixels stay within WARP_SNAP_TOLERANCE of the
+ones of a cheaper model, across the whole row, is snapped to it: M10 = 0, then M00 = 1, the removed terms taken
+at the middle of the row (M12 += M10 (w - 1) / 2, M02 += (M00 - 1) (w - 1) / 2).
+The kernels give the exact result of warpAffine() for the snapped movement. Against the movement itself,
+a source pixel moves by at most WARP_SNAP_TOLERANCE on each axis.
+Each model has its own kernel, chosen at compile time by a template parameter.
+*/
+
+#ifndef WARP_HPP
+#define WARP_HPP
+
+#include <opencv2/core/core.hpp>
+
+using namespace cv;
+
+// Fixed point precision of the coordinates in warpAffine()
+#define WARP_AB_BITS 10
+#define WARP_AB_SCALE (1 << WARP_AB_BITS)
+// Error budget of the snap: the largest move (px) of a source pixel when a movement is snapped to a cheaper model.
+// Half a pixel, the rounding of the nearest neighbour warp itself: for a 1920 px wide frame, a rotation or a zoom
+// under 5e-4 per frame is snapped
+#define WARP_SNAP_TOLERANCE 0.5
+
+
+enum MotionModel
+{
+    MOTION_TRANSLATION, // rows shifted
+    MOTION_SIMILARITY,  // rows resampled
+    MOTION_AFFINE       // anything else
+};
+
+/*
+@param homography: a movement, as returned by estimateRigidTransform (2x3)
+@param size: the size of the frames to warp
+@return the cheapest model of this movement and size, within WARP_SNAP_TOLERANCE
+*/
+MotionModel classifyMotion(const Mat homography, Size size);
+/*
+Same as above
+@param snapped: filled with the movement snapped to its model (2x3 CV_64F): the kernel gives the exact
+                result of warpAffine() for it
+*/
+MotionModel classifyMotion(const Mat homography, Size size, Mat& snapped);
+
+/*
+Warp a frame with the kernel of a model
+@param frame: the frame to warp (CV_8U or CV_8UC3)
+@param homography: the movement (2x3, of this model within the tolerance: see classifyMotion())
+@param warped: filled with the warped frame (not sharing the data of the frame)
+*/
+template<MotionModel model>
+void warpNearest(const Mat& frame, const Mat& homography, Mat& warped);
+template<> void warpNearest<MOTION_TRANSLATION>(const Mat& frame, const Mat& homography, Mat& warped);
+template<> void warpNearest<MOTION_SIMILARITY>(const Mat& frame, const Mat& homography, Mat& warped);
+template<> void warpNearest<MOTION_AFFINE>(const Mat& frame, const Mat& homography, Mat& warped);
+
+// Same as above, with the kernel of the model of the movement
+void warpNearest(const Mat& frame, const Mat& homography, Mat& warped);
+
+#endif